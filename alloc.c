@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "alloc.h"
+
+/* Raw blocks carry their size and owner in a header in front of the payload.
+ * The header is 16 bytes so the payload keeps malloc's alignment. */
+union memHeader {
+    struct {
+        size_t bytes;
+        int subsystem;
+    } info;
+    char pad[16];
+};
+
+/* the last slot holds the totals over all subsystems */
+static struct memUsage usages[MEM_SUBSYSTEMS + 1];
+/* per thread; workers of parallelFor() start in their caller's subsystem */
+static __thread enum memSubsystem current = MEM_MODULE;
+/* per thread too, so concurrent callers each see their own failures */
+static __thread struct memFailure failure;
+static int budgetConfigured = 0;
+static size_t budget = 0;
+
+const char *memSubsystemNames[MEM_SUBSYSTEMS] = {"parse", "affinity", "eigen", "kmeans", "output", "module"};
+
+enum memSubsystem memEnter(enum memSubsystem subsystem) {
+    enum memSubsystem previous = current;
+
+    current = subsystem;
+    return previous;
+}
+
+void memLeave(enum memSubsystem previous) {
+    current = previous;
+}
+
+enum memSubsystem memCurrent(void) {
+    return current;
+}
+
+/* The budget comes from SPKMEANS_MEMORY_BUDGET (in bytes) unless
+ * setMemoryBudget() was called first. 0 means unlimited. */
+void setMemoryBudget(size_t bytes) {
+    budgetConfigured = 1;
+    budget = bytes;
+}
+
+size_t getMemoryBudget(void) {
+    char *bytes;
+
+    if (!budgetConfigured) {
+        bytes = getenv(ALLOC_BUDGET_ENV);
+        setMemoryBudget(bytes != NULL ? (size_t) strtoul(bytes, NULL, 10) : 0);
+    }
+
+    return budget;
+}
+
+static void raisePeak(struct memUsage *usage, size_t inUse) {
+    size_t peak = usage->peak;
+
+    while (inUse > peak && !__sync_bool_compare_and_swap(&usage->peak, peak, inUse)) {
+        peak = usage->peak;
+    }
+}
+
+/* Charges bytes to the current subsystem and returns it, or -1 when that
+ * would take the process past its memory budget, which is reported through
+ * printErrorDetail(). Safe to call from the workers of parallelFor(). */
+int memReserve(size_t bytes) {
+    struct memUsage *total = &usages[MEM_SUBSYSTEMS], *usage = &usages[current];
+    size_t limit = getMemoryBudget(), inUse;
+
+    inUse = __sync_add_and_fetch(&total->inUse, bytes);
+    if (limit > 0 && inUse > limit) {
+        __sync_sub_and_fetch(&total->inUse, bytes);
+        failure.kind = MEM_FAILURE_BUDGET;
+        sprintf(failure.message, "Memory budget of %lu bytes exceeded: %s requested %lu bytes with %lu in use",
+                (unsigned long) limit, memSubsystemNames[current], (unsigned long) bytes,
+                (unsigned long) (inUse - bytes));
+        printErrorDetail(failure.message);
+        return -1;
+    }
+
+    __sync_add_and_fetch(&total->allocations, 1);
+    raisePeak(total, inUse);
+
+    inUse = __sync_add_and_fetch(&usage->inUse, bytes);
+    __sync_add_and_fetch(&usage->allocations, 1);
+    raisePeak(usage, inUse);
+
+    return current;
+}
+
+void memRelease(enum memSubsystem subsystem, size_t bytes) {
+    __sync_sub_and_fetch(&usages[MEM_SUBSYSTEMS].inUse, bytes);
+    __sync_add_and_fetch(&usages[MEM_SUBSYSTEMS].frees, 1);
+    __sync_sub_and_fetch(&usages[subsystem].inUse, bytes);
+    __sync_add_and_fetch(&usages[subsystem].frees, 1);
+}
+
+/* The last allocation of the calling thread that failed, by the budget or
+ * by malloc, since memClearFailure(); its kind is MEM_FAILURE_NONE when
+ * there was none */
+const struct memFailure * memLastFailure(void) {
+    return &failure;
+}
+
+void memClearFailure(void) {
+    failure.kind = MEM_FAILURE_NONE;
+}
+
+/* Moves the calling thread's failure into taken, for a worker to hand it
+ * to the thread that waits for it */
+void memTakeFailure(struct memFailure *taken) {
+    *taken = failure;
+    memClearFailure();
+}
+
+/* Records a failure taken from a worker unless one is already recorded */
+void memRaiseFailure(const struct memFailure *raised) {
+    if (raised->kind != MEM_FAILURE_NONE && failure.kind == MEM_FAILURE_NONE) {
+        failure = *raised;
+    }
+}
+
+static void systemFailure(int subsystem, size_t bytes) {
+    failure.kind = MEM_FAILURE_SYSTEM;
+    sprintf(failure.message, "Out of memory: %s requested %lu bytes", memSubsystemNames[subsystem],
+            (unsigned long) bytes);
+}
+
+void * memAlloc(size_t bytes) {
+    union memHeader *header;
+    int subsystem = memReserve(bytes);
+
+    if (subsystem < 0) {
+        return NULL;
+    }
+
+    header = malloc(sizeof(union memHeader) + bytes);
+    if (header == NULL) {
+        systemFailure(subsystem, bytes);
+        memRelease(subsystem, bytes);
+        return NULL;
+    }
+
+    header->info.bytes = bytes;
+    header->info.subsystem = subsystem;
+    return header + 1;
+}
+
+void * memCalloc(size_t count, size_t size) {
+    void *ptr = memAlloc(count * size);
+
+    if (ptr != NULL) {
+        memset(ptr, 0, count * size);
+    }
+
+    return ptr;
+}
+
+/* Grows or shrinks a block, which stays charged to its original subsystem */
+void * memRealloc(void *ptr, size_t bytes) {
+    union memHeader *header, *grown;
+    enum memSubsystem previous;
+    size_t oldBytes;
+
+    if (ptr == NULL) {
+        return memAlloc(bytes);
+    }
+
+    header = (union memHeader *) ptr - 1;
+    oldBytes = header->info.bytes;
+
+    previous = memEnter((enum memSubsystem) header->info.subsystem);
+    if (memReserve(bytes) < 0) {
+        memLeave(previous);
+        return NULL;
+    }
+    memLeave(previous);
+
+    grown = realloc(header, sizeof(union memHeader) + bytes);
+    if (grown == NULL) {
+        systemFailure(header->info.subsystem, bytes);
+        memRelease((enum memSubsystem) header->info.subsystem, bytes);
+        return NULL;
+    }
+
+    memRelease((enum memSubsystem) grown->info.subsystem, oldBytes);
+    grown->info.bytes = bytes;
+    return grown + 1;
+}
+
+void memFree(void *ptr) {
+    union memHeader *header;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    header = (union memHeader *) ptr - 1;
+    memRelease((enum memSubsystem) header->info.subsystem, header->info.bytes);
+    free(header);
+}
+
+/* MEM_SUBSYSTEMS selects the totals */
+void getMemoryUsage(int subsystem, struct memUsage *usage) {
+    *usage = usages[subsystem];
+}
+
+/* Starts a new peak measurement from what is live right now */
+void resetMemoryPeaks(void) {
+    int i;
+
+    for (i = 0; i <= MEM_SUBSYSTEMS; i++) {
+        usages[i].peak = usages[i].inUse;
+    }
+}
+
+static void printUsageJson(FILE *fp, struct memUsage *usage) {
+    fprintf(fp, "{\"in_use\": %lu, \"peak\": %lu, \"allocations\": %ld, \"frees\": %ld}",
+            (unsigned long) usage->inUse, (unsigned long) usage->peak, usage->allocations, usage->frees);
+}
+
+void printMemoryJson(FILE *fp) {
+    int i;
+
+    fprintf(fp, "{\"budget\": %lu, \"total\": ", (unsigned long) getMemoryBudget());
+    printUsageJson(fp, &usages[MEM_SUBSYSTEMS]);
+
+    for (i = 0; i < MEM_SUBSYSTEMS; i++) {
+        fprintf(fp, ", \"%s\": ", memSubsystemNames[i]);
+        printUsageJson(fp, &usages[i]);
+    }
+
+    fprintf(fp, "}");
+}
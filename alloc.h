@@ -0,0 +1,79 @@
+# ifndef ALLOC_H_
+# define ALLOC_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define ALLOC_BUDGET_ENV "SPKMEANS_MEMORY_BUDGET"
+/* room for a failure message with four 20 digit numbers */
+#define MEM_MESSAGE_LEN 160
+
+/* Every C-side allocation is charged to the subsystem that is current when
+ * it is made; frees are credited back to the same subsystem. */
+enum memSubsystem {
+    MEM_PARSE,
+    MEM_AFFINITY,
+    MEM_EIGEN,
+    MEM_KMEANS,
+    MEM_OUTPUT,
+    MEM_MODULE,
+    MEM_SUBSYSTEMS
+};
+
+enum memFailureKind {
+    MEM_FAILURE_NONE,
+    MEM_FAILURE_BUDGET,
+    MEM_FAILURE_SYSTEM
+};
+
+struct memFailure {
+    int kind;
+    char message[MEM_MESSAGE_LEN];
+};
+
+struct memUsage {
+    size_t inUse;
+    size_t peak;
+    long allocations;
+    long frees;
+};
+
+extern const char *memSubsystemNames[MEM_SUBSYSTEMS];
+
+enum memSubsystem memEnter(enum memSubsystem subsystem);
+
+void memLeave(enum memSubsystem previous);
+
+enum memSubsystem memCurrent(void);
+
+int memReserve(size_t bytes);
+
+void memRelease(enum memSubsystem subsystem, size_t bytes);
+
+const struct memFailure * memLastFailure(void);
+
+void memClearFailure(void);
+
+void memTakeFailure(struct memFailure *taken);
+
+void memRaiseFailure(const struct memFailure *raised);
+
+void * memAlloc(size_t bytes);
+
+void * memCalloc(size_t count, size_t size);
+
+void * memRealloc(void *ptr, size_t bytes);
+
+void memFree(void *ptr);
+
+void setMemoryBudget(size_t bytes);
+
+size_t getMemoryBudget(void);
+
+void getMemoryUsage(int subsystem, struct memUsage *usage);
+
+void resetMemoryPeaks(void);
+
+void printMemoryJson(FILE *fp);
+
+#endif
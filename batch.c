@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "cache.h"
+#include "outofcore.h"
+#include "stats.h"
+#include "spkmeans.h"
+#include "batch.h"
+
+struct batchJob {
+    struct spkBatch *batch;
+    struct spkResult **results;
+    struct matrixPool pools[PARALLEL_MAX_THREADS];
+};
+
+/* One problem on a view of its rows. The worker's matrix pool is active for
+ * the duration, so Jacobi's same-shaped temporaries are recycled instead of
+ * going back to malloc. */
+static void solveProblem(void *ctx, int worker, int index) {
+    struct batchJob *job = ctx;
+    struct spkBatch *batch = job->batch;
+    struct matrix view = *batch->points;
+    int k = batch->ks == NULL ? 0 : batch->ks[index];
+
+    view.rows = batch->offsets[index + 1] - batch->offsets[index];
+    view.data = MAT_ROW(batch->points, batch->offsets[index]);
+    if (view.rows < 1 || k < 0 || k > view.rows) {
+        job->results[index] = NULL;
+        return;
+    }
+
+    statsMuted = 1;
+    useMatrixPool(&job->pools[worker]);
+    job->results[index] = spk(&view, k);
+    useMatrixPool(NULL);
+    statsMuted = 0;
+}
+
+void freeSpkBatchResult(struct spkBatchResult *result) {
+    memFree(result->k);
+    memFree(result->status);
+    memFree(result->labels);
+    memFree(result->centroidOffsets);
+    memFree(result->indexes);
+    memFree(result->centroidValues);
+    memFree(result->centroids);
+    memset(result, 0, sizeof(struct spkBatchResult));
+}
+
+/* Lays the per-problem results out in the packed arrays */
+static int packResults(struct spkBatch *batch, struct spkBatchResult *result, struct spkResult **results) {
+    struct spkResult *problem;
+    int i, j, c, rows = batch->offsets[batch->count];
+    int clusters = 0, values = 0;
+
+    for (i = 0; i < batch->count; i++) {
+        if (results[i] != NULL) {
+            clusters += results[i]->k;
+            values += results[i]->k * results[i]->k;
+        }
+    }
+
+    result->labels = memAlloc((rows > 0 ? rows : 1) * sizeof(int));
+    result->indexes = memAlloc((clusters > 0 ? clusters : 1) * sizeof(int));
+    result->centroids = memAlloc((values > 0 ? values : 1) * sizeof(double));
+    if (result->labels == NULL || result->indexes == NULL || result->centroids == NULL) {
+        return 1;
+    }
+
+    result->centroidOffsets[0] = 0;
+    result->centroidValues[0] = 0;
+    for (i = 0; i < batch->count; i++) {
+        problem = results[i];
+        result->k[i] = problem == NULL ? 0 : problem->k;
+        result->status[i] = problem == NULL;
+        result->failed += problem == NULL;
+        result->centroidOffsets[i + 1] = result->centroidOffsets[i] + result->k[i];
+        result->centroidValues[i + 1] = result->centroidValues[i] + result->k[i] * result->k[i];
+
+        for (j = batch->offsets[i]; j < batch->offsets[i + 1]; j++) {
+            result->labels[j] = problem == NULL ? -1 : problem->labels[j - batch->offsets[i]];
+        }
+
+        for (c = 0; c < result->k[i]; c++) {
+            result->indexes[result->centroidOffsets[i] + c] = problem->indexes[c];
+            memcpy(result->centroids + result->centroidValues[i] + c * result->k[i],
+                   MAT_ROW(problem->centroids, c), result->k[i] * sizeof(double));
+        }
+    }
+
+    return 0;
+}
+
+/* Clusters every problem of the batch, spread over the threads with work
+ * stealing since problem sizes vary. A problem that fails (bad k or rows,
+ * allocation failure) is reported in status and does not stop the others.
+ * Returns 0 unless the batch as a whole could not run. */
+int spkBatchRun(struct spkBatch *batch, struct spkBatchResult *result) {
+    struct batchJob *job;
+    double start = monotonicMs();
+    int i, failed;
+
+    memset(result, 0, sizeof(struct spkBatchResult));
+    for (i = 0; i < batch->count; i++) {
+        if (batch->offsets[i + 1] < batch->offsets[i] || batch->offsets[i] < 0 ||
+            batch->offsets[i + 1] > batch->points->rows) {
+            printErrorMessage();
+            return 1;
+        }
+    }
+
+    job = memCalloc(1, sizeof(struct batchJob));
+    result->count = batch->count;
+    result->k = memAlloc((batch->count + 1) * sizeof(int));
+    result->status = memAlloc((batch->count + 1) * sizeof(int));
+    result->centroidOffsets = memAlloc((batch->count + 1) * sizeof(int));
+    result->centroidValues = memAlloc((batch->count + 1) * sizeof(int));
+    if (job == NULL || result->k == NULL || result->status == NULL || result->centroidOffsets == NULL ||
+        result->centroidValues == NULL) {
+        printErrorMessage();
+        memFree(job);
+        freeSpkBatchResult(result);
+        return 1;
+    }
+
+    job->batch = batch;
+    job->results = memCalloc(batch->count + 1, sizeof(struct spkResult *));
+    if (job->results == NULL) {
+        printErrorMessage();
+        memFree(job);
+        freeSpkBatchResult(result);
+        return 1;
+    }
+
+    /* settle the lazily read configuration before the workers look at it */
+    cacheEnabled();
+    outOfCoreEnabled();
+
+    parallelForEach(batch->count, solveProblem, job);
+
+    for (i = 0; i < PARALLEL_MAX_THREADS; i++) {
+        drainMatrixPool(&job->pools[i]);
+    }
+
+    failed = packResults(batch, result, job->results);
+    for (i = 0; i < batch->count; i++) {
+        freeSpkResult(job->results[i]);
+    }
+
+    memFree(job->results);
+    memFree(job);
+    if (failed) {
+        printErrorMessage();
+        freeSpkBatchResult(result);
+        return 1;
+    }
+
+    result->elapsedMs = monotonicMs() - start;
+    return 0;
+}
@@ -0,0 +1,38 @@
+# ifndef BATCH_H_
+# define BATCH_H_
+
+#include "matrix.h"
+
+/* Many independent spk problems over one packed matrix: problem i is rows
+ * offsets[i] to offsets[i + 1] of points, clustered into ks[i] clusters
+ * (0, or ks == NULL, picks k by the eigengap heuristic). */
+struct spkBatch {
+    int count;
+    const int *offsets;
+    struct matrix *points;
+    const int *ks;
+};
+
+/* Packed results. Problem i has k[i] clusters and status[i] (0 on success,
+ * a failed problem has k 0). Its labels are labels[offsets[i]..offsets[i + 1]).
+ * Its initial centroid indexes (relative to the problem's first row) are
+ * indexes[centroidOffsets[i]..centroidOffsets[i + 1]), one per cluster. Its
+ * k x k centroids are packed row by row from centroids[centroidValues[i]]. */
+struct spkBatchResult {
+    int count;
+    int failed;
+    int *k;
+    int *status;
+    int *labels;
+    int *centroidOffsets;
+    int *indexes;
+    int *centroidValues;
+    double *centroids;
+    double elapsedMs;
+};
+
+int spkBatchRun(struct spkBatch *batch, struct spkBatchResult *result);
+
+void freeSpkBatchResult(struct spkBatchResult *result);
+
+#endif
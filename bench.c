@@ -0,0 +1,466 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "utils.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "kmeans.h"
+
+#define BENCH_MAX_SIZES 32
+#define BENCH_MAX_RECORDS 1024
+#define BENCH_PATH_LEN 1024
+#define BENCH_DEFAULT_SIZES "50,100,200"
+#define BENCH_DEFAULT_GOALS "wam,ddg,gl,jacobi,kmeans,spk"
+#define BENCH_BLOB_SPREAD 10.0
+
+/* Macro benchmark: every goal runs in its own child process, end to end
+ * through the spkmeans binary (kmeans, which has no CLI goal, runs in
+ * process), so wall time and peak RSS are per run. */
+
+struct benchOptions {
+    int sizes[BENCH_MAX_SIZES];
+    int sizesAmount;
+    int dim;
+    int clusters;
+    int repeats;
+    unsigned long seed;
+    char goals[256];
+    char format[8];
+    char *out;
+    char *baseline;
+    double tolerance;
+    char *spkmeans;
+    char workDir[BENCH_PATH_LEN];
+};
+
+struct benchRecord {
+    char goal[16];
+    int n;
+    int d;
+    int k;
+    double wallMs;
+    long peakRssKb;
+    double throughput;
+};
+
+static double nextGaussian(struct mt19937 *rng) {
+    double u1, u2;
+
+    do {
+        u1 = mt19937NextDouble(rng);
+    } while (u1 <= 0);
+
+    u2 = mt19937NextDouble(rng);
+    return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/* n points in d dimensions around k centers drawn uniformly from a box, unit
+ * variance around each center, points dealt to the blobs round robin */
+struct matrix * generateBlobs(int n, int d, int k, unsigned long seed) {
+    struct mt19937 rng;
+    struct matrix *points, *centers;
+    int i, j;
+
+    points = allocMatrix(n, d);
+    centers = allocMatrix(k, d);
+    if (points == NULL || centers == NULL) {
+        freeMatrix(points);
+        freeMatrix(centers);
+        return NULL;
+    }
+
+    mt19937Seed(&rng, seed);
+    for (i = 0; i < k; i++) {
+        for (j = 0; j < d; j++) {
+            MAT(centers, i, j) = (mt19937NextDouble(&rng) - 0.5) * BENCH_BLOB_SPREAD;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < d; j++) {
+            MAT(points, i, j) = MAT(centers, i % k, j) + nextGaussian(&rng);
+        }
+    }
+
+    freeMatrix(centers);
+    return points;
+}
+
+static int writePoints(const char *path, struct matrix *points) {
+    FILE *fp;
+    int i, j;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < points->rows; i++) {
+        for (j = 0; j < points->cols; j++) {
+            fprintf(fp, "%.4f%c", MAT(points, i, j), j == points->cols - 1 ? '\n' : ',');
+        }
+    }
+
+    return fclose(fp) != 0;
+}
+
+static double nowMs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void redirect(const char *outPath) {
+    int fd = open(outPath != NULL ? outPath : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0) {
+        dup2(fd, 1);
+        close(fd);
+    }
+}
+
+/* The blobs and k-means++ seeds of the kmeans stage, made before the timed
+ * region so that only the Lloyd iterations are measured */
+static int prepareKmeansStage(int n, int d, int k, unsigned long seed, struct matrix **points,
+                              struct matrix **centroids) {
+    int *indexes;
+
+    *points = generateBlobs(n, d, k, seed);
+    indexes = malloc(k * sizeof(int));
+    *centroids = *points == NULL || indexes == NULL ? NULL : kmeansPlusPlus(*points, k, KMEANS_SEED, indexes);
+    free(indexes);
+    if (*centroids == NULL) {
+        freeMatrix(*points);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Runs one measurement in a child and fills wall time and peak RSS. When
+ * outPath is given the child's stdout is kept there. */
+static int measure(struct benchOptions *opts, const char *goal, const char *input, const char *outPath,
+                   int n, double *wallMs, long *peakRssKb) {
+    struct matrix *points = NULL, *centroids = NULL;
+    struct rusage usage;
+    pid_t pid;
+    int status;
+    double start;
+
+    if (strcmp(goal, "kmeans") == 0 &&
+        prepareKmeansStage(n, opts->dim, opts->clusters, opts->seed, &points, &centroids) != 0) {
+        return 1;
+    }
+
+    fflush(stdout);
+    start = nowMs();
+    pid = fork();
+    if (pid == 0) {
+        redirect(outPath);
+        if (points != NULL) {
+            _exit(kmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, points, centroids, NULL));
+        }
+
+        execl(opts->spkmeans, opts->spkmeans, goal, input, (char *) NULL);
+        _exit(127);
+    }
+
+    freeMatrix(points);
+    freeMatrix(centroids);
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+        return 1;
+    }
+
+    *wallMs = nowMs() - start;
+    *peakRssKb = usage.ru_maxrss;
+
+    return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+static int parseSizes(struct benchOptions *opts, char *list) {
+    char *token;
+
+    opts->sizesAmount = 0;
+    for (token = strtok(list, ","); token != NULL && opts->sizesAmount < BENCH_MAX_SIZES; token = strtok(NULL, ",")) {
+        opts->sizes[opts->sizesAmount] = atoi(token);
+        if (opts->sizes[opts->sizesAmount] < 2) {
+            return 1;
+        }
+        opts->sizesAmount++;
+    }
+
+    return opts->sizesAmount == 0;
+}
+
+static int hasGoal(struct benchOptions *opts, const char *goal) {
+    char goals[256], *token;
+
+    strcpy(goals, opts->goals);
+    for (token = strtok(goals, ","); token != NULL; token = strtok(NULL, ",")) {
+        if (strcmp(token, goal) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void printRecords(FILE *fp, struct benchOptions *opts, struct benchRecord *records, int count) {
+    int i;
+
+    if (strcmp(opts->format, "json") == 0) {
+        fprintf(fp, "[\n");
+        for (i = 0; i < count; i++) {
+            fprintf(fp, "  {\"goal\": \"%s\", \"n\": %d, \"d\": %d, \"k\": %d, \"wall_ms\": %.3f, "
+                        "\"peak_rss_kb\": %ld, \"points_per_sec\": %.1f}%s\n",
+                    records[i].goal, records[i].n, records[i].d, records[i].k, records[i].wallMs,
+                    records[i].peakRssKb, records[i].throughput, i == count - 1 ? "" : ",");
+        }
+        fprintf(fp, "]\n");
+        return;
+    }
+
+    fprintf(fp, "goal,n,d,k,wall_ms,peak_rss_kb,points_per_sec\n");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "%s,%d,%d,%d,%.3f,%ld,%.1f\n", records[i].goal, records[i].n, records[i].d,
+                records[i].k, records[i].wallMs, records[i].peakRssKb, records[i].throughput);
+    }
+}
+
+/* Flags every record whose wall time exceeds the matching baseline CSV row
+ * by more than the tolerance. Returns the number of regressions. */
+static int compareBaseline(struct benchOptions *opts, struct benchRecord *records, int count) {
+    FILE *fp;
+    char line[512], goal[16];
+    int i, n, d, k, regressions = 0, matched = 0;
+    double wallMs;
+    long rss;
+
+    fp = fopen(opts->baseline, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "no baseline at %s, skipping comparison\n", opts->baseline);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (sscanf(line, "%15[^,],%d,%d,%d,%lf,%ld", goal, &n, &d, &k, &wallMs, &rss) != 6) {
+            continue;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (strcmp(records[i].goal, goal) != 0 || records[i].n != n || records[i].d != d || records[i].k != k) {
+                continue;
+            }
+
+            matched++;
+            if (records[i].wallMs > wallMs * (1 + opts->tolerance)) {
+                fprintf(stderr, "REGRESSION %s n=%d: %.3f ms vs baseline %.3f ms (+%.1f%%)\n", goal, n,
+                        records[i].wallMs, wallMs, 100 * (records[i].wallMs / wallMs - 1));
+                regressions++;
+            }
+        }
+    }
+
+    fclose(fp);
+    fprintf(stderr, "compared %d runs against %s: %d regression(s)\n", matched, opts->baseline, regressions);
+    return regressions;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: spkbench [--sizes N,N,...] [--dim D] [--clusters K] [--repeats R] [--seed S]\n"
+            "                [--goals wam,ddg,gl,jacobi,kmeans,spk] [--format csv|json] [--out FILE]\n"
+            "                [--baseline FILE] [--tolerance FRACTION] [--spkmeans PATH] [--workdir DIR]\n"
+            "       spkbench generate N D K SEED\n");
+}
+
+static int parseOptions(struct benchOptions *opts, int argc, char *argv[]) {
+    char sizes[256];
+    char *tmp = getenv("TMPDIR");
+    int i;
+
+    strcpy(sizes, BENCH_DEFAULT_SIZES);
+    strcpy(opts->goals, BENCH_DEFAULT_GOALS);
+    strcpy(opts->format, "csv");
+    opts->dim = 3;
+    opts->clusters = 4;
+    opts->repeats = 3;
+    opts->seed = 0;
+    opts->out = NULL;
+    opts->baseline = NULL;
+    opts->tolerance = 0.25;
+    opts->spkmeans = "./spkmeans";
+    sprintf(opts->workDir, "%.900s", tmp != NULL ? tmp : "/tmp");
+
+    for (i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            return 1;
+        }
+
+        if (strcmp(argv[i], "--sizes") == 0) {
+            sprintf(sizes, "%.255s", argv[++i]);
+        } else if (strcmp(argv[i], "--dim") == 0) {
+            opts->dim = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--clusters") == 0) {
+            opts->clusters = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeats") == 0) {
+            opts->repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            opts->seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--goals") == 0) {
+            sprintf(opts->goals, "%.255s", argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0) {
+            sprintf(opts->format, "%.7s", argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0) {
+            opts->out = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0) {
+            opts->baseline = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0) {
+            opts->tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--spkmeans") == 0) {
+            opts->spkmeans = argv[++i];
+        } else if (strcmp(argv[i], "--workdir") == 0) {
+            sprintf(opts->workDir, "%.900s", argv[++i]);
+        } else {
+            return 1;
+        }
+    }
+
+    return parseSizes(opts, sizes) || opts->dim < 1 || opts->clusters < 1 || opts->repeats < 1;
+}
+
+static int generateCommand(int argc, char *argv[]) {
+    struct matrix *points;
+    int i, j;
+
+    if (argc != 6) {
+        usage();
+        return 1;
+    }
+
+    points = generateBlobs(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), strtoul(argv[5], NULL, 10));
+    if (points == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < points->rows; i++) {
+        for (j = 0; j < points->cols; j++) {
+            printf("%.4f%c", MAT(points, i, j), j == points->cols - 1 ? '\n' : ',');
+        }
+    }
+
+    freeMatrix(points);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *goals[] = {"wam", "ddg", "gl", "jacobi", "kmeans", "spk"};
+    struct benchOptions opts;
+    struct benchRecord records[BENCH_MAX_RECORDS];
+    struct matrix *points;
+    char dataPath[BENCH_PATH_LEN + 64], glPath[BENCH_PATH_LEN + 64];
+    const char *input;
+    double wallMs, best;
+    long rss, bestRss;
+    int s, g, r, n, count = 0, failed = 0, regressions = 0;
+    FILE *out = stdout;
+
+    if (argc > 1 && strcmp(argv[1], "generate") == 0) {
+        return generateCommand(argc, argv);
+    }
+
+    if (parseOptions(&opts, argc, argv) != 0) {
+        usage();
+        return 1;
+    }
+
+    for (s = 0; s < opts.sizesAmount; s++) {
+        n = opts.sizes[s];
+        sprintf(dataPath, "%s/spkbench_n%d_d%d_k%d_s%lu.txt", opts.workDir, n, opts.dim, opts.clusters, opts.seed);
+        sprintf(glPath, "%s/spkbench_n%d_d%d_k%d_s%lu.gl.txt", opts.workDir, n, opts.dim, opts.clusters, opts.seed);
+
+        points = generateBlobs(n, opts.dim, opts.clusters, opts.seed);
+        if (points == NULL || writePoints(dataPath, points) != 0) {
+            fprintf(stderr, "could not write %s\n", dataPath);
+            freeMatrix(points);
+            return 1;
+        }
+        freeMatrix(points);
+
+        /* jacobi is benchmarked on the Laplacian of the same data */
+        if (hasGoal(&opts, "jacobi") && measure(&opts, "gl", dataPath, glPath, n, &wallMs, &rss) != 0) {
+            fprintf(stderr, "could not build the jacobi input for n=%d\n", n);
+            return 1;
+        }
+
+        for (g = 0; g < (int) (sizeof(goals) / sizeof(goals[0])); g++) {
+            if (!hasGoal(&opts, goals[g]) || count == BENCH_MAX_RECORDS) {
+                continue;
+            }
+
+            input = strcmp(goals[g], "jacobi") == 0 ? glPath : dataPath;
+            best = -1;
+            bestRss = 0;
+            for (r = 0; r < opts.repeats; r++) {
+                if (measure(&opts, goals[g], input, NULL, n, &wallMs, &rss) != 0) {
+                    fprintf(stderr, "%s failed for n=%d\n", goals[g], n);
+                    failed = 1;
+                    break;
+                }
+
+                if (best < 0 || wallMs < best) {
+                    best = wallMs;
+                }
+                if (rss > bestRss) {
+                    bestRss = rss;
+                }
+            }
+
+            if (best < 0) {
+                continue;
+            }
+
+            strcpy(records[count].goal, goals[g]);
+            records[count].n = n;
+            records[count].d = opts.dim;
+            records[count].k = opts.clusters;
+            records[count].wallMs = best;
+            records[count].peakRssKb = bestRss;
+            records[count].throughput = n / (best / 1000.0);
+            fprintf(stderr, "%-7s n=%-6d %10.3f ms %8ld KB\n", goals[g], n, best, bestRss);
+            count++;
+        }
+
+        unlink(dataPath);
+        unlink(glPath);
+    }
+
+    if (opts.out != NULL) {
+        out = fopen(opts.out, "w");
+        if (out == NULL) {
+            fprintf(stderr, "could not write %s\n", opts.out);
+            return 1;
+        }
+    }
+
+    printRecords(out, &opts, records, count);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (opts.baseline != NULL) {
+        regressions = compareBaseline(&opts, records, count);
+    }
+
+    return failed ? 1 : (regressions > 0 ? 2 : 0);
+}
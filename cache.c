@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "alloc.h"
+#include "matrix.h"
+#include "writer.h"
+#include "cache.h"
+
+#define FNV_OFFSET_BASIS ((uint64_t) 0xcbf29ce4UL << 32 | 0x84222325UL)
+#define FNV_PRIME ((uint64_t) 0x100UL << 32 | 0x1b3UL)
+
+/* room for the directory, a file name and a temporary suffix */
+#define CACHE_PATH_BUFFER (CACHE_MAX_PATH + 320)
+
+/* Cache entries are one matrix each: a fixed header followed by the rows
+ * exactly as they sit in memory, so a hit is a single private mapping. */
+struct cacheHeader {
+    char magic[8];
+    int version;
+    int rows;
+    int cols;
+    int stride;
+};
+
+struct cacheEntry {
+    char name[256];
+    time_t mtime;
+    size_t size;
+};
+
+static int configured = 0;
+static char cacheDir[CACHE_MAX_PATH];
+static size_t cacheMaxBytes = CACHE_DEFAULT_MAX_BYTES;
+
+/* The cache is configured from SPKMEANS_CACHE_DIR and SPKMEANS_CACHE_MAX_BYTES
+ * unless setCacheConfig() was called first. A NULL or empty dir disables it. */
+void setCacheConfig(const char *dir, size_t maxBytes) {
+    configured = 1;
+    cacheDir[0] = '\0';
+    cacheMaxBytes = maxBytes > 0 ? maxBytes : CACHE_DEFAULT_MAX_BYTES;
+
+    if (dir != NULL && strlen(dir) < CACHE_MAX_PATH - 64) {
+        strcpy(cacheDir, dir);
+    }
+}
+
+int cacheEnabled(void) {
+    char *maxBytes;
+
+    if (!configured) {
+        maxBytes = getenv(CACHE_MAX_BYTES_ENV);
+        setCacheConfig(getenv(CACHE_DIR_ENV), maxBytes != NULL ? (size_t) strtoul(maxBytes, NULL, 10) : 0);
+    }
+
+    return cacheDir[0] != '\0';
+}
+
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/* FNV-1a over the shape and every value (row padding excluded) */
+uint64_t hashMatrix(struct matrix *mat) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    int i, version = CACHE_VERSION;
+
+    hash = hashBytes(hash, &version, sizeof(int));
+    hash = hashBytes(hash, &mat->rows, sizeof(int));
+    hash = hashBytes(hash, &mat->cols, sizeof(int));
+    for (i = 0; i < mat->rows; i++) {
+        hash = hashBytes(hash, MAT_ROW(mat, i), mat->cols * sizeof(double));
+    }
+
+    return hash;
+}
+
+static void entryPath(char *path, uint64_t key, const char *kind) {
+    sprintf(path, "%s/%08lx%08lx-%.32s%s", cacheDir, (unsigned long) (key >> 32),
+            (unsigned long) (key & 0xffffffffUL), kind, CACHE_SUFFIX);
+}
+
+/* The entry of key and kind, or NULL on a miss. An entry of any shape but
+ * rows x cols is a miss too, whatever put it there. */
+struct matrix * cacheLoad(uint64_t key, const char *kind, int rows, int cols) {
+    char path[CACHE_PATH_BUFFER];
+    struct cacheHeader header;
+    struct stat st;
+    void *base;
+    int fd;
+
+    if (!cacheEnabled()) {
+        return NULL;
+    }
+
+    entryPath(path, key, kind);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || read(fd, &header, sizeof(header)) != (ssize_t) sizeof(header) ||
+        memcmp(header.magic, "SPKCACHE", 8) != 0 || header.version != CACHE_VERSION ||
+        header.rows != rows || header.cols != cols || header.stride != matrixStride(header.cols) ||
+        (size_t) st.st_size != CACHE_HEADER_BYTES + (size_t) header.rows * header.stride * sizeof(double)) {
+        close(fd);
+        return NULL;
+    }
+
+    /* private, so callers may modify the matrix without touching the file */
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* the modification time is the LRU clock */
+    utime(path, NULL);
+
+    return wrapMappedMatrix(base, st.st_size, CACHE_HEADER_BYTES, header.rows, header.cols);
+}
+
+static int compareEntries(const void *a, const void *b) {
+    const struct cacheEntry *e1 = a, *e2 = b;
+
+    if (e1->mtime != e2->mtime) {
+        return e1->mtime < e2->mtime ? -1 : 1;
+    }
+
+    return strcmp(e1->name, e2->name);
+}
+
+/* Deletes least recently used entries until the directory fits maxBytes,
+ * and the temporary files of stores that died before renaming them. A
+ * temporary file an hour old is left by a crash, not a store in progress. */
+static void evict(void) {
+    DIR *dir;
+    struct dirent *ent;
+    struct stat st;
+    struct cacheEntry *entries = NULL, *grown;
+    char path[CACHE_PATH_BUFFER];
+    size_t count = 0, cap = 0, total = 0, suffixLen = strlen(CACHE_SUFFIX), len, i;
+    time_t staleBefore = time(NULL) - CACHE_STALE_TEMP_SECONDS;
+
+    dir = opendir(cacheDir);
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strstr(ent->d_name, CACHE_TEMP_MARK) != NULL) {
+            sprintf(path, "%s/%s", cacheDir, ent->d_name);
+            if (stat(path, &st) == 0 && st.st_mtime < staleBefore) {
+                unlink(path);
+            }
+            continue;
+        }
+
+        len = strlen(ent->d_name);
+        if (len <= suffixLen || len >= sizeof(entries->name) ||
+            strcmp(ent->d_name + len - suffixLen, CACHE_SUFFIX) != 0) {
+            continue;
+        }
+
+        sprintf(path, "%s/%s", cacheDir, ent->d_name);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+
+        if (count == cap) {
+            cap = cap > 0 ? cap * 2 : 64;
+            grown = memRealloc(entries, cap * sizeof(struct cacheEntry));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+
+        strcpy(entries[count].name, ent->d_name);
+        entries[count].mtime = st.st_mtime;
+        entries[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+
+    closedir(dir);
+
+    if (entries != NULL && total > cacheMaxBytes) {
+        qsort(entries, count, sizeof(struct cacheEntry), compareEntries);
+
+        for (i = 0; i < count && total > cacheMaxBytes; i++) {
+            sprintf(path, "%s/%s", cacheDir, entries[i].name);
+            if (unlink(path) == 0) {
+                total -= entries[i].size;
+            }
+        }
+    }
+
+    memFree(entries);
+}
+
+/* Best effort: the entry is written under a unique temporary name and
+ * renamed into place, so concurrent stores of one key from several threads
+ * or processes never share a half-written file. Any failure just leaves the
+ * cache without it. */
+void cacheStore(uint64_t key, const char *kind, struct matrix *mat) {
+    char path[CACHE_PATH_BUFFER], tmpPath[CACHE_PATH_BUFFER + 32];
+    char headerBytes[CACHE_HEADER_BYTES];
+    struct cacheHeader header;
+    int fd, failed;
+
+    if (!cacheEnabled() || CACHE_HEADER_BYTES + mat->bytes > cacheMaxBytes) {
+        return;
+    }
+
+    mkdir(cacheDir, 0755);
+    entryPath(path, key, kind);
+    sprintf(tmpPath, "%s" CACHE_TEMP_SUFFIX "XXXXXX", path);
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "SPKCACHE", 8);
+    header.version = CACHE_VERSION;
+    header.rows = mat->rows;
+    header.cols = mat->cols;
+    header.stride = mat->stride;
+    memset(headerBytes, 0, CACHE_HEADER_BYTES);
+    memcpy(headerBytes, &header, sizeof(header));
+
+    fd = mkstemp(tmpPath);
+    if (fd < 0) {
+        return;
+    }
+
+    fchmod(fd, 0644);
+
+    failed = writeAll(fd, headerBytes, CACHE_HEADER_BYTES) != 0 ||
+             writeAll(fd, (const char *) mat->data, mat->bytes) != 0;
+    failed = close(fd) != 0 || failed;
+
+    if (failed || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        return;
+    }
+
+    evict();
+}
@@ -0,0 +1,30 @@
+# ifndef CACHE_H_
+# define CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "matrix.h"
+
+#define CACHE_DIR_ENV "SPKMEANS_CACHE_DIR"
+#define CACHE_MAX_BYTES_ENV "SPKMEANS_CACHE_MAX_BYTES"
+#define CACHE_DEFAULT_MAX_BYTES ((size_t) 1024 * 1024 * 1024)
+#define CACHE_HEADER_BYTES 64
+#define CACHE_VERSION 1
+#define CACHE_SUFFIX ".spkc"
+/* temporary files are <entry>.spkc.tmp.XXXXXX until renamed into place */
+#define CACHE_TEMP_SUFFIX ".tmp."
+#define CACHE_TEMP_MARK CACHE_SUFFIX CACHE_TEMP_SUFFIX
+#define CACHE_STALE_TEMP_SECONDS 3600
+#define CACHE_MAX_PATH 4096
+
+void setCacheConfig(const char *dir, size_t maxBytes);
+
+int cacheEnabled(void);
+
+uint64_t hashMatrix(struct matrix *mat);
+
+struct matrix * cacheLoad(uint64_t key, const char *kind, int rows, int cols);
+
+void cacheStore(uint64_t key, const char *kind, struct matrix *mat);
+
+#endif
@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "writer.h"
+#include "distance.h"
+#include "kmeans.h"
+#include "operator.h"
+#include "spkmeans.h"
+
+#define CHECK_SEED 0
+#define CHECK_FORMAT_VALUES 200000
+#define CHECK_DISTANCE_PAIRS 1000
+
+/* Bit-identity checks for the fast paths that promise the exact output of
+ * the code they replaced: the fixed point writer against printf("%.4f"), the
+ * unrolled distance kernels against the generic loop, the MT19937 k-means++
+ * seeding against numpy and the matrix-free Laplacian against products with
+ * gl(). Every check prints one line; the exit status is the number that
+ * failed. */
+
+/* Points whose coordinates are exact in binary, so the numpy reference
+ * below was computed on the very same values */
+static struct matrix * gridPoints(int n, int d) {
+    struct matrix *points = allocMatrix(n, d);
+    int i, j;
+
+    for (i = 0; points != NULL && i < n; i++) {
+        for (j = 0; j < d; j++) {
+            MAT(points, i, j) = ((i * 37 + j * 11) % 101) / 101.0;
+        }
+    }
+
+    return points;
+}
+
+static struct matrix * randomPoints(struct mt19937 *rng, int n, int d, double scale) {
+    struct matrix *points = allocMatrix(n, d);
+    int i, j;
+
+    for (i = 0; points != NULL && i < n; i++) {
+        for (j = 0; j < d; j++) {
+            MAT(points, i, j) = (mt19937NextDouble(rng) * 2 - 1) * scale;
+        }
+    }
+
+    return points;
+}
+
+static int report(const char *name, int failures, long cases) {
+    printf("%s: %s (%ld cases)\n", name, failures == 0 ? "ok" : "FAILED", cases);
+    return failures != 0;
+}
+
+static int compareFormat(double value) {
+    char expected[WRITER_MAX_NUMBER_LEN], actual[WRITER_MAX_NUMBER_LEN];
+    int len;
+
+    sprintf(expected, "%.4f", value);
+    len = formatFixed4(value, actual);
+    actual[len] = '\0';
+    if (strcmp(expected, actual) != 0) {
+        fprintf(stderr, "formatFixed4(%.17g) gave %s, printf %s\n", value, actual, expected);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Halfway cases exact in binary, signed zeros, values that round to zero
+ * from either side and random values over a wide range of magnitudes */
+static int checkFormat(struct mt19937 *rng) {
+    static const double edges[] = {0.0, -0.0, 0.03125, -0.03125, 0.00005, -0.00005, 0.00004, -0.00004,
+                                   0.99995, 9.99995, 1e-300, -1e-300, 123456789.12345, 2.5, 0.5, 1e15};
+    int i, failures = 0;
+    double scale;
+
+    for (i = 0; i < (int) (sizeof(edges) / sizeof(edges[0])); i++) {
+        failures += compareFormat(edges[i]);
+    }
+
+    for (i = 0; i < CHECK_FORMAT_VALUES; i++) {
+        scale = i % 4 == 0 ? 1e-3 : i % 4 == 1 ? 1 : i % 4 == 2 ? 1e3 : 1e9;
+        failures += compareFormat((mt19937NextDouble(rng) * 2 - 1) * scale);
+        failures += compareFormat((mt19937RandomInt(rng, 2000000) - 1000000) / 10000.0 + 0.00005);
+    }
+
+    return report("formatFixed4 vs printf %.4f",
+                  failures, (long) (sizeof(edges) / sizeof(edges[0])) + 2L * CHECK_FORMAT_VALUES);
+}
+
+/* The kernel dispatched for every dimension up to a few past the unrolled
+ * ones, against the generic loop */
+static int checkDistance(struct mt19937 *rng) {
+    struct matrix *points;
+    double expected, actual;
+    int d, i, failures = 0;
+    long cases = 0;
+
+    for (d = 1; d <= DISTANCE_MAX_UNROLLED + 4; d++) {
+        points = randomPoints(rng, 2 * CHECK_DISTANCE_PAIRS, d, 10);
+        if (points == NULL) {
+            return report("unrolled vs generic squared distance", 1, cases);
+        }
+
+        for (i = 0; i < CHECK_DISTANCE_PAIRS; i++) {
+            expected = genericSquaredDistance(MAT_ROW(points, 2 * i), MAT_ROW(points, 2 * i + 1), d);
+            actual = squaredDistanceKernel(d)(MAT_ROW(points, 2 * i), MAT_ROW(points, 2 * i + 1), d);
+            if (memcmp(&expected, &actual, sizeof(double)) != 0) {
+                fprintf(stderr, "d=%d: unrolled %.17g, generic %.17g\n", d, actual, expected);
+                failures++;
+            }
+            cases++;
+        }
+
+        freeMatrix(points);
+    }
+
+    return report("unrolled vs generic squared distance", failures, cases);
+}
+
+/* Indexes drawn by the original Python seeding (np.random.seed(0), the
+ * first index by np.random.choice(n), the next ones with probability
+ * proportional to the distance to the nearest chosen centroid) on
+ * gridPoints(n, d) */
+static int checkSeeding(void) {
+    static const struct {
+        int n, d, k;
+        int indexes[8];
+    } cases[] = {
+        {60, 3, 5, {44, 35, 49, 51, 50}},
+        {200, 4, 8, {172, 119, 169, 173, 170, 125, 81, 57}},
+        {40, 2, 3, {0, 24, 23}}
+    };
+    static const double randomSample[] = {0.5488135039273248, 0.7151893663724195, 0.6027633760716439};
+    struct matrix *points, *centroids;
+    struct mt19937 rng;
+    int indexes[8];
+    int c, i, failures = 0;
+    double value;
+
+    mt19937Seed(&rng, 0);
+    for (i = 0; i < (int) (sizeof(randomSample) / sizeof(randomSample[0])); i++) {
+        value = mt19937NextDouble(&rng);
+        if (value != randomSample[i]) {
+            fprintf(stderr, "random_sample %d: %.17g, numpy %.17g\n", i, value, randomSample[i]);
+            failures++;
+        }
+    }
+
+    for (c = 0; c < (int) (sizeof(cases) / sizeof(cases[0])); c++) {
+        points = gridPoints(cases[c].n, cases[c].d);
+        centroids = points == NULL ? NULL : kmeansPlusPlus(points, cases[c].k, 0, indexes);
+        if (centroids == NULL) {
+            freeMatrix(points);
+            failures++;
+            continue;
+        }
+
+        for (i = 0; i < cases[c].k; i++) {
+            if (indexes[i] != cases[c].indexes[i]) {
+                fprintf(stderr, "n=%d d=%d k=%d: index %d is %d, numpy %d\n", cases[c].n, cases[c].d,
+                        cases[c].k, i, indexes[i], cases[c].indexes[i]);
+                failures++;
+            }
+        }
+
+        freeMatrix(points);
+        freeMatrix(centroids);
+    }
+
+    return report("MT19937 k-means++ vs numpy", failures,
+                  (long) (sizeof(randomSample) / sizeof(randomSample[0]) + sizeof(cases) / sizeof(cases[0])));
+}
+
+/* One product of the matrix-free operator, with no cached rows and with all
+ * of them, against the same product through gl() */
+static int checkOperator(struct mt19937 *rng) {
+    static const int sizes[] = {1, 17, 100, 301};
+    static const size_t caches[] = {0, (size_t) 1 << 30};
+    struct linearOperator op, dense;
+    struct matrix *points, *lMat, *x, *expected, *actual;
+    int s, c, i, failures = 0;
+    long cases = 0;
+
+    for (s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++) {
+        points = randomPoints(rng, sizes[s], 3, 1);
+        lMat = points == NULL ? NULL : gl(points);
+        x = randomPoints(rng, sizes[s], 5, 1);
+        expected = allocMatrix(sizes[s], 5);
+        actual = allocMatrix(sizes[s], 5);
+        if (lMat == NULL || x == NULL || expected == NULL || actual == NULL) {
+            failures++;
+        } else {
+            denseOperator(lMat, &dense);
+            dense.apply(&dense, x, expected);
+        }
+
+        for (c = 0; lMat != NULL && c < (int) (sizeof(caches) / sizeof(caches[0])); c++) {
+            if (x == NULL || expected == NULL || actual == NULL || laplacianOperator(points, caches[c], &op) != 0) {
+                failures++;
+                continue;
+            }
+
+            op.apply(&op, x, actual);
+            for (i = 0; i < sizes[s]; i++) {
+                if (memcmp(MAT_ROW(expected, i), MAT_ROW(actual, i), 5 * sizeof(double)) != 0) {
+                    fprintf(stderr, "n=%d cache=%lu: row %d differs\n", sizes[s], (unsigned long) caches[c], i);
+                    failures++;
+                    break;
+                }
+            }
+            freeLaplacianOperator(&op);
+            cases++;
+        }
+
+        freeMatrix(points);
+        freeMatrix(lMat);
+        freeMatrix(x);
+        freeMatrix(expected);
+        freeMatrix(actual);
+    }
+
+    return report("matrix-free operator vs gl()", failures, cases);
+}
+
+int main(void) {
+    struct mt19937 rng;
+    int failed = 0;
+
+    mt19937Seed(&rng, CHECK_SEED);
+    failed += checkFormat(&rng);
+    failed += checkDistance(&rng);
+    failed += checkSeeding();
+    failed += checkOperator(&rng);
+
+    return failed;
+}
@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "distance.h"
+#include "kmeans.h"
+#include "stats.h"
+#include "spkmeans.h"
+#include "nystrom.h"
+#include "coreset.h"
+
+static int configured = 0;
+static int sizeWanted = 0;
+
+/* Runs the k-means of spk on a coreset of that many points from now on; 0
+ * runs it on all of them. Unless called first, SPKMEANS_CORESET is read. */
+void setCoresetSize(int size) {
+    configured = 1;
+    sizeWanted = size < 0 ? 0 : size;
+}
+
+int coresetSize(void) {
+    if (!configured) {
+        setCoresetSize(getenv(CORESET_ENV) == NULL ? 0 : atoi(getenv(CORESET_ENV)));
+    }
+
+    return sizeWanted;
+}
+
+/* Squared distance of point i to its closest center, whose index goes to
+ * label */
+static double closestCenter(struct matrix *points, int i, struct matrix *centers, int *label) {
+    distanceKernel distance = squaredDistanceKernel(points->cols);
+    double dist, minDist = HUGE_VAL;
+    int c;
+
+    for (c = 0; c < centers->rows; c++) {
+        dist = distance(MAT_ROW(points, i), MAT_ROW(centers, c), points->cols);
+        if (dist < minDist) {
+            minDist = dist;
+            *label = c;
+        }
+    }
+
+    return minDist;
+}
+
+double kmeansCost(struct matrix *points, struct matrix *centroids) {
+    double cost = 0;
+    int i, label;
+
+    for (i = 0; i < points->rows; i++) {
+        cost += closestCenter(points, i, centroids, &label);
+    }
+
+    return cost;
+}
+
+void freeCoreset(struct coreset *coreset) {
+    if (coreset != NULL) {
+        freeMatrix(coreset->points);
+        memFree(coreset->weights);
+        memFree(coreset->rows);
+        memFree(coreset);
+    }
+}
+
+/* Sensitivity bound of every point against the centers B (Bachem et al.):
+ * s(x) = a d(x) / c + 2a cost(B_x) / (|B_x| c) + 4n / |B_x|, where d(x) is
+ * the squared distance to the closest center, B_x its cluster, c the mean
+ * of d and a = 16 (log k + 2). Fills cdf with their running sum. */
+static int sensitivities(struct matrix *points, struct matrix *centers, double *cdf) {
+    double *dists, *clusterCost, *clusterSize;
+    double meanCost = 0, alpha = 16 * (log(centers->rows) + 2);
+    int *labels;
+    int i, n = points->rows;
+
+    dists = memAlloc(n * sizeof(double));
+    labels = memAlloc(n * sizeof(int));
+    clusterCost = memCalloc(centers->rows, sizeof(double));
+    clusterSize = memCalloc(centers->rows, sizeof(double));
+    if (dists == NULL || labels == NULL || clusterCost == NULL || clusterSize == NULL) {
+        memFree(dists);
+        memFree(labels);
+        memFree(clusterCost);
+        memFree(clusterSize);
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        dists[i] = closestCenter(points, i, centers, &labels[i]);
+        clusterCost[labels[i]] += dists[i];
+        clusterSize[labels[i]]++;
+        meanCost += dists[i] / n;
+    }
+
+    /* every point sits on a center: all of them are equally important */
+    meanCost = meanCost > 0 ? meanCost : 1;
+    for (i = 0; i < n; i++) {
+        cdf[i] = (i > 0 ? cdf[i - 1] : 0) + alpha * dists[i] / meanCost +
+                 2 * alpha * clusterCost[labels[i]] / (clusterSize[labels[i]] * meanCost) +
+                 4.0 * n / clusterSize[labels[i]];
+    }
+
+    memFree(dists);
+    memFree(labels);
+    memFree(clusterCost);
+    memFree(clusterSize);
+    return 0;
+}
+
+/* Draws size points with probability q(x) proportional to their sensitivity
+ * against centers (usually k-means++ seeds), each draw weighing
+ * 1 / (size q(x)). Points drawn more than once are kept once with the
+ * weights added up, so the coreset may have fewer than size rows. */
+struct coreset * buildCoreset(struct matrix *points, struct matrix *centers, int size, unsigned long seed) {
+    struct mt19937 rng;
+    struct coreset *coreset;
+    double *cdf, *drawn;
+    double u, total;
+    int i, low, high, mid, rows = 0, n = points->rows;
+
+    coreset = memCalloc(1, sizeof(struct coreset));
+    cdf = memAlloc(n * sizeof(double));
+    drawn = memCalloc(n, sizeof(double));
+    if (coreset == NULL || cdf == NULL || drawn == NULL || size < 1 || sensitivities(points, centers, cdf) != 0) {
+        printErrorMessage();
+        memFree(coreset);
+        memFree(cdf);
+        memFree(drawn);
+        return NULL;
+    }
+
+    total = cdf[n - 1];
+    mt19937Seed(&rng, seed);
+    for (i = 0; i < size; i++) {
+        u = mt19937NextDouble(&rng) * total;
+        for (low = 0, high = n - 1; low < high;) {
+            mid = (low + high) / 2;
+            if (cdf[mid] <= u) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        rows += drawn[low] == 0;
+        drawn[low]++;
+    }
+
+    coreset->size = rows;
+    coreset->points = allocMatrix(rows, points->cols);
+    coreset->weights = memAlloc(rows * sizeof(double));
+    coreset->rows = memAlloc(rows * sizeof(int));
+    if (coreset->points == NULL || coreset->weights == NULL || coreset->rows == NULL) {
+        printErrorMessage();
+        freeCoreset(coreset);
+        memFree(cdf);
+        memFree(drawn);
+        return NULL;
+    }
+
+    for (i = 0, rows = 0; i < n; i++) {
+        if (drawn[i] == 0) {
+            continue;
+        }
+
+        /* q(x) is the sensitivity over the total, the cdf step at x */
+        coreset->weights[rows] = drawn[i] * total / (size * (cdf[i] - (i > 0 ? cdf[i - 1] : 0)));
+        coreset->rows[rows] = i;
+        memcpy(MAT_ROW(coreset->points, rows), MAT_ROW(points, i), points->cols * sizeof(double));
+        rows++;
+    }
+
+    memFree(cdf);
+    memFree(drawn);
+    return coreset;
+}
+
+/* kmeans() on a coreset of size points built around the seeds in centroids,
+ * followed by one assignment pass over all the points to fill labels. Falls
+ * back to kmeans() when the points are not more than size. */
+int coresetKmeans(int maxIter, double epsilon, struct matrix *points, int size, struct matrix *centroids,
+                  int *labels) {
+    enum memSubsystem previous;
+    struct coreset *coreset;
+    int failed;
+
+    if (size < 1 || size >= points->rows) {
+        return kmeans(maxIter, epsilon, points, centroids, labels);
+    }
+
+    previous = memEnter(MEM_KMEANS);
+    coreset = buildCoreset(points, centroids, size, CORESET_SEED);
+    memLeave(previous);
+    if (coreset == NULL) {
+        return 1;
+    }
+
+    failed = weightedKmeans(maxIter, epsilon, coreset->points, coreset->weights, centroids, NULL);
+    freeCoreset(coreset);
+
+    if (!failed && labels != NULL) {
+        memset(labels, -1, points->rows * sizeof(int));
+        updateClusters(centroids, points, labels);
+    }
+
+    return failed;
+}
+
+/* Takes the points to their embedding U (k by the eigengap when 0), then
+ * runs full and coreset k-means on U from the same k-means++ seeds and fills
+ * quality. Returns 0 on success. */
+int compareCoreset(struct matrix *points, int k, int size, struct coresetQuality *quality) {
+    struct matrix *lMat, *u, *seeds, *full = NULL, *reduced = NULL;
+    struct eigen *eigen;
+    int *indexes, *fullLabels, *coresetLabels;
+    double start;
+    int failed = 1;
+
+    lMat = gl(points);
+    eigen = lMat == NULL ? NULL : eigenDecompose(lMat, k == 0 ? EIGEN_EIGENGAP : EIGEN_SORTED, k);
+    freeMatrix(lMat);
+    if (eigen == NULL) {
+        return 1;
+    }
+
+    u = eigen->vectors;
+    quality->k = eigen->k;
+    quality->size = size < 1 || size > u->rows ? u->rows : size;
+
+    indexes = memAlloc(quality->k * sizeof(int));
+    fullLabels = memAlloc(u->rows * sizeof(int));
+    coresetLabels = memAlloc(u->rows * sizeof(int));
+    seeds = indexes == NULL ? NULL : kmeansPlusPlus(u, quality->k, KMEANS_SEED, indexes);
+    full = seeds == NULL ? NULL : copyMatrix(seeds);
+    reduced = seeds == NULL ? NULL : copyMatrix(seeds);
+
+    if (fullLabels != NULL && coresetLabels != NULL && full != NULL && reduced != NULL) {
+        start = monotonicMs();
+        failed = kmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, u, full, fullLabels);
+        quality->fullMs = monotonicMs() - start;
+
+        start = monotonicMs();
+        failed = failed || coresetKmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, u, quality->size, reduced, coresetLabels);
+        quality->coresetMs = monotonicMs() - start;
+    }
+
+    if (!failed) {
+        quality->fullCost = kmeansCost(u, full);
+        quality->coresetCost = kmeansCost(u, reduced);
+        quality->costRatio = quality->fullCost > 0 ? quality->coresetCost / quality->fullCost : 1;
+        failed = adjustedRandIndex(fullLabels, coresetLabels, u->rows, quality->k, quality->k,
+                                   &quality->adjustedRand);
+    }
+
+    memFree(indexes);
+    memFree(fullLabels);
+    memFree(coresetLabels);
+    freeMatrix(seeds);
+    freeMatrix(full);
+    freeMatrix(reduced);
+    freeEigen(eigen);
+    return failed;
+}
@@ -0,0 +1,48 @@
+# ifndef CORESET_H_
+# define CORESET_H_
+
+#include "matrix.h"
+
+#define CORESET_ENV "SPKMEANS_CORESET"
+#define CORESET_SEED 0
+#define CORESET_DEFAULT_SIZE 2000
+
+/* A weighted subset standing in for all the points in k-means: rows[i] is
+ * the source row of points row i, which counts as weights[i] points */
+struct coreset {
+    int size;
+    struct matrix *points;
+    double *weights;
+    int *rows;
+};
+
+/* Coreset k-means against full k-means from the same seeds: the k-means
+ * cost (sum of squared distances to the closest centroid) of each on all
+ * the points, their ratio, label agreement and the time each took */
+struct coresetQuality {
+    int k;
+    int size;
+    double coresetCost;
+    double fullCost;
+    double costRatio;
+    double adjustedRand;
+    double coresetMs;
+    double fullMs;
+};
+
+void setCoresetSize(int size);
+
+int coresetSize(void);
+
+double kmeansCost(struct matrix *points, struct matrix *centroids);
+
+struct coreset * buildCoreset(struct matrix *points, struct matrix *centers, int size, unsigned long seed);
+
+void freeCoreset(struct coreset *coreset);
+
+int coresetKmeans(int maxIter, double epsilon, struct matrix *points, int size, struct matrix *centroids,
+                  int *labels);
+
+int compareCoreset(struct matrix *points, int k, int size, struct coresetQuality *quality);
+
+#endif
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "spkmeans.h"
+#include "dedup.h"
+
+#define FNV_OFFSET_BASIS ((uint64_t) 0xcbf29ce4UL << 32 | 0x84222325UL)
+#define FNV_PRIME ((uint64_t) 0x100UL << 32 | 0x1b3UL)
+
+/* FNV-1a over the row's values, with -0.0 hashed like 0.0 as they compare
+ * equal */
+static uint64_t hashRow(const double *row, int cols) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    const unsigned char *bytes;
+    double value;
+    size_t i;
+    int j;
+
+    for (j = 0; j < cols; j++) {
+        value = row[j] + 0.0;
+        bytes = (const unsigned char *) &value;
+        for (i = 0; i < sizeof(double); i++) {
+            hash ^= bytes[i];
+            hash *= FNV_PRIME;
+        }
+    }
+
+    return hash;
+}
+
+static int sameRow(const double *row1, const double *row2, int cols) {
+    int j;
+
+    for (j = 0; j < cols; j++) {
+        if (row1[j] != row2[j]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void freeDedup(struct dedup *dedup) {
+    if (dedup == NULL) {
+        return;
+    }
+
+    freeMatrix(dedup->points);
+    memFree(dedup->weights);
+    memFree(dedup->groupOf);
+    memFree(dedup);
+}
+
+/* Rows are hashed into an open addressing table of distinct rows, so
+ * collapsing takes one pass and one comparison per row in the common case. */
+struct dedup * collapseDuplicates(struct matrix *points) {
+    struct dedup *dedup;
+    int *firstRow, *table;
+    int i, a, m = 0, n = points->rows, mask = 1;
+    size_t slot;
+
+    while (mask < 2 * n) {
+        mask <<= 1;
+    }
+    mask--;
+
+    dedup = memAlloc(sizeof(struct dedup));
+    firstRow = memAlloc(n * sizeof(int));
+    table = memAlloc((mask + 1) * sizeof(int));
+    if (dedup == NULL || firstRow == NULL || table == NULL) {
+        printErrorMessage();
+        memFree(dedup);
+        memFree(firstRow);
+        memFree(table);
+        return NULL;
+    }
+
+    dedup->n = n;
+    dedup->points = NULL;
+    dedup->weights = memCalloc(n, sizeof(double));
+    dedup->groupOf = memAlloc(n * sizeof(int));
+    if (dedup->weights == NULL || dedup->groupOf == NULL) {
+        printErrorMessage();
+        memFree(firstRow);
+        memFree(table);
+        freeDedup(dedup);
+        return NULL;
+    }
+
+    memset(table, -1, (mask + 1) * sizeof(int));
+    for (i = 0; i < n; i++) {
+        slot = (size_t) (hashRow(MAT_ROW(points, i), points->cols) & (uint64_t) mask);
+        while (table[slot] >= 0 && !sameRow(MAT_ROW(points, firstRow[table[slot]]), MAT_ROW(points, i), points->cols)) {
+            slot = (slot + 1) & mask;
+        }
+
+        if (table[slot] < 0) {
+            table[slot] = m;
+            firstRow[m++] = i;
+        }
+
+        dedup->groupOf[i] = table[slot];
+        dedup->weights[table[slot]]++;
+    }
+
+    memFree(table);
+
+    dedup->points = allocMatrix(m, points->cols);
+    if (dedup->points == NULL) {
+        printErrorMessage();
+        memFree(firstRow);
+        freeDedup(dedup);
+        return NULL;
+    }
+
+    for (a = 0; a < m; a++) {
+        memcpy(MAT_ROW(dedup->points, a), MAT_ROW(points, firstRow[a]), points->cols * sizeof(double));
+    }
+
+    memFree(firstRow);
+    return dedup;
+}
+
+/* The degree every copy of a distinct point has in the expanded graph, as a
+ * 1 x m matrix: its W row weighted by the multiplicities, plus weight 1 to
+ * each of its own other copies. */
+struct matrix * weightedDegrees(struct matrix *wMat, const double *weights) {
+    struct matrix *degreeVec;
+    int a, b, m = wMat->rows;
+
+    degreeVec = allocMatrix(1, m);
+    if (degreeVec == NULL) {
+        return NULL;
+    }
+
+    for (a = 0; a < m; a++) {
+        MAT(degreeVec, 0, a) = weights[a] - 1;
+        for (b = 0; b < m; b++) {
+            MAT(degreeVec, 0, a) += weights[b] * MAT(wMat, a, b);
+        }
+    }
+
+    return degreeVec;
+}
+
+/* L of the expanded points restricted to vectors constant on every group of
+ * copies. With C the multiplicities this is diag(W c) - W C, which is brought
+ * to the symmetric C^1/2 (diag(W c) - W C) C^-1/2 for Jacobi; an eigenvector
+ * y of it gives the eigenvector C^-1/2 y of L, already of unit length once
+ * expanded. */
+struct matrix * weightedGl(struct matrix *points, const double *weights) {
+    struct matrix *glMat, *degreeVec;
+    int a, b, m = points->rows;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    glMat = wam(points);
+    degreeVec = glMat == NULL ? NULL : weightedDegrees(glMat, weights);
+    if (degreeVec == NULL) {
+        freeMatrix(glMat);
+        memLeave(previous);
+        return NULL;
+    }
+
+    for (a = 0; a < m; a++) {
+        for (b = 0; b < m; b++) {
+            MAT(glMat, a, b) = -sqrt(weights[a] * weights[b]) * MAT(glMat, a, b);
+        }
+
+        MAT(glMat, a, a) = MAT(degreeVec, 0, a) - (weights[a] - 1);
+    }
+
+    freeMatrix(degreeVec);
+    memLeave(previous);
+    return glMat;
+}
+
+/* The rest of L's spectrum: for every point with c copies, c - 1 vectors
+ * that sum to zero over the copies, with eigenvalue its degree plus 1. The
+ * spectrum of L is returned sorted, values of the reduced problem before
+ * equal ones from the copies, and *firstCopy is the position of the first
+ * value from the copies. */
+static double * expandedSpectrum(struct eigen *eigen, struct matrix *glMat, struct dedup *dedup, int *firstCopy) {
+    double *values, *sorted;
+    int *order;
+    int a, i, c, n = dedup->n, m = eigen->n;
+
+    values = memAlloc(n * sizeof(double));
+    sorted = memAlloc(n * sizeof(double));
+    order = memAlloc(n * sizeof(int));
+    if (values == NULL || sorted == NULL || order == NULL) {
+        printErrorMessage();
+        memFree(values);
+        memFree(sorted);
+        memFree(order);
+        return NULL;
+    }
+
+    memcpy(values, eigen->values, m * sizeof(double));
+    for (a = 0, i = m; a < m; a++) {
+        for (c = 1; c < dedup->weights[a]; c++) {
+            values[i++] = MAT(glMat, a, a) + dedup->weights[a];
+        }
+    }
+
+    if (sortEigenValues(values, n, order) != 0) {
+        memFree(values);
+        memFree(sorted);
+        memFree(order);
+        return NULL;
+    }
+
+    *firstCopy = n;
+    for (i = n - 1; i >= 0; i--) {
+        sorted[i] = values[order[i]];
+        if (order[i] >= m) {
+            *firstCopy = i;
+        }
+    }
+
+    memFree(values);
+    memFree(order);
+    return sorted;
+}
+
+/* spk() on points with many exact duplicates. W, L and Jacobi run on the
+ * distinct points only and k-means weighs them by multiplicity, which is the
+ * same clustering as on the expanded points. Labels and indexes refer to the
+ * input rows. Should the first k eigenvectors of L not all be constant over
+ * copies, the embedding cannot be reduced and spk() runs on the input. */
+struct spkResult * spkCollapsed(struct matrix *points, int k) {
+    struct dedup *dedup;
+    struct matrix *glMat, *u;
+    struct eigen *eigen;
+    double *spectrum;
+    struct spkResult *result;
+    int a, j, firstCopy;
+
+    dedup = collapseDuplicates(points);
+    if (dedup == NULL) {
+        return NULL;
+    }
+
+    if (dedup->points->rows == points->rows) {
+        freeDedup(dedup);
+        return spk(points, k);
+    }
+
+    glMat = weightedGl(dedup->points, dedup->weights);
+    eigen = glMat == NULL ? NULL : eigenDecompose(glMat, EIGEN_SORTED, 0);
+    spectrum = eigen == NULL ? NULL : expandedSpectrum(eigen, glMat, dedup, &firstCopy);
+    freeMatrix(glMat);
+    if (spectrum == NULL) {
+        freeEigen(eigen);
+        freeDedup(dedup);
+        return NULL;
+    }
+
+    if (k == 0) {
+        k = calcK(spectrum, points->rows);
+    }
+
+    memFree(spectrum);
+    if (k > firstCopy) {
+        freeEigen(eigen);
+        freeDedup(dedup);
+        return spk(points, k);
+    }
+
+    u = allocMatrix(eigen->n, k);
+    if (u == NULL) {
+        printErrorMessage();
+        freeEigen(eigen);
+        freeDedup(dedup);
+        return NULL;
+    }
+
+    for (a = 0; a < eigen->n; a++) {
+        for (j = 0; j < k; j++) {
+            MAT(u, a, j) = MAT(eigen->vectors, a, j) / sqrt(dedup->weights[a]);
+        }
+    }
+
+    freeMatrix(eigen->vectors);
+    eigen->vectors = u;
+    eigen->k = k;
+
+    result = clusterGroupedEmbedding(eigen, dedup->weights, dedup->groupOf, dedup->n);
+    freeDedup(dedup);
+    return result;
+}
@@ -0,0 +1,27 @@
+# ifndef DEDUP_H_
+# define DEDUP_H_
+
+#include "matrix.h"
+#include "spkmeans.h"
+
+/* Input rows with exact duplicates collapsed. points holds the distinct rows
+ * in order of first appearance, weights[a] how often row a of points occurs
+ * and groupOf[i] which row of points input row i is. */
+struct dedup {
+    int n;
+    struct matrix *points;
+    double *weights;
+    int *groupOf;
+};
+
+struct dedup * collapseDuplicates(struct matrix *points);
+
+void freeDedup(struct dedup *dedup);
+
+struct matrix * weightedDegrees(struct matrix *wMat, const double *weights);
+
+struct matrix * weightedGl(struct matrix *points, const double *weights);
+
+struct spkResult * spkCollapsed(struct matrix *points, int k);
+
+#endif
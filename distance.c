@@ -0,0 +1,86 @@
+#include <stddef.h>
+#include "distance.h"
+
+/* Unrolled kernels are stamped out by the preprocessor: DISTANCE_TERMS_d
+ * expands to the d terms of the sum, one statement each. */
+#define DISTANCE_TERM(i) diff = p1[i] - p2[i]; sum += diff * diff;
+#define DISTANCE_TERMS_1 DISTANCE_TERM(0)
+#define DISTANCE_TERMS_2 DISTANCE_TERMS_1 DISTANCE_TERM(1)
+#define DISTANCE_TERMS_3 DISTANCE_TERMS_2 DISTANCE_TERM(2)
+#define DISTANCE_TERMS_4 DISTANCE_TERMS_3 DISTANCE_TERM(3)
+#define DISTANCE_TERMS_5 DISTANCE_TERMS_4 DISTANCE_TERM(4)
+#define DISTANCE_TERMS_6 DISTANCE_TERMS_5 DISTANCE_TERM(5)
+#define DISTANCE_TERMS_7 DISTANCE_TERMS_6 DISTANCE_TERM(6)
+#define DISTANCE_TERMS_8 DISTANCE_TERMS_7 DISTANCE_TERM(7)
+#define DISTANCE_TERMS_9 DISTANCE_TERMS_8 DISTANCE_TERM(8)
+#define DISTANCE_TERMS_10 DISTANCE_TERMS_9 DISTANCE_TERM(9)
+#define DISTANCE_TERMS_11 DISTANCE_TERMS_10 DISTANCE_TERM(10)
+#define DISTANCE_TERMS_12 DISTANCE_TERMS_11 DISTANCE_TERM(11)
+#define DISTANCE_TERMS_13 DISTANCE_TERMS_12 DISTANCE_TERM(12)
+#define DISTANCE_TERMS_14 DISTANCE_TERMS_13 DISTANCE_TERM(13)
+#define DISTANCE_TERMS_15 DISTANCE_TERMS_14 DISTANCE_TERM(14)
+#define DISTANCE_TERMS_16 DISTANCE_TERMS_15 DISTANCE_TERM(15)
+
+#define DISTANCE_KERNEL(name, real, d) \
+    static real name##d(const real *p1, const real *p2, int dims) { \
+        real diff, sum = 0; \
+        (void) dims; \
+        DISTANCE_TERMS_##d \
+        return sum; \
+    }
+
+#define DISTANCE_KERNELS(name, real) \
+    DISTANCE_KERNEL(name, real, 1) \
+    DISTANCE_KERNEL(name, real, 2) \
+    DISTANCE_KERNEL(name, real, 3) \
+    DISTANCE_KERNEL(name, real, 4) \
+    DISTANCE_KERNEL(name, real, 5) \
+    DISTANCE_KERNEL(name, real, 6) \
+    DISTANCE_KERNEL(name, real, 7) \
+    DISTANCE_KERNEL(name, real, 8) \
+    DISTANCE_KERNEL(name, real, 9) \
+    DISTANCE_KERNEL(name, real, 10) \
+    DISTANCE_KERNEL(name, real, 11) \
+    DISTANCE_KERNEL(name, real, 12) \
+    DISTANCE_KERNEL(name, real, 13) \
+    DISTANCE_KERNEL(name, real, 14) \
+    DISTANCE_KERNEL(name, real, 15) \
+    DISTANCE_KERNEL(name, real, 16)
+
+#define DISTANCE_TABLE(name) {NULL, name##1, name##2, name##3, name##4, name##5, name##6, name##7, name##8, name##9, name##10, name##11, name##12, name##13, name##14, name##15, name##16}
+
+#define DISTANCE_GENERIC(name, real) \
+    static real name(const real *p1, const real *p2, int d) { \
+        real diff, sum = 0; \
+        int i; \
+        for (i = 0; i < d; i++) { \
+            diff = p1[i] - p2[i]; \
+            sum += diff * diff; \
+        } \
+        return sum; \
+    }
+
+DISTANCE_KERNELS(unrolledDistance, double)
+DISTANCE_KERNELS(unrolledDistanceF, float)
+DISTANCE_GENERIC(genericDistance, double)
+DISTANCE_GENERIC(genericDistanceF, float)
+
+static const distanceKernel kernels[DISTANCE_MAX_UNROLLED + 1] = DISTANCE_TABLE(unrolledDistance);
+
+static const distanceKernelF kernelsF[DISTANCE_MAX_UNROLLED + 1] = DISTANCE_TABLE(unrolledDistanceF);
+
+distanceKernel squaredDistanceKernel(int d) {
+    return d >= 1 && d <= DISTANCE_MAX_UNROLLED ? kernels[d] : genericDistance;
+}
+
+distanceKernelF squaredDistanceKernelF(int d) {
+    return d >= 1 && d <= DISTANCE_MAX_UNROLLED ? kernelsF[d] : genericDistanceF;
+}
+
+double squaredDistance(const double *p1, const double *p2, int d) {
+    return squaredDistanceKernel(d)(p1, p2, d);
+}
+
+double genericSquaredDistance(const double *p1, const double *p2, int d) {
+    return genericDistance(p1, p2, d);
+}
@@ -0,0 +1,22 @@
+# ifndef DISTANCE_H_
+# define DISTANCE_H_
+
+/* dimensions up to this get a fully unrolled squared distance kernel */
+#define DISTANCE_MAX_UNROLLED 16
+
+typedef double (*distanceKernel)(const double *p1, const double *p2, int d);
+
+typedef float (*distanceKernelF)(const float *p1, const float *p2, int d);
+
+/* The squared Euclidean distance kernel for points of dimension d, resolved
+ * once ahead of a loop. Every kernel sums the same terms in the same order as
+ * the generic loop, so all of them give identical results. */
+distanceKernel squaredDistanceKernel(int d);
+
+distanceKernelF squaredDistanceKernelF(int d);
+
+double squaredDistance(const double *p1, const double *p2, int d);
+
+double genericSquaredDistance(const double *p1, const double *p2, int d);
+
+#endif
@@ -1,305 +1,345 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "kmeans.h"
+#include "distance.h"
+#include "stats.h"
 
 
-void freeClusters(struct vector ** clusters, int k) {
-    int i=0;
-
-    for(i=0; i<k; i++) {
-        freeVectorsList(clusters[i]);
-    }
-
-    free(clusters);
-}
-
-double calcDistanceBetweenPoints(struct cord *p1, struct cord *p2) {
-    double sum = 0.0;
-    struct cord *currCord1 = p1;
-    struct cord *currCord2 = p2;
-
-    while (currCord1 != NULL) {
-        sum += pow(currCord1->value - currCord2->value, 2);
-        currCord1 = currCord1->next;
-        currCord2 = currCord2->next;
-    }
-
-    return sqrt(sum);
+double calcDistanceBetweenPoints(const double *p1, const double *p2, int d) {
+    return sqrt(squaredDistance(p1, p2, d));
 }
 
-int getClosestCentroidIndex(struct vector* headCentroid, struct vector* v) {
+int getClosestCentroidIndex(struct matrix *centroids, const double *v) {
+    distanceKernel distance = squaredDistanceKernel(centroids->cols);
     double minDist = 0.0;
     double dist = 0.0;
     int minIndex = 0;
     int index = 0;
-    struct vector *currCentroid = headCentroid;
-
-    minDist = calcDistanceBetweenPoints(currCentroid->cords, v->cords);
-    currCentroid = currCentroid->next;
-    
-    while (currCentroid != NULL) {
-        index++;
-        dist = calcDistanceBetweenPoints(currCentroid->cords, v->cords);
+
+    minDist = sqrt(distance(MAT_ROW(centroids, 0), v, centroids->cols));
+
+    for (index = 1; index < centroids->rows; index++) {
+        dist = sqrt(distance(MAT_ROW(centroids, index), v, centroids->cols));
         if (dist < minDist) {
             minDist = dist;
             minIndex = index;
         }
-
-        currCentroid = currCentroid->next;
     }
 
     return minIndex;
 }
 
-void copyCordToNewVector(struct vector *source, struct vector *dest) {
-    struct cord *currSource = source->cords;
-    struct cord *currDest;
-
-    currDest = malloc(sizeof(struct cord));
-    currDest->next = NULL;
-    dest->cords = currDest;
-
-    while(currSource->next != NULL) {
-        currDest->value = currSource->value;
-        currDest->next = malloc(sizeof(struct cord));
-        currDest = currDest->next;
-        currDest->next = NULL;
-        currSource = currSource->next;
+/* Assigns every point to its closest centroid and returns how many points
+ * changed cluster. */
+long updateClusters(struct matrix *centroids, struct matrix *points, int *labels) {
+    long changed = 0;
+    int i, label;
+
+    for (i = 0; i < points->rows; i++) {
+        label = getClosestCentroidIndex(centroids, MAT_ROW(points, i));
+        if (label != labels[i]) {
+            labels[i] = label;
+            changed++;
+        }
     }
 
-    currDest->value = currSource->value;
+    return changed;
 }
 
-void copyCordsBetweenVectors(struct vector *source, struct vector *dest) {
-    struct cord *currSource = source->cords;
-    struct cord *currDest = dest->cords;
+/* Adds every point (times weights[i] when weights is not NULL) to the sum of
+ * its cluster and its weight to the cluster's count */
+void accumulateClusters(struct matrix *sums, double *counts, struct matrix *points, const double *weights,
+                        const int *labels) {
+    int i, j, d = points->cols;
+    double weight;
+    double *sum, *point;
+
+    for (i = 0; i < points->rows; i++) {
+        sum = MAT_ROW(sums, labels[i]);
+        point = MAT_ROW(points, i);
+        weight = weights == NULL ? 1 : weights[i];
+
+        for (j = 0; j < d; j++) {
+            sum[j] += weight * point[j];
+        }
 
-    while(currSource != NULL) {
-        currDest->value = currSource->value;
-        currDest = currDest->next;
-        currSource = currSource->next;
+        counts[labels[i]] += weight;
     }
 }
 
-void updateClusters(struct vector *clusters[], 
-                    struct vector *headCentroid, 
-                    struct vector *headVector) {
-    struct vector *currVector, *insertedVector;
-    int centroidIndex = 0;
-
-    currVector = headVector;
-
-    while (currVector != NULL) {
-        centroidIndex = getClosestCentroidIndex(headCentroid, currVector);
-        insertedVector = malloc(sizeof(struct vector));
-        copyCordToNewVector(currVector, insertedVector);
-        insertedVector->next = clusters[centroidIndex];
-        clusters[centroidIndex] = insertedVector;
-        currVector = currVector->next;
+/* Moves every centroid to the mean sums[i] / counts[i] of its cluster and
+ * returns the largest distance a centroid moved. Empty clusters keep their
+ * previous centroid. sums is left holding the means. */
+double moveCentroids(struct matrix *centroids, struct matrix *sums, const double *counts) {
+    int i, j, d = centroids->cols;
+    double delta, maxDelta = 0.0;
+    double *sum;
+
+    for (i = 0; i < centroids->rows; i++) {
+        if (counts[i] == 0) {
+            continue;
+        }
+
+        sum = MAT_ROW(sums, i);
+        for (j = 0; j < d; j++) {
+            sum[j] /= counts[i];
+        }
+
+        delta = calcDistanceBetweenPoints(sum, MAT_ROW(centroids, i), d);
+        if (delta > maxDelta) {
+            maxDelta = delta;
+        }
+
+        memcpy(MAT_ROW(centroids, i), sum, d * sizeof(double));
     }
 
+    return maxDelta;
 }
 
-struct vector * calculateNewCentroid(struct vector *headCluster, int vectorLen) {
-    int i = 0;
-    int vectorCount = 0;
-    double sums[vectorLen];
-    struct vector *currVector, *newCentroid;
-    struct cord *currCord, *newCentroidCord;
+/* Recomputes every centroid as the (weighted, when weights is not NULL) mean
+ * of its cluster and returns the largest distance a centroid moved */
+double calculateNewCentroids(struct matrix *centroids, struct matrix *sums, double *counts,
+                             struct matrix *points, const double *weights, int *labels) {
+    memset(sums->data, 0, sums->bytes);
+    memset(counts, 0, centroids->rows * sizeof(double));
 
-    if (sums == NULL) {
-        printErrorMessage();
-        freeVectorsList(headCluster);
-        return NULL;
-    }
+    accumulateClusters(sums, counts, points, weights, labels);
+    return moveCentroids(centroids, sums, counts);
+}
 
-    currVector = headCluster;
-    for(i=0; i < vectorLen; i++) {
-        sums[i] = 0.0;
-    }
+/* Whether Lloyd iterations go on after iterCount of them, the last having
+ * moved a centroid by maxDelta */
+int kmeansContinues(int iterCount, int maxIter, double maxDelta, double epsilon) {
+    return iterCount <= maxIter && maxDelta > epsilon;
+}
 
-    while (currVector != NULL) {
-        i=0;
-        currCord = currVector->cords;
-        while(currCord != NULL) {
-            sums[i] += currCord->value;
-            currCord = currCord->next;
-            i++;
+/* updateClusters() that also sums the (weighted) squared distance of every
+ * point to its new centroid into inertia */
+static long assignPoints(struct matrix *centroids, struct matrix *points, const double *weights, int *labels,
+                         double *inertia) {
+    distanceKernel distance = squaredDistanceKernel(points->cols);
+    double dist, minDist;
+    long changed = 0;
+    int i, c, label;
+
+    *inertia = 0;
+    for (i = 0; i < points->rows; i++) {
+        minDist = distance(MAT_ROW(centroids, 0), MAT_ROW(points, i), points->cols);
+        label = 0;
+
+        for (c = 1; c < centroids->rows; c++) {
+            dist = distance(MAT_ROW(centroids, c), MAT_ROW(points, i), points->cols);
+            if (dist < minDist) {
+                minDist = dist;
+                label = c;
+            }
         }
-        vectorCount++;
-        currVector = currVector->next;
+
+        *inertia += (weights == NULL ? 1 : weights[i]) * minDist;
+        changed += label != labels[i];
+        labels[i] = label;
     }
-    
-    i=0;
 
-    newCentroid = malloc(sizeof(struct vector));
-    if (newCentroid == NULL) {
-        printErrorMessage();
-        freeVectorsList(headCluster);
-        return NULL;
+    return changed;
+}
+
+/* Whether the run has to stop early after iterCount iterations: the budget
+ * is spent or the progress callback asked for it */
+static int stopsEarly(struct kmeansControl *control, double start, int iterCount, double maxDelta, double inertia) {
+    if (control->progress != NULL && control->progress(control->ctx, iterCount, maxDelta, inertia) != 0) {
+        return 1;
     }
 
-    newCentroid->next = NULL;
-    newCentroidCord = malloc(sizeof(struct cord));
-    if (newCentroid == NULL) {
+    return control->deadlineMs > 0 && monotonicMs() - start >= control->deadlineMs;
+}
+
+static int lloyd(int maxIter, double epsilon, struct matrix *points, const double *weights,
+                 struct matrix *centroids, int *labels, struct kmeansControl *control) {
+    int iterCount = 0, stopped = 0;
+    double maxDelta = epsilon + 1, inertia = 0, start = monotonicMs();
+    struct matrix *sums;
+    double *counts;
+    int *assignment;
+    long changed;
+
+    sums = allocMatrix(centroids->rows, centroids->cols);
+    counts = memAlloc(centroids->rows * sizeof(double));
+    assignment = labels != NULL ? labels : memAlloc(points->rows * sizeof(int));
+
+    if (sums == NULL || counts == NULL || assignment == NULL) {
         printErrorMessage();
-        freeVectorsList(headCluster);
-        freeVectorsList(newCentroid);
-        return NULL;
+        freeMatrix(sums);
+        memFree(counts);
+        if (assignment != labels) {
+            memFree(assignment);
+        }
+        return 1;
     }
 
-    newCentroidCord->next = NULL;
-    newCentroid->cords = newCentroidCord;
-    newCentroidCord->value = sums[i] / vectorCount;
-
-    for (i=1; i<vectorLen; i++) {
-        newCentroidCord->next = malloc(sizeof(struct cord));
-        if (newCentroid == NULL) {
-            printErrorMessage();
-            freeVectorsList(headCluster);
-            freeVectorsList(newCentroid);
-            return NULL;
-        }
+    STATS_BEGIN(STATS_KMEANS);
+    memset(assignment, -1, points->rows * sizeof(int));
 
-        newCentroidCord = newCentroidCord->next;
-        newCentroidCord->next = NULL;
-        newCentroidCord->value = sums[i] / vectorCount;
+    while (!stopped && kmeansContinues(iterCount, maxIter, maxDelta, epsilon)) {
+        changed = control == NULL ? updateClusters(centroids, points, assignment) :
+                  assignPoints(centroids, points, weights, assignment, &inertia);
+        STATS_KMEANS_ITERATION(changed);
+        maxDelta = calculateNewCentroids(centroids, sums, counts, points, weights, assignment);
+        iterCount++;
+        stopped = control != NULL && stopsEarly(control, start, iterCount, maxDelta, inertia);
     }
 
-    return newCentroid;
-}
-
-struct vector ** initializeClustersArray(int k) {
-    int i=0;
-    struct vector ** clusters = malloc(k*sizeof(struct vector*));
-    if (clusters == NULL) {
-        printErrorMessage();
-        return NULL;
+    if (control == NULL) {
+        updateClusters(centroids, points, assignment);
+    } else {
+        assignPoints(centroids, points, weights, assignment, &control->inertia);
+        control->converged = maxDelta <= epsilon;
+        control->iterations = iterCount;
     }
+    STATS_END(STATS_KMEANS);
 
-    for(i=0; i<k; i++) {
-        clusters[i] = NULL;
+    freeMatrix(sums);
+    memFree(counts);
+    if (assignment != labels) {
+        memFree(assignment);
     }
 
-    return clusters;
+    return 0;
 }
 
-struct vector* extractVectorsListFromArray(int pointsAmount, int vectorLength, double points[pointsAmount][vectorLength]) {
-    int i, j;
-    struct vector *headVec, *currVec;
-    struct cord *headCord, *currCord;
+/* Runs Lloyd iterations on `centroids` in place until no centroid moves more
+ * than epsilon or maxIter iterations were made. When labels is not NULL it
+ * receives the final cluster of every point. Returns 0 on success. */
+int kmeans(int maxIter, double epsilon, struct matrix *points, struct matrix *centroids, int *labels) {
+    enum memSubsystem previous = memEnter(MEM_KMEANS);
+    int result = lloyd(maxIter, epsilon, points, NULL, centroids, labels, NULL);
 
-    headVec = malloc(sizeof(struct vector));
-    if (headVec == NULL) {
-        printErrorMessage();
-        return NULL;
-    }
+    memLeave(previous);
+    return result;
+}
 
-    currVec = headVec;
-    currVec->next = NULL;
+/* kmeans() where point i stands for weights[i] identical points. Every
+ * iteration is the same as on the expanded points, up to summation order. */
+int weightedKmeans(int maxIter, double epsilon, struct matrix *points, const double *weights,
+                   struct matrix *centroids, int *labels) {
+    enum memSubsystem previous = memEnter(MEM_KMEANS);
+    int result = lloyd(maxIter, epsilon, points, weights, centroids, labels, NULL);
 
-    for (i=0; i < pointsAmount; i++) {
-        headCord = malloc(sizeof(struct cord));
-        if (headCord == NULL) {
-            printErrorMessage();
-            return NULL;
-        }
+    memLeave(previous);
+    return result;
+}
 
-        currCord = headCord;
-        currCord->next = NULL;
-        currVec->cords = headCord;
-
-        for (j=0; j < vectorLength; j++) {
-            currCord->value = points[i][j];
-            if (j == vectorLength - 1) {
-                currCord->next = NULL;
-            } else {
-                currCord->next = malloc(sizeof(struct cord));
-                if (currCord->next == NULL) {
-                    printErrorMessage();
-                    freeVectorsList(headVec);
-                    return NULL;
-                }
-            }
+/* weightedKmeans() (plain kmeans() when weights is NULL) under control: it
+ * also stops once the deadline passes or the progress callback asks to. The
+ * centroids and labels are then the last iteration's, the lowest-cost ones
+ * so far since Lloyd iterations never raise the cost, and control->converged
+ * is 0. Returns 0 on success, whether or not the run converged. */
+int anytimeKmeans(int maxIter, double epsilon, struct matrix *points, const double *weights,
+                  struct matrix *centroids, int *labels, struct kmeansControl *control) {
+    enum memSubsystem previous = memEnter(MEM_KMEANS);
+    int result = lloyd(maxIter, epsilon, points, weights, centroids, labels, control);
+
+    memLeave(previous);
+    return result;
+}
 
-            currCord = currCord->next;
-        }
+static double calcMinDistance(struct matrix *points, int pointIndex, struct matrix *centroids, int centroidsAmount) {
+    distanceKernel distance = squaredDistanceKernel(points->cols);
+    double dist, minDist = HUGE_VAL;
+    int i;
 
-        if (i == pointsAmount - 1) {
-            currVec->next = NULL;
-        } else {
-            currVec->next = malloc(sizeof(struct vector));
-            if (currVec->next == NULL) {
-                printErrorMessage();
-                freeVectorsList(headVec);
-                return NULL;
-            }
+    for (i = 0; i < centroidsAmount; i++) {
+        dist = sqrt(distance(MAT_ROW(points, pointIndex), MAT_ROW(centroids, i), points->cols));
+        if (dist < minDist) {
+            minDist = dist;
         }
-
-        currVec = currVec->next;
     }
 
-    return headVec;
+    return minDist;
 }
 
-struct vector * kmeans(int k, int maxIter, double epsilon, int vectorLength, int pointsAmount, 
-                       double points[pointsAmount][vectorLength], double centroids[k][vectorLength]) {
-    int i = 0;
-    int firstIter = 1;
-    int iterCount = 0;
-    double delta = 0.0;
-    double maxDelta = 0.0;
-    struct vector *currOldCentroid, *currNewCentroid, *headCentroid, *headVector;
-    struct vector ** clusters = NULL;
-
-    headCentroid = extractVectorsListFromArray(k, vectorLength, centroids);
-    headVector = extractVectorsListFromArray(pointsAmount, vectorLength, points);
-
-    while (iterCount <= maxIter && (firstIter || maxDelta > epsilon)) {
-        if (!firstIter) {
-            freeClusters(clusters, k);
+/* Draws over `rows` rows, row i being points[groupOf[i]] (row i itself when
+ * groupOf is NULL). Distances are taken once per point and spread over its
+ * rows, so the draws match those over the expanded points. */
+static struct matrix * seedCentroids(struct matrix *points, const int *groupOf, int rows, int k,
+                                     unsigned long seed, int *indexes) {
+    struct mt19937 rng;
+    struct matrix *centroids;
+    double *dists, *pointDists;
+    int i, c, index;
+
+    centroids = allocMatrix(k, points->cols);
+    dists = memAlloc(rows * sizeof(double));
+    pointDists = groupOf == NULL ? dists : memAlloc(points->rows * sizeof(double));
+    if (centroids == NULL || dists == NULL || pointDists == NULL) {
+        printErrorMessage();
+        freeMatrix(centroids);
+        memFree(dists);
+        if (pointDists != dists) {
+            memFree(pointDists);
         }
+        return NULL;
+    }
 
-        firstIter = 0;
-        clusters = initializeClustersArray(k);
-
-        if (clusters == NULL) {
-            freeVectorsList(headVector);
-            freeVectorsList(headCentroid);
-            return NULL;
-        }
+    mt19937Seed(&rng, seed);
+    index = (int) mt19937RandomInt(&rng, rows);
 
-        currOldCentroid = headCentroid;
-        updateClusters(clusters, headCentroid, headVector);
-        
-        while (currOldCentroid != NULL) {
-            currNewCentroid = calculateNewCentroid(clusters[i], vectorLength);
-            if (currNewCentroid == NULL) {
-                freeVectorsList(headVector);
-                freeVectorsList(headCentroid);
-                freeClusters(clusters, k);
-                return NULL;
+    for (c = 0; c < k; c++) {
+        if (c > 0) {
+            for (i = 0; i < points->rows; i++) {
+                pointDists[i] = calcMinDistance(points, i, centroids, c);
             }
 
-            delta = calcDistanceBetweenPoints(currNewCentroid->cords, currOldCentroid->cords);
-            
-            if (delta > maxDelta) {
-                maxDelta = delta;
+            for (i = 0; groupOf != NULL && i < rows; i++) {
+                dists[i] = pointDists[groupOf[i]];
             }
 
-            copyCordsBetweenVectors(currNewCentroid, currOldCentroid);
-            freeVectorsList(currNewCentroid);
-            currOldCentroid = currOldCentroid->next;
-            i++;
+            index = mt19937Choice(&rng, dists, rows);
+            if (index < 0) {
+                break;
+            }
         }
 
-        iterCount++;
-        i=0;
+        indexes[c] = index;
+        memcpy(MAT_ROW(centroids, c), MAT_ROW(points, groupOf == NULL ? index : groupOf[index]),
+               points->cols * sizeof(double));
+    }
+
+    memFree(dists);
+    if (pointDists != dists) {
+        memFree(pointDists);
     }
-    
-    freeClusters(clusters, k);
-    freeVectorsList(headVector);
 
-    return headCentroid;
+    if (index < 0) {
+        freeMatrix(centroids);
+        return NULL;
+    }
+
+    return centroids;
+}
+
+/* k-means++ seeding. Draws the same indexes as the original numpy based
+ * implementation seeded with np.random.seed(seed). */
+struct matrix * kmeansPlusPlus(struct matrix *points, int k, unsigned long seed, int *indexes) {
+    enum memSubsystem previous = memEnter(MEM_KMEANS);
+    struct matrix *centroids = seedCentroids(points, NULL, points->rows, k, seed, indexes);
+
+    memLeave(previous);
+    return centroids;
+}
+
+/* k-means++ over n rows where row i is the point groupOf[i], drawing the same
+ * indexes (of rows) as kmeansPlusPlus() on the expanded points */
+struct matrix * groupedKmeansPlusPlus(struct matrix *points, const int *groupOf, int n, int k,
+                                      unsigned long seed, int *indexes) {
+    enum memSubsystem previous = memEnter(MEM_KMEANS);
+    struct matrix *centroids = seedCentroids(points, groupOf, n, k, seed, indexes);
+
+    memLeave(previous);
+    return centroids;
 }
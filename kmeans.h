@@ -1,9 +1,51 @@
 # ifndef KMEANS_H_
 # define KMEANS_H_
 
-struct vector * kmeans(int k, int maxIter, double epsilon, int vectorLength, int pointsAmount, 
-                       double points[pointsAmount][vectorLength], double centroids[k][vectorLength]);
+#include "matrix.h"
 
-struct vector* extractVectorsListFromArray(int pointsAmount, int vectorLength, double points[pointsAmount][vectorLength]);
+#define KMEANS_MAX_ITER 300
+#define KMEANS_EPSILON 0
+#define KMEANS_SEED 0
 
-#endif
\ No newline at end of file
+typedef int (*kmeansProgress)(void *ctx, int iteration, double maxShift, double inertia);
+
+/* Bounds and observes anytimeKmeans(). deadlineMs is a wall-clock budget (0
+ * for none); progress, when set, is called after every iteration with the
+ * largest centroid shift and the inertia of that iteration's assignment, and
+ * stops the run by returning non-zero. The rest is filled in on return. */
+struct kmeansControl {
+    double deadlineMs;
+    kmeansProgress progress;
+    void *ctx;
+    int converged;
+    int iterations;
+    double inertia;
+};
+
+double calcDistanceBetweenPoints(const double *p1, const double *p2, int d);
+
+int getClosestCentroidIndex(struct matrix *centroids, const double *v);
+
+long updateClusters(struct matrix *centroids, struct matrix *points, int *labels);
+
+void accumulateClusters(struct matrix *sums, double *counts, struct matrix *points, const double *weights,
+                        const int *labels);
+
+double moveCentroids(struct matrix *centroids, struct matrix *sums, const double *counts);
+
+int kmeansContinues(int iterCount, int maxIter, double maxDelta, double epsilon);
+
+int anytimeKmeans(int maxIter, double epsilon, struct matrix *points, const double *weights,
+                  struct matrix *centroids, int *labels, struct kmeansControl *control);
+
+int kmeans(int maxIter, double epsilon, struct matrix *points, struct matrix *centroids, int *labels);
+
+int weightedKmeans(int maxIter, double epsilon, struct matrix *points, const double *weights,
+                   struct matrix *centroids, int *labels);
+
+struct matrix * kmeansPlusPlus(struct matrix *points, int k, unsigned long seed, int *indexes);
+
+struct matrix * groupedKmeansPlusPlus(struct matrix *points, const int *groupOf, int n, int k,
+                                      unsigned long seed, int *indexes);
+
+#endif
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "cache.h"
+#include "outofcore.h"
+#include "shard.h"
+#include "coreset.h"
+#include "spkmeans.h"
+#include "libspkmeans.h"
+
+/* n x n matrices a workspace parks up front: W, the degrees and L */
+#define WORKSPACE_MATRICES 3
+
+enum libraryGoal {
+    LIBRARY_WAM,
+    LIBRARY_DDG,
+    LIBRARY_GL,
+    LIBRARY_JACOBI,
+    LIBRARY_CLUSTER
+};
+
+static const char *goalFunctions[] = {"spkmWam", "spkmDdg", "spkmGl", "spkmJacobi", "spkmCluster"};
+
+struct spkmDataset {
+    struct matrix *points;
+};
+
+struct spkmWorkspace {
+    int n;
+    int d;
+    struct matrixPool pool;
+};
+
+struct spkmResult {
+    struct matrix *mat;
+    int k;
+    int *indexes;
+    int *labels;
+};
+
+static spkmErrorHandler userHandler = NULL;
+static void *userContext = NULL;
+static pthread_once_t settled = PTHREAD_ONCE_INIT;
+
+static const char *statusMessages[] = {
+    "success",
+    "invalid argument",
+    "out of memory",
+    "cannot read the points file",
+    "computation failed"
+};
+
+/* The internals report failures by return value; their printed messages,
+ * the stderr detail of a memory budget overrun included, are dropped since
+ * the library never writes to stdout or stderr */
+static void quietError(void) {
+}
+
+/* The internals read their environment settings on first use, which races
+ * when that first use is on several threads at once; the library settles
+ * them on its first call instead */
+static void settleConfiguration(void) {
+    cacheEnabled();
+    outOfCoreEnabled();
+    shardCount();
+    coresetSize();
+    getMemoryBudget();
+}
+
+static void enterLibrary(void) {
+    pthread_once(&settled, settleConfiguration);
+    setErrorHandler(quietError);
+}
+
+static int report(int status, const char *function) {
+    if (status != SPKM_OK && userHandler != NULL) {
+        userHandler(status, function, userContext);
+    }
+
+    return status;
+}
+
+int spkmVersion(void) {
+    return SPKM_API_VERSION;
+}
+
+const char * spkmStatusMessage(int status) {
+    if (status < SPKM_OK || status > SPKM_COMPUTE_FAILED) {
+        return "unknown status";
+    }
+
+    return statusMessages[status];
+}
+
+void spkmSetErrorHandler(spkmErrorHandler handler, void *ctx) {
+    userHandler = handler;
+    userContext = ctx;
+}
+
+int spkmDatasetCreate(const double *points, int n, int d, struct spkmDataset **dataset) {
+    struct spkmDataset *created;
+    int i;
+
+    enterLibrary();
+    if (points == NULL || dataset == NULL || n < 1 || d < 1) {
+        return report(SPKM_INVALID_ARGUMENT, "spkmDatasetCreate");
+    }
+
+    created = memAlloc(sizeof(struct spkmDataset));
+    if (created == NULL || (created->points = allocMatrix(n, d)) == NULL) {
+        memFree(created);
+        return report(SPKM_OUT_OF_MEMORY, "spkmDatasetCreate");
+    }
+
+    for (i = 0; i < n; i++) {
+        memcpy(MAT_ROW(created->points, i), points + (size_t) i * d, d * sizeof(double));
+    }
+
+    *dataset = created;
+    return SPKM_OK;
+}
+
+int spkmDatasetLoad(const char *path, struct spkmDataset **dataset) {
+    struct spkmDataset *created;
+    char *name;
+
+    enterLibrary();
+    if (path == NULL || dataset == NULL) {
+        return report(SPKM_INVALID_ARGUMENT, "spkmDatasetLoad");
+    }
+
+    created = memAlloc(sizeof(struct spkmDataset));
+    name = memAlloc(strlen(path) + 1);
+    if (created == NULL || name == NULL) {
+        memFree(created);
+        memFree(name);
+        return report(SPKM_OUT_OF_MEMORY, "spkmDatasetLoad");
+    }
+
+    strcpy(name, path);
+    created->points = readPoints(name);
+    memFree(name);
+    if (created->points == NULL) {
+        memFree(created);
+        return report(SPKM_IO_ERROR, "spkmDatasetLoad");
+    }
+
+    *dataset = created;
+    return SPKM_OK;
+}
+
+int spkmDatasetShape(const struct spkmDataset *dataset, int *n, int *d) {
+    if (dataset == NULL || n == NULL || d == NULL) {
+        return report(SPKM_INVALID_ARGUMENT, "spkmDatasetShape");
+    }
+
+    *n = dataset->points->rows;
+    *d = dataset->points->cols;
+    return SPKM_OK;
+}
+
+void spkmDatasetFree(struct spkmDataset *dataset) {
+    if (dataset != NULL) {
+        freeMatrix(dataset->points);
+        memFree(dataset);
+    }
+}
+
+int spkmWorkspaceCreate(int n, int d, struct spkmWorkspace **workspace) {
+    struct spkmWorkspace *created;
+    struct matrix *scratch[WORKSPACE_MATRICES];
+    int i, failed = 0;
+
+    enterLibrary();
+    if (workspace == NULL || n < 1 || d < 1) {
+        return report(SPKM_INVALID_ARGUMENT, "spkmWorkspaceCreate");
+    }
+
+    created = memCalloc(1, sizeof(struct spkmWorkspace));
+    if (created == NULL) {
+        return report(SPKM_OUT_OF_MEMORY, "spkmWorkspaceCreate");
+    }
+
+    created->n = n;
+    created->d = d;
+    for (i = 0; i < WORKSPACE_MATRICES; i++) {
+        scratch[i] = allocMatrix(n, n);
+        failed |= scratch[i] == NULL;
+    }
+
+    /* freed into the pool, where the first call finds them */
+    useMatrixPool(&created->pool);
+    for (i = 0; i < WORKSPACE_MATRICES; i++) {
+        freeMatrix(scratch[i]);
+    }
+    useMatrixPool(NULL);
+
+    if (failed) {
+        spkmWorkspaceFree(created);
+        return report(SPKM_OUT_OF_MEMORY, "spkmWorkspaceCreate");
+    }
+
+    *workspace = created;
+    return SPKM_OK;
+}
+
+void spkmWorkspaceFree(struct spkmWorkspace *workspace) {
+    if (workspace != NULL) {
+        drainMatrixPool(&workspace->pool);
+        memFree(workspace);
+    }
+}
+
+int spkmResultCreate(struct spkmResult **result) {
+    enterLibrary();
+    if (result == NULL) {
+        return report(SPKM_INVALID_ARGUMENT, "spkmResultCreate");
+    }
+
+    *result = memCalloc(1, sizeof(struct spkmResult));
+    return *result == NULL ? report(SPKM_OUT_OF_MEMORY, "spkmResultCreate") : SPKM_OK;
+}
+
+static void clearResult(struct spkmResult *result) {
+    freeMatrix(result->mat);
+    memFree(result->indexes);
+    memFree(result->labels);
+    memset(result, 0, sizeof(struct spkmResult));
+}
+
+void spkmResultFree(struct spkmResult *result) {
+    if (result != NULL) {
+        clearResult(result);
+        memFree(result);
+    }
+}
+
+/* Runs one goal with the workspace's pool active. The result's previous
+ * matrix goes back to the pool first, so same-shaped calls recycle it. A
+ * goal that fails after an allocation failed is out of memory. */
+static int runGoal(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, int k,
+                   struct spkmResult *result, enum libraryGoal goal) {
+    struct spkResult *clusters = NULL;
+    struct matrix *points;
+
+    enterLibrary();
+    if (workspace == NULL || dataset == NULL || result == NULL) {
+        return report(SPKM_INVALID_ARGUMENT, goalFunctions[goal]);
+    }
+
+    points = dataset->points;
+    if (points->rows != workspace->n || points->cols != workspace->d
+        || (goal == LIBRARY_JACOBI && points->rows != points->cols) || k < 0 || k > points->rows) {
+        return report(SPKM_INVALID_ARGUMENT, goalFunctions[goal]);
+    }
+
+    memClearFailure();
+    useMatrixPool(&workspace->pool);
+    clearResult(result);
+    switch (goal) {
+        case LIBRARY_WAM:
+            result->mat = wam(points);
+            break;
+        case LIBRARY_DDG:
+            result->mat = ddg(points);
+            break;
+        case LIBRARY_GL:
+            result->mat = gl(points);
+            break;
+        case LIBRARY_JACOBI:
+            result->mat = jacobi(points);
+            break;
+        case LIBRARY_CLUSTER:
+            clusters = spk(points, k);
+            break;
+    }
+    useMatrixPool(NULL);
+
+    if (clusters != NULL) {
+        result->mat = clusters->centroids;
+        result->k = clusters->k;
+        result->indexes = clusters->indexes;
+        result->labels = clusters->labels;
+        memset(clusters, 0, sizeof(struct spkResult));
+        freeSpkResult(clusters);
+    }
+
+    if (result->mat == NULL) {
+        return report(memLastFailure()->kind != MEM_FAILURE_NONE ? SPKM_OUT_OF_MEMORY : SPKM_COMPUTE_FAILED,
+                      goalFunctions[goal]);
+    }
+
+    return SPKM_OK;
+}
+
+int spkmWam(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, struct spkmResult *result) {
+    return runGoal(workspace, dataset, 0, result, LIBRARY_WAM);
+}
+
+int spkmDdg(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, struct spkmResult *result) {
+    return runGoal(workspace, dataset, 0, result, LIBRARY_DDG);
+}
+
+int spkmGl(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, struct spkmResult *result) {
+    return runGoal(workspace, dataset, 0, result, LIBRARY_GL);
+}
+
+int spkmJacobi(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, struct spkmResult *result) {
+    return runGoal(workspace, dataset, 0, result, LIBRARY_JACOBI);
+}
+
+int spkmCluster(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, int k,
+                struct spkmResult *result) {
+    return runGoal(workspace, dataset, k, result, LIBRARY_CLUSTER);
+}
+
+int spkmResultShape(const struct spkmResult *result, int *rows, int *cols) {
+    if (result == NULL || result->mat == NULL || rows == NULL || cols == NULL) {
+        return report(SPKM_INVALID_ARGUMENT, "spkmResultShape");
+    }
+
+    *rows = result->mat->rows;
+    *cols = result->mat->cols;
+    return SPKM_OK;
+}
+
+const double * spkmResultRow(const struct spkmResult *result, int i) {
+    if (result == NULL || result->mat == NULL || i < 0 || i >= result->mat->rows) {
+        return NULL;
+    }
+
+    return MAT_ROW(result->mat, i);
+}
+
+int spkmResultCopy(const struct spkmResult *result, double *out) {
+    int i;
+
+    if (result == NULL || result->mat == NULL || out == NULL) {
+        return report(SPKM_INVALID_ARGUMENT, "spkmResultCopy");
+    }
+
+    for (i = 0; i < result->mat->rows; i++) {
+        memcpy(out + (size_t) i * result->mat->cols, MAT_ROW(result->mat, i), result->mat->cols * sizeof(double));
+    }
+
+    return SPKM_OK;
+}
+
+int spkmResultClusters(const struct spkmResult *result) {
+    return result == NULL ? 0 : result->k;
+}
+
+const int * spkmResultIndexes(const struct spkmResult *result) {
+    return result == NULL ? NULL : result->indexes;
+}
+
+const int * spkmResultLabels(const struct spkmResult *result) {
+    return result == NULL ? NULL : result->labels;
+}
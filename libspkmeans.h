@@ -0,0 +1,107 @@
+# ifndef LIBSPKMEANS_H_
+# define LIBSPKMEANS_H_
+
+/* Embeddable C API of spkmeans, built as libspkmeans.so / libspkmeans.a.
+ * This header is the whole public interface and includes nothing internal.
+ *
+ * Datasets, workspaces and results are opaque handles. A workspace holds
+ * the scratch matrices of the computations for datasets of one shape:
+ * repeated calls through it reuse every matrix instead of going back to
+ * malloc, and a result passed back in reuses its own buffers the same way. A workspace and the results filled through it must be used by one
+ * thread at a time; separate workspaces may run concurrently. The
+ * SPKMEANS_* environment settings are read once, by the first call.
+ *
+ * Every function returning int returns an spkmStatus. Nothing is printed;
+ * failures are reported through the status and, when one is set, the
+ * error handler. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) && defined(SPKMEANS_BUILDING_LIBRARY)
+#define SPKM_API __attribute__((visibility("default")))
+#else
+#define SPKM_API
+#endif
+
+#define SPKM_API_VERSION 1
+
+enum spkmStatus {
+    SPKM_OK = 0,
+    SPKM_INVALID_ARGUMENT,
+    SPKM_OUT_OF_MEMORY,
+    SPKM_IO_ERROR,
+    SPKM_COMPUTE_FAILED
+};
+
+struct spkmDataset;
+struct spkmWorkspace;
+struct spkmResult;
+
+/* Called with the failing status and the API function that returned it */
+typedef void (*spkmErrorHandler)(int status, const char *function, void *ctx);
+
+SPKM_API int spkmVersion(void);
+
+SPKM_API const char * spkmStatusMessage(int status);
+
+SPKM_API void spkmSetErrorHandler(spkmErrorHandler handler, void *ctx);
+
+/* n points of d coordinates, row after row; the points are copied */
+SPKM_API int spkmDatasetCreate(const double *points, int n, int d, struct spkmDataset **dataset);
+
+/* Reads a comma separated points file, one point per line */
+SPKM_API int spkmDatasetLoad(const char *path, struct spkmDataset **dataset);
+
+SPKM_API int spkmDatasetShape(const struct spkmDataset *dataset, int *n, int *d);
+
+SPKM_API void spkmDatasetFree(struct spkmDataset *dataset);
+
+/* Preallocates the n x n scratch matrices of datasets of n points of d
+ * coordinates; the goals reject datasets of any other shape */
+SPKM_API int spkmWorkspaceCreate(int n, int d, struct spkmWorkspace **workspace);
+
+SPKM_API void spkmWorkspaceFree(struct spkmWorkspace *workspace);
+
+SPKM_API int spkmResultCreate(struct spkmResult **result);
+
+SPKM_API void spkmResultFree(struct spkmResult *result);
+
+/* The goals. Each replaces what result held before. wam, ddg and gl give
+ * n x n matrices. jacobi takes a symmetric n x n dataset and gives the
+ * eigenvalues as the first row followed by the eigenvectors as rows.
+ * cluster gives the k x k final centroids, the k initial centroid indexes
+ * and the n labels; k 0 picks it by the eigengap heuristic. */
+SPKM_API int spkmWam(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, struct spkmResult *result);
+
+SPKM_API int spkmDdg(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, struct spkmResult *result);
+
+SPKM_API int spkmGl(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, struct spkmResult *result);
+
+SPKM_API int spkmJacobi(struct spkmWorkspace *workspace, const struct spkmDataset *dataset,
+                        struct spkmResult *result);
+
+SPKM_API int spkmCluster(struct spkmWorkspace *workspace, const struct spkmDataset *dataset, int k,
+                         struct spkmResult *result);
+
+SPKM_API int spkmResultShape(const struct spkmResult *result, int *rows, int *cols);
+
+/* Row i of the result matrix, valid until the result is reused or freed */
+SPKM_API const double * spkmResultRow(const struct spkmResult *result, int i);
+
+/* Copies the result matrix densely, rows * cols doubles, into out */
+SPKM_API int spkmResultCopy(const struct spkmResult *result, double *out);
+
+/* Clustering output of spkmCluster(); k is 0 and the arrays NULL otherwise */
+SPKM_API int spkmResultClusters(const struct spkmResult *result);
+
+SPKM_API const int * spkmResultIndexes(const struct spkmResult *result);
+
+SPKM_API const int * spkmResultLabels(const struct spkmResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
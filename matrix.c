@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+
+static size_t mappedSize(size_t bytes) {
+    return ((bytes + MATRIX_HUGE_PAGE_SIZE - 1) / MATRIX_HUGE_PAGE_SIZE) * MATRIX_HUGE_PAGE_SIZE;
+}
+
+/* Large matrices are mapped directly so they can sit on huge pages: first try
+ * explicit huge pages, then fall back to asking for transparent ones. */
+static void * mapHugePages(size_t bytes) {
+    void *mem;
+    size_t rounded = mappedSize(bytes);
+
+#ifdef MAP_HUGETLB
+    mem = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mem != MAP_FAILED) {
+        return mem;
+    }
+#endif
+
+    mem = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    madvise(mem, rounded, MADV_HUGEPAGE);
+#endif
+
+    return mem;
+}
+
+/* The pool the calling thread recycles double heap matrices through, if any */
+static __thread struct matrixPool *threadPool = NULL;
+
+void useMatrixPool(struct matrixPool *pool) {
+    threadPool = pool;
+}
+
+/* Frees every matrix parked in the pool. It must not be in use by a thread. */
+void drainMatrixPool(struct matrixPool *pool) {
+    struct matrixPool *previous = threadPool;
+
+    threadPool = NULL;
+    while (pool->count > 0) {
+        freeMatrix(pool->entries[--pool->count]);
+    }
+    threadPool = previous;
+}
+
+/* A parked matrix of exactly rows x cols, the most recently parked first */
+static struct matrix * takePooledMatrix(int rows, int cols) {
+    struct matrixPool *pool = threadPool;
+    struct matrix *mat;
+    int i;
+
+    for (i = pool == NULL ? -1 : pool->count - 1; i >= 0; i--) {
+        mat = pool->entries[i];
+        if (mat->rows == rows && mat->cols == cols) {
+            pool->entries[i] = pool->entries[--pool->count];
+            return mat;
+        }
+    }
+
+    return NULL;
+}
+
+/* Parks a heap matrix instead of freeing it, evicting the oldest one when the
+ * pool is full. Returns 1 when mat was parked. */
+static int poolMatrix(struct matrix *mat) {
+    struct matrixPool *pool = threadPool;
+    struct matrix *evicted;
+
+    if (pool == NULL || mat->backing != MATRIX_HEAP) {
+        return 0;
+    }
+
+    if (pool->count == MATRIX_POOL_SIZE) {
+        evicted = pool->entries[0];
+        memmove(pool->entries, pool->entries + 1, (MATRIX_POOL_SIZE - 1) * sizeof(struct matrix *));
+        pool->count--;
+        threadPool = NULL;
+        freeMatrix(evicted);
+        threadPool = pool;
+    }
+
+    pool->entries[pool->count++] = mat;
+    return 1;
+}
+
+#define REAL double
+#define MATRIX struct matrix
+#define MATRIX_FN(name) name
+#define MATRIX_POOLED
+#include "matrix_template.h"
+#undef MATRIX_POOLED
+#undef REAL
+#undef MATRIX
+#undef MATRIX_FN
+
+#define REAL float
+#define MATRIX struct matrixf
+#define MATRIX_FN(name) name##F
+#include "matrix_template.h"
+#undef REAL
+#undef MATRIX
+#undef MATRIX_FN
+
+/* Takes ownership of an existing mapping whose matrix data starts `offset`
+ * bytes in; freeMatrix() unmaps it. */
+struct matrix * wrapMappedMatrix(void *mapBase, size_t mapBytes, size_t offset, int rows, int cols) {
+    return wrapMapping(mapBase, mapBytes, offset, rows, cols, MATRIX_MAPPED);
+}
+
+struct matrixf * matrixToFloat(struct matrix *mat) {
+    struct matrixf *converted = allocMatrixF(mat->rows, mat->cols);
+    int i, j;
+
+    for (i = 0; converted != NULL && i < mat->rows; i++) {
+        for (j = 0; j < mat->cols; j++) {
+            MAT(converted, i, j) = (float) MAT(mat, i, j);
+        }
+    }
+
+    return converted;
+}
+
+struct matrix * matrixToDouble(struct matrixf *mat) {
+    struct matrix *converted = allocMatrix(mat->rows, mat->cols);
+    int i, j;
+
+    for (i = 0; converted != NULL && i < mat->rows; i++) {
+        for (j = 0; j < mat->cols; j++) {
+            MAT(converted, i, j) = MAT(mat, i, j);
+        }
+    }
+
+    return converted;
+}
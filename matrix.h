@@ -0,0 +1,95 @@
+# ifndef MATRIX_H_
+# define MATRIX_H_
+
+#include <stddef.h>
+#include "alloc.h"
+
+#define MATRIX_ALIGNMENT 64
+#define MATRIX_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define MATRIX_HUGE_PAGE_THRESHOLD (32 * 1024 * 1024)
+
+enum matrixBacking {
+    MATRIX_HEAP,
+    MATRIX_MAPPED,
+    MATRIX_SCRATCH
+};
+
+/* Row-major matrix backed by a single aligned allocation. Rows start every
+ * `stride` elements, so each row begins on a cache line boundary. Mapped
+ * matrices remember the whole mapping, which may start before data. The
+ * buffer is charged to the `owner` subsystem of the allocation accounting.
+ * Scratch matrices live in a shared mapping of an unlinked file, so their
+ * pages can be written back and dropped; they are not charged.
+ *
+ * struct matrix holds doubles and struct matrixf floats. Both come from this
+ * one definition and share an API (the float functions end in F), generated
+ * from matrix_template.h. MAT and MAT_ROW work on either. */
+#define MATRIX_STRUCT(name, real) \
+    struct name { \
+        real *data; \
+        int rows; \
+        int cols; \
+        int stride; \
+        size_t bytes; \
+        enum matrixBacking backing; \
+        void *mapBase; \
+        size_t mapBytes; \
+        enum memSubsystem owner; \
+    }
+
+MATRIX_STRUCT(matrix, double);
+
+MATRIX_STRUCT(matrixf, float);
+
+#define MATRIX_POOL_SIZE 16
+
+/* Freed double heap matrices parked for reuse by a thread that allocates the
+ * same shapes over and over, set up with useMatrixPool(). Parked matrices
+ * stay charged to their subsystem until drainMatrixPool(). */
+struct matrixPool {
+    int count;
+    struct matrix *entries[MATRIX_POOL_SIZE];
+};
+
+#define MAT(m, i, j) ((m)->data[(size_t)(i) * (m)->stride + (j)])
+#define MAT_ROW(m, i) ((m)->data + (size_t)(i) * (m)->stride)
+
+int matrixStride(int cols);
+
+struct matrix * allocMatrix(int rows, int cols);
+
+struct matrix * wrapMappedMatrix(void *mapBase, size_t mapBytes, size_t offset, int rows, int cols);
+
+struct matrix * allocScratchMatrix(const char *dir, int rows, int cols);
+
+void releaseMatrixRows(struct matrix *mat, int first, int last);
+
+struct matrix * allocZeroMatrix(int rows, int cols);
+
+struct matrix * copyMatrix(struct matrix *mat);
+
+void freeMatrix(struct matrix *mat);
+
+void useMatrixPool(struct matrixPool *pool);
+
+void drainMatrixPool(struct matrixPool *pool);
+
+int matrixStrideF(int cols);
+
+struct matrixf * allocMatrixF(int rows, int cols);
+
+struct matrixf * allocScratchMatrixF(const char *dir, int rows, int cols);
+
+void releaseMatrixRowsF(struct matrixf *mat, int first, int last);
+
+struct matrixf * allocZeroMatrixF(int rows, int cols);
+
+struct matrixf * copyMatrixF(struct matrixf *mat);
+
+void freeMatrixF(struct matrixf *mat);
+
+struct matrixf * matrixToFloat(struct matrix *mat);
+
+struct matrix * matrixToDouble(struct matrixf *mat);
+
+#endif
@@ -0,0 +1,204 @@
+/* Matrix storage for one element type, included by matrix.c once per
+ * precision with REAL, MATRIX and MATRIX_FN defined, and MATRIX_POOLED when
+ * heap matrices go through the thread's matrix pool. No include guard. */
+
+int MATRIX_FN(matrixStride)(int cols) {
+    int perLine = MATRIX_ALIGNMENT / sizeof(REAL);
+
+    return ((cols + perLine - 1) / perLine) * perLine;
+}
+
+static size_t MATRIX_FN(chargedBytes)(MATRIX *mat) {
+    if (mat->backing == MATRIX_SCRATCH) {
+        return 0;
+    }
+
+    if (mat->backing == MATRIX_MAPPED) {
+        return mat->mapBytes;
+    }
+
+    return mat->bytes > 0 ? mat->bytes : MATRIX_ALIGNMENT;
+}
+
+MATRIX * MATRIX_FN(allocMatrix)(int rows, int cols) {
+    MATRIX *mat;
+    void *data = NULL;
+    int owner;
+
+#ifdef MATRIX_POOLED
+    mat = takePooledMatrix(rows, cols);
+    if (mat != NULL) {
+        return mat;
+    }
+#endif
+
+    mat = memAlloc(sizeof(MATRIX));
+    if (mat == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    mat->rows = rows;
+    mat->cols = cols;
+    mat->stride = MATRIX_FN(matrixStride)(cols);
+    mat->bytes = (size_t) rows * mat->stride * sizeof(REAL);
+    mat->backing = MATRIX_HEAP;
+    mat->mapBase = NULL;
+    mat->mapBytes = 0;
+
+    if (mat->bytes >= MATRIX_HUGE_PAGE_THRESHOLD) {
+        mat->backing = MATRIX_MAPPED;
+        mat->mapBytes = mappedSize(mat->bytes);
+    }
+
+    owner = memReserve(MATRIX_FN(chargedBytes)(mat));
+    if (owner < 0) {
+        data = NULL;
+    } else if (mat->backing == MATRIX_MAPPED) {
+        data = mapHugePages(mat->bytes);
+        mat->mapBase = data;
+    } else if (posix_memalign(&data, MATRIX_ALIGNMENT, MATRIX_FN(chargedBytes)(mat)) != 0) {
+        data = NULL;
+    }
+
+    if (data == NULL) {
+        printErrorMessage();
+        if (owner >= 0) {
+            memRelease(owner, MATRIX_FN(chargedBytes)(mat));
+        }
+        memFree(mat);
+        return NULL;
+    }
+
+    mat->data = data;
+    mat->owner = owner;
+    return mat;
+}
+
+static MATRIX * MATRIX_FN(wrapMapping)(void *mapBase, size_t mapBytes, size_t offset, int rows, int cols,
+                                       enum matrixBacking backing) {
+    MATRIX *mat;
+    int owner = -1;
+
+    mat = memAlloc(sizeof(MATRIX));
+    if (mat != NULL) {
+        mat->data = (REAL *) ((char *) mapBase + offset);
+        mat->rows = rows;
+        mat->cols = cols;
+        mat->stride = MATRIX_FN(matrixStride)(cols);
+        mat->bytes = (size_t) rows * mat->stride * sizeof(REAL);
+        mat->backing = backing;
+        mat->mapBase = mapBase;
+        mat->mapBytes = mapBytes;
+        owner = memReserve(MATRIX_FN(chargedBytes)(mat));
+    }
+
+    if (owner < 0) {
+        printErrorMessage();
+        memFree(mat);
+        munmap(mapBase, mapBytes);
+        return NULL;
+    }
+
+    mat->owner = owner;
+    return mat;
+}
+
+/* A zero filled matrix in a shared mapping of a temporary file under dir.
+ * The file is unlinked right away, so it goes away with the mapping. */
+MATRIX * MATRIX_FN(allocScratchMatrix)(const char *dir, int rows, int cols) {
+    char *path;
+    void *base;
+    size_t bytes = (size_t) rows * MATRIX_FN(matrixStride)(cols) * sizeof(REAL);
+    int fd;
+
+    path = memAlloc(strlen(dir) + 32);
+    if (path == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    sprintf(path, "%s/spkmeans-XXXXXX", dir);
+    fd = mkstemp(path);
+    if (fd >= 0) {
+        unlink(path);
+    }
+    memFree(path);
+
+    if (fd < 0 || ftruncate(fd, bytes > 0 ? bytes : MATRIX_ALIGNMENT) != 0) {
+        printErrorMessage();
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    base = mmap(NULL, bytes > 0 ? bytes : MATRIX_ALIGNMENT, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    return MATRIX_FN(wrapMapping)(base, bytes > 0 ? bytes : MATRIX_ALIGNMENT, 0, rows, cols, MATRIX_SCRATCH);
+}
+
+/* Drops the pages holding rows [first, last) of a scratch matrix from the
+ * process. They stay in the file and fault back in if touched again. */
+void MATRIX_FN(releaseMatrixRows)(MATRIX *mat, int first, int last) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = (size_t) first * mat->stride * sizeof(REAL);
+    size_t end = (size_t) last * mat->stride * sizeof(REAL);
+
+    if (mat->backing != MATRIX_SCRATCH) {
+        return;
+    }
+
+    begin -= begin % page;
+    end -= end % page;
+    if (end > begin) {
+        madvise((char *) mat->data + begin, end - begin, MADV_DONTNEED);
+    }
+}
+
+MATRIX * MATRIX_FN(allocZeroMatrix)(int rows, int cols) {
+    MATRIX *mat = MATRIX_FN(allocMatrix)(rows, cols);
+
+    /* anonymous mappings are already zero filled */
+    if (mat != NULL && mat->backing == MATRIX_HEAP) {
+        memset(mat->data, 0, mat->bytes);
+    }
+
+    return mat;
+}
+
+MATRIX * MATRIX_FN(copyMatrix)(MATRIX *mat) {
+    MATRIX *copy = MATRIX_FN(allocMatrix)(mat->rows, mat->cols);
+
+    if (copy != NULL) {
+        memcpy(copy->data, mat->data, mat->bytes);
+    }
+
+    return copy;
+}
+
+void MATRIX_FN(freeMatrix)(MATRIX *mat) {
+    if (mat == NULL) {
+        return;
+    }
+
+#ifdef MATRIX_POOLED
+    if (poolMatrix(mat)) {
+        return;
+    }
+#endif
+
+    memRelease(mat->owner, MATRIX_FN(chargedBytes)(mat));
+    if (mat->backing != MATRIX_HEAP) {
+        munmap(mat->mapBase, mat->mapBytes);
+    } else {
+        free(mat->data);
+    }
+
+    memFree(mat);
+}
@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "utils.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "kmeans.h"
+#include "distance.h"
+#include "spkmeans.h"
+
+#define MICRO_MIN_TIME_MS 50.0
+#define MICRO_MAX_ITERATIONS 100000000L
+#define MICRO_COUNTERS 4
+
+/* Kernel microbenchmarks. Each kernel runs over a range of shapes until it has
+ * used at least MICRO_MIN_TIME_MS, and time plus hardware counters (cycles,
+ * instructions, cache misses, branch misses from perf_event_open) are
+ * reported per element or per flop of work. Counters that cannot be opened,
+ * e.g. under perf_event_paranoid or in a container, are reported as n/a. */
+
+struct perfCounters {
+    int fds[MICRO_COUNTERS];
+    int available;
+};
+
+struct kernelCase {
+    const char *kernel;
+    char shape[32];
+    double units;
+    const char *unitName;
+    int a;
+    int b;
+};
+
+static const __u64 counterConfigs[MICRO_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static volatile double sink;
+
+static void openCounters(struct perfCounters *counters) {
+    struct perf_event_attr attr;
+    int i;
+
+    counters->available = 1;
+    for (i = 0; i < MICRO_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = counterConfigs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        counters->fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters->fds[i] < 0) {
+            counters->available = 0;
+        }
+    }
+}
+
+static void closeCounters(struct perfCounters *counters) {
+    int i;
+
+    for (i = 0; i < MICRO_COUNTERS; i++) {
+        if (counters->fds[i] >= 0) {
+            close(counters->fds[i]);
+        }
+    }
+}
+
+static void startCounters(struct perfCounters *counters) {
+    int i;
+
+    for (i = 0; i < MICRO_COUNTERS; i++) {
+        if (counters->fds[i] >= 0) {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void stopCounters(struct perfCounters *counters, double *values) {
+    __u64 value;
+    int i;
+
+    for (i = 0; i < MICRO_COUNTERS; i++) {
+        values[i] = -1;
+        if (counters->fds[i] >= 0) {
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counters->fds[i], &value, sizeof(value)) == (ssize_t) sizeof(value)) {
+                values[i] = (double) value;
+            }
+        }
+    }
+}
+
+static double nowMs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static struct matrix * randomMatrix(struct mt19937 *rng, int rows, int cols, int symmetric) {
+    struct matrix *mat = allocMatrix(rows, cols);
+    int i, j;
+
+    if (mat == NULL) {
+        exit(1);
+    }
+
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            MAT(mat, i, j) = symmetric && j < i ? MAT(mat, j, i) : mt19937NextDouble(rng) * 2 - 1;
+        }
+    }
+
+    return mat;
+}
+
+/* Runs `iterations` calls of the case's kernel on prepared inputs */
+static void runKernel(struct kernelCase *kc, struct matrix *x, struct matrix *y, long iterations) {
+    struct matrix *result, *pivot;
+    int pivotIndexes[2];
+    double acc = 0;
+    long it;
+    int i;
+
+    for (it = 0; it < iterations; it++) {
+        if (strcmp(kc->kernel, "calcWeightBetweenPoints") == 0) {
+            for (i = 1; i < x->rows; i++) {
+                acc += calcWeightBetweenPoints(MAT_ROW(x, 0), MAT_ROW(x, i), x->cols);
+            }
+        } else if (strcmp(kc->kernel, "squaredDistance") == 0) {
+            for (i = 1; i < x->rows; i++) {
+                acc += squaredDistance(MAT_ROW(x, 0), MAT_ROW(x, i), x->cols);
+            }
+        } else if (strcmp(kc->kernel, "genericSquaredDistance") == 0) {
+            for (i = 1; i < x->rows; i++) {
+                acc += genericSquaredDistance(MAT_ROW(x, 0), MAT_ROW(x, i), x->cols);
+            }
+        } else if (strcmp(kc->kernel, "getClosestCentroidIndex") == 0) {
+            for (i = 0; i < x->rows; i++) {
+                acc += getClosestCentroidIndex(y, MAT_ROW(x, i));
+            }
+        } else if (strcmp(kc->kernel, "findPivot") == 0) {
+            findPivot(x, pivotIndexes);
+            acc += pivotIndexes[0];
+        } else if (strcmp(kc->kernel, "calcOff") == 0) {
+            acc += calcOff(x);
+        } else if (strcmp(kc->kernel, "matrixMultiply") == 0) {
+            result = matrixMultiply(x, y);
+            acc += MAT(result, 0, 0);
+            freeMatrix(result);
+        } else {
+            pivot = buildPivotMat(x);
+            result = makePivot(pivot, x);
+            acc += MAT(result, 0, 0);
+            freeMatrix(result);
+            freeMatrix(pivot);
+        }
+    }
+
+    sink = acc;
+}
+
+static void prepareInputs(struct kernelCase *kc, struct mt19937 *rng, struct matrix **x, struct matrix **y) {
+    *y = NULL;
+
+    if (strcmp(kc->kernel, "calcWeightBetweenPoints") == 0 || strstr(kc->kernel, "quaredDistance") != NULL) {
+        *x = randomMatrix(rng, 1025, kc->a, 0);
+    } else if (strcmp(kc->kernel, "getClosestCentroidIndex") == 0) {
+        *x = randomMatrix(rng, 1024, kc->a, 0);
+        *y = randomMatrix(rng, kc->b, kc->a, 0);
+    } else if (strcmp(kc->kernel, "matrixMultiply") == 0) {
+        *x = randomMatrix(rng, kc->a, kc->a, 0);
+        *y = randomMatrix(rng, kc->a, kc->a, 0);
+    } else {
+        *x = randomMatrix(rng, kc->a, kc->a, 1);
+    }
+}
+
+static void benchCase(struct kernelCase *kc, struct perfCounters *counters, struct mt19937 *rng) {
+    struct matrix *x, *y;
+    double values[MICRO_COUNTERS], start, elapsed, units;
+    long iterations = 1;
+    int i;
+
+    prepareInputs(kc, rng, &x, &y);
+
+    /* grow the iteration count until one timed run is long enough */
+    for (;;) {
+        start = nowMs();
+        runKernel(kc, x, y, iterations);
+        elapsed = nowMs() - start;
+        if (elapsed >= MICRO_MIN_TIME_MS / 4 || iterations >= MICRO_MAX_ITERATIONS) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    iterations = (long) (iterations * (MICRO_MIN_TIME_MS / (elapsed > 0 ? elapsed : 1))) + 1;
+
+    startCounters(counters);
+    start = nowMs();
+    runKernel(kc, x, y, iterations);
+    elapsed = nowMs() - start;
+    stopCounters(counters, values);
+
+    units = kc->units * iterations;
+    printf("%s,%s,%s,%ld,%.4f", kc->kernel, kc->shape, kc->unitName, iterations, elapsed * 1e6 / units);
+    for (i = 0; i < MICRO_COUNTERS; i++) {
+        if (values[i] < 0) {
+            printf(",n/a");
+        } else {
+            printf(",%.4f", values[i] / units);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+
+    freeMatrix(x);
+    freeMatrix(y);
+}
+
+static int selected(int argc, char *argv[], const char *kernel) {
+    int i;
+
+    if (argc < 2) {
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], kernel) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    static const int dims[] = {2, 3, 4, 8, 16, 64};
+    static const char *distanceKernels[] = {"squaredDistance", "genericSquaredDistance"};
+    static const int clusters[] = {2, 5, 10};
+    static const int sizes[] = {16, 64, 128, 256};
+    static const char *squareKernels[] = {"findPivot", "calcOff", "matrixMultiply", "rotationUpdate"};
+    struct perfCounters counters;
+    struct kernelCase kc;
+    struct mt19937 rng;
+    int i, j;
+
+    mt19937Seed(&rng, 0);
+    openCounters(&counters);
+    if (!counters.available) {
+        fprintf(stderr, "hardware counters unavailable, reporting time only where they could not be opened\n");
+    }
+
+    printf("kernel,shape,unit,iterations,ns_per_unit,cycles_per_unit,instructions_per_unit,"
+           "cache_misses_per_unit,branch_misses_per_unit\n");
+
+    for (i = 0; i < (int) (sizeof(dims) / sizeof(dims[0])); i++) {
+        kc.kernel = "calcWeightBetweenPoints";
+        kc.a = dims[i];
+        sprintf(kc.shape, "d=%d", dims[i]);
+        kc.units = 1024.0 * dims[i];
+        kc.unitName = "element";
+        if (selected(argc, argv, kc.kernel)) {
+            benchCase(&kc, &counters, &rng);
+        }
+
+        /* the dispatched unrolled kernels against the loop they replace */
+        for (j = 0; j < (int) (sizeof(distanceKernels) / sizeof(distanceKernels[0])); j++) {
+            kc.kernel = distanceKernels[j];
+            if (selected(argc, argv, kc.kernel)) {
+                benchCase(&kc, &counters, &rng);
+            }
+        }
+
+        for (j = 0; j < (int) (sizeof(clusters) / sizeof(clusters[0])); j++) {
+            kc.kernel = "getClosestCentroidIndex";
+            kc.b = clusters[j];
+            sprintf(kc.shape, "d=%d k=%d", dims[i], clusters[j]);
+            kc.units = 1024.0 * dims[i] * clusters[j];
+            if (selected(argc, argv, kc.kernel)) {
+                benchCase(&kc, &counters, &rng);
+            }
+        }
+    }
+
+    for (i = 0; i < (int) (sizeof(squareKernels) / sizeof(squareKernels[0])); i++) {
+        for (j = 0; j < (int) (sizeof(sizes) / sizeof(sizes[0])); j++) {
+            kc.kernel = squareKernels[i];
+            kc.a = sizes[j];
+            sprintf(kc.shape, "n=%d", sizes[j]);
+            if (strcmp(kc.kernel, "matrixMultiply") == 0) {
+                kc.units = 2.0 * sizes[j] * sizes[j] * sizes[j];
+                kc.unitName = "flop";
+            } else if (strcmp(kc.kernel, "rotationUpdate") == 0) {
+                kc.units = 4.0 * sizes[j] * sizes[j] * sizes[j];
+                kc.unitName = "flop";
+            } else {
+                kc.units = (double) sizes[j] * sizes[j];
+                kc.unitName = "element";
+            }
+
+            if (selected(argc, argv, kc.kernel)) {
+                benchCase(&kc, &counters, &rng);
+            }
+        }
+    }
+
+    closeCounters(&counters);
+    return 0;
+}
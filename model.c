@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "distance.h"
+#include "kmeans.h"
+#include "stats.h"
+#include "spkmeans.h"
+#include "model.h"
+
+void freeModel(struct spkModel *model) {
+    if (model == NULL) {
+        return;
+    }
+
+    freeMatrix(model->points);
+    memFree(model->degrees);
+    memFree(model->values);
+    freeMatrix(model->vectors);
+    freeMatrix(model->centroids);
+    memFree(model->clusterSizes);
+    memFree(model->labels);
+    memFree(model);
+}
+
+/* gl, Jacobi and k-means as in spk(), keeping what predictions need */
+struct spkModel * fitModel(struct matrix *points, int k) {
+    struct spkModel *model;
+    struct spkResult *result;
+    struct matrix *lMat;
+    struct eigen *eigen;
+    int i, n = points->rows;
+
+    model = memCalloc(1, sizeof(struct spkModel));
+    if (model == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    lMat = gl(points);
+    if (lMat == NULL) {
+        memFree(model);
+        return NULL;
+    }
+
+    model->degrees = memAlloc(n * sizeof(double));
+    for (i = 0; model->degrees != NULL && i < n; i++) {
+        model->degrees[i] = MAT(lMat, i, i);
+    }
+
+    eigen = model->degrees == NULL ? NULL : eigenDecompose(lMat, k == 0 ? EIGEN_EIGENGAP : EIGEN_SORTED, k);
+    freeMatrix(lMat);
+    if (eigen == NULL) {
+        freeModel(model);
+        return NULL;
+    }
+
+    model->k = eigen->k;
+    model->values = memAlloc(eigen->k * sizeof(double));
+    model->vectors = copyMatrix(eigen->vectors);
+    model->points = copyMatrix(points);
+    if (model->values == NULL || model->vectors == NULL || model->points == NULL) {
+        printErrorMessage();
+        freeEigen(eigen);
+        freeModel(model);
+        return NULL;
+    }
+
+    memcpy(model->values, eigen->values, eigen->k * sizeof(double));
+
+    result = clusterEmbedding(eigen);
+    if (result == NULL) {
+        freeModel(model);
+        return NULL;
+    }
+
+    model->centroids = result->centroids;
+    model->labels = result->labels;
+    result->centroids = NULL;
+    result->labels = NULL;
+    freeSpkResult(result);
+
+    model->clusterSizes = memCalloc(model->k, sizeof(double));
+    if (model->clusterSizes == NULL) {
+        printErrorMessage();
+        freeModel(model);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        model->clusterSizes[model->labels[i]]++;
+    }
+
+    return model;
+}
+
+struct weightJob {
+    struct spkModel *model;
+    struct matrix *points;
+    struct matrix *weights;
+    int first;
+};
+
+/* weights[r][j] = W(points[first + r], training point j) */
+static void weighRows(void *ctx, int begin, int end) {
+    struct weightJob *job = ctx;
+    struct matrix *training = job->model->points;
+    distanceKernel distance = squaredDistanceKernel(training->cols);
+    int r, j;
+
+    for (r = begin; r < end; r++) {
+        for (j = 0; j < training->rows; j++) {
+            MAT(job->weights, r, j) = exp(-distance(MAT_ROW(job->points, job->first + r), MAT_ROW(training, j),
+                                                    training->cols) / 2);
+        }
+    }
+}
+
+/* Row r of U extended to a point with weights w to the training points:
+ * L u = lambda u read at the point gives u(x) = sum_j w_j u_j / (d(x) - lambda).
+ * A point the kernel cannot see (d(x) == 0) takes the row of its nearest
+ * training point. Returns d(x). */
+static double extendRow(struct spkModel *model, const double *w, const double *point, double *row) {
+    struct matrix *u = model->vectors;
+    double degree = 0, denominator, dist, minDist = HUGE_VAL;
+    int j, c, nearest = 0;
+
+    for (c = 0; c < model->k; c++) {
+        row[c] = 0;
+    }
+
+    for (j = 0; j < u->rows; j++) {
+        degree += w[j];
+        for (c = 0; c < model->k; c++) {
+            row[c] += w[j] * MAT(u, j, c);
+        }
+    }
+
+    if (degree == 0) {
+        for (j = 0; j < u->rows; j++) {
+            dist = squaredDistance(point, MAT_ROW(model->points, j), model->points->cols);
+            if (dist < minDist) {
+                minDist = dist;
+                nearest = j;
+            }
+        }
+
+        memcpy(row, MAT_ROW(u, nearest), model->k * sizeof(double));
+        return degree;
+    }
+
+    for (c = 0; c < model->k; c++) {
+        denominator = degree - model->values[c];
+        row[c] /= denominator > MODEL_MIN_DENOMINATOR * degree ? denominator : degree;
+    }
+
+    return degree;
+}
+
+/* Embeds the points with the Nystrom extension of the model's eigenvectors,
+ * in O(n d + n k) per point. Weights are evaluated MODEL_BATCH_ROWS points
+ * at a time. When degrees is not NULL it receives every point's degree with
+ * respect to the training points, and trainingDegrees gains every training
+ * point's weight to the new ones. */
+static struct matrix * extend(struct spkModel *model, struct matrix *points, double *degrees, double *trainingDegrees) {
+    struct weightJob job;
+    struct matrix *embedding;
+    int r, j, rows, n = model->points->rows;
+    double degree;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    embedding = allocMatrix(points->rows, model->k);
+    job.model = model;
+    job.points = points;
+    job.weights = allocMatrix(MODEL_BATCH_ROWS < points->rows ? MODEL_BATCH_ROWS : points->rows, n);
+    if (embedding == NULL || job.weights == NULL) {
+        printErrorMessage();
+        freeMatrix(embedding);
+        freeMatrix(job.weights);
+        memLeave(previous);
+        return NULL;
+    }
+
+    for (job.first = 0; job.first < points->rows; job.first += rows) {
+        rows = points->rows - job.first < job.weights->rows ? points->rows - job.first : job.weights->rows;
+        parallelFor(rows, weighRows, &job);
+        STATS_ADD(kernelEvaluations, (long) rows * n);
+
+        for (r = 0; r < rows; r++) {
+            degree = extendRow(model, MAT_ROW(job.weights, r), MAT_ROW(points, job.first + r),
+                               MAT_ROW(embedding, job.first + r));
+            if (degrees != NULL) {
+                degrees[job.first + r] = degree;
+            }
+
+            for (j = 0; trainingDegrees != NULL && j < n; j++) {
+                trainingDegrees[j] += MAT(job.weights, r, j);
+            }
+        }
+    }
+
+    freeMatrix(job.weights);
+    memLeave(previous);
+    return embedding;
+}
+
+struct matrix * embedPoints(struct spkModel *model, struct matrix *points) {
+    return extend(model, points, NULL, NULL);
+}
+
+/* The cluster of every point: its embedding's nearest centroid */
+int predictModel(struct spkModel *model, struct matrix *points, int *labels) {
+    struct matrix *embedding;
+    int i;
+
+    embedding = extend(model, points, NULL, NULL);
+    if (embedding == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < points->rows; i++) {
+        labels[i] = getClosestCentroidIndex(model->centroids, MAT_ROW(embedding, i));
+    }
+
+    freeMatrix(embedding);
+    return 0;
+}
+
+static struct matrix * appendRows(struct matrix *mat, struct matrix *rows) {
+    struct matrix *grown;
+    int i;
+
+    grown = allocMatrix(mat->rows + rows->rows, mat->cols);
+    if (grown == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < grown->rows; i++) {
+        memcpy(MAT_ROW(grown, i), i < mat->rows ? MAT_ROW(mat, i) : MAT_ROW(rows, i - mat->rows),
+               mat->cols * sizeof(double));
+    }
+
+    return grown;
+}
+
+/* Adds the points to the model without refitting. Each is embedded and
+ * labelled as by predictModel(), its centroid moves to the running mean of
+ * its cluster, and the degrees of old and new points are updated for the
+ * new weights. The eigenpairs stay those of the fit; refit once the data
+ * has drifted. labels, when not NULL, receives the new points' clusters. */
+int partialFitModel(struct spkModel *model, struct matrix *points, int *labels) {
+    struct matrix *embedding, *grownPoints, *grownVectors;
+    double *degrees, *grownDegrees, weight;
+    int *grownLabels;
+    int i, j, c, label, n = model->points->rows, b = points->rows;
+
+    /* the training degrees gain the new weights in a copy, so a failure
+     * below leaves the model as it was */
+    grownDegrees = memAlloc((n + b) * sizeof(double));
+    if (grownDegrees == NULL) {
+        printErrorMessage();
+        return 1;
+    }
+    memcpy(grownDegrees, model->degrees, n * sizeof(double));
+    degrees = grownDegrees + n;
+
+    embedding = extend(model, points, degrees, grownDegrees);
+    grownPoints = embedding == NULL ? NULL : appendRows(model->points, points);
+    grownVectors = grownPoints == NULL ? NULL : appendRows(model->vectors, embedding);
+    grownLabels = grownVectors == NULL ? NULL : memRealloc(model->labels, (n + b) * sizeof(int));
+    if (grownLabels == NULL) {
+        printErrorMessage();
+        memFree(grownDegrees);
+        freeMatrix(embedding);
+        freeMatrix(grownPoints);
+        freeMatrix(grownVectors);
+        return 1;
+    }
+    model->labels = grownLabels;
+
+    /* the new points also weigh each other */
+    for (i = 0; i < b; i++) {
+        for (j = i + 1; j < b; j++) {
+            weight = calcWeightBetweenPoints(MAT_ROW(points, i), MAT_ROW(points, j), points->cols);
+            degrees[i] += weight;
+            degrees[j] += weight;
+        }
+    }
+
+    for (i = 0; i < b; i++) {
+        label = getClosestCentroidIndex(model->centroids, MAT_ROW(embedding, i));
+        model->clusterSizes[label]++;
+        for (c = 0; c < model->k; c++) {
+            MAT(model->centroids, label, c) += (MAT(embedding, i, c) - MAT(model->centroids, label, c)) /
+                                               model->clusterSizes[label];
+        }
+
+        model->labels[n + i] = label;
+        if (labels != NULL) {
+            labels[i] = label;
+        }
+    }
+
+    freeMatrix(embedding);
+    freeMatrix(model->points);
+    freeMatrix(model->vectors);
+    memFree(model->degrees);
+    model->points = grownPoints;
+    model->vectors = grownVectors;
+    model->degrees = grownDegrees;
+
+    return 0;
+}
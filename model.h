@@ -0,0 +1,37 @@
+# ifndef MODEL_H_
+# define MODEL_H_
+
+#include "matrix.h"
+
+/* new points are weighed against the training points this many at a time */
+#define MODEL_BATCH_ROWS 64
+
+/* below this fraction of a point's degree, d(x) - lambda is replaced by d(x) */
+#define MODEL_MIN_DENOMINATOR 1e-3
+
+/* A fitted spectral clustering: the n training points, their degrees, the
+ * first k eigenpairs of L (vectors as the n x k embedding U), the k
+ * centroids in embedding space with the number of points behind each, and
+ * the label of every training point. */
+struct spkModel {
+    int k;
+    struct matrix *points;
+    double *degrees;
+    double *values;
+    struct matrix *vectors;
+    struct matrix *centroids;
+    double *clusterSizes;
+    int *labels;
+};
+
+struct spkModel * fitModel(struct matrix *points, int k);
+
+struct matrix * embedPoints(struct spkModel *model, struct matrix *points);
+
+int predictModel(struct spkModel *model, struct matrix *points, int *labels);
+
+int partialFitModel(struct spkModel *model, struct matrix *points, int *labels);
+
+void freeModel(struct spkModel *model);
+
+#endif
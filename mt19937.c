@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include "utils.h"
+#include "alloc.h"
+#include "mt19937.h"
+
+#define MT19937_M 397
+#define MT19937_MATRIX_A 0x9908b0dfUL
+#define MT19937_UPPER_MASK 0x80000000UL
+#define MT19937_LOWER_MASK 0x7fffffffUL
+#define MT19937_WORD_MASK 0xffffffffUL
+
+void mt19937Seed(struct mt19937 *state, unsigned long seed) {
+    int pos;
+
+    seed &= MT19937_WORD_MASK;
+    for (pos = 0; pos < MT19937_STATE_LEN; pos++) {
+        state->key[pos] = seed;
+        seed = (1812433253UL * (seed ^ (seed >> 30)) + pos + 1) & MT19937_WORD_MASK;
+    }
+
+    state->pos = MT19937_STATE_LEN;
+}
+
+static void mt19937Generate(struct mt19937 *state) {
+    int i;
+    unsigned long y;
+
+    for (i = 0; i < MT19937_STATE_LEN; i++) {
+        y = (state->key[i] & MT19937_UPPER_MASK) | (state->key[(i + 1) % MT19937_STATE_LEN] & MT19937_LOWER_MASK);
+        state->key[i] = state->key[(i + MT19937_M) % MT19937_STATE_LEN] ^ (y >> 1) ^ ((y & 1) ? MT19937_MATRIX_A : 0);
+    }
+
+    state->pos = 0;
+}
+
+unsigned long mt19937NextUint32(struct mt19937 *state) {
+    unsigned long y;
+
+    if (state->pos == MT19937_STATE_LEN) {
+        mt19937Generate(state);
+    }
+
+    y = state->key[state->pos++];
+    y ^= (y >> 11);
+    y ^= (y << 7) & 0x9d2c5680UL;
+    y ^= (y << 15) & 0xefc60000UL;
+    y ^= (y >> 18);
+
+    return y & MT19937_WORD_MASK;
+}
+
+/* 53-bit uniform double in [0, 1), same construction as numpy's random_sample */
+double mt19937NextDouble(struct mt19937 *state) {
+    long a = (long) (mt19937NextUint32(state) >> 5);
+    long b = (long) (mt19937NextUint32(state) >> 6);
+
+    return (a * 67108864.0 + b) / 9007199254740992.0;
+}
+
+/* Uniform integer in [0, high) drawn by masked rejection, like numpy's legacy
+ * randint for ranges that fit in 32 bits. */
+unsigned long mt19937RandomInt(struct mt19937 *state, unsigned long high) {
+    unsigned long rng, mask, val;
+
+    if (high <= 1) {
+        return 0;
+    }
+
+    rng = high - 1;
+    mask = rng;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+
+    while ((val = (mt19937NextUint32(state) & mask)) > rng);
+
+    return val;
+}
+
+/* Index drawn with probability proportional to weights, reproducing
+ * RandomState.choice(n, p=weights / sum(weights)). */
+int mt19937Choice(struct mt19937 *state, const double *weights, int n) {
+    double *cdf;
+    double total = 0, u;
+    int i, index;
+
+    cdf = memAlloc(n * sizeof(double));
+    if (cdf == NULL) {
+        printErrorMessage();
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        total += weights[i];
+    }
+
+    cdf[0] = weights[0] / total;
+    for (i = 1; i < n; i++) {
+        cdf[i] = cdf[i - 1] + weights[i] / total;
+    }
+
+    for (i = 0; i < n; i++) {
+        cdf[i] /= cdf[n - 1];
+    }
+
+    u = mt19937NextDouble(state);
+    for (index = 0; index < n - 1 && cdf[index] <= u; index++);
+
+    memFree(cdf);
+    return index;
+}
@@ -0,0 +1,23 @@
+# ifndef MT19937_H_
+# define MT19937_H_
+
+#define MT19937_STATE_LEN 624
+
+/* Mersenne Twister matching numpy's legacy RandomState, so a native run seeded
+ * like np.random.seed(s) draws the same sequence as the Python implementation. */
+struct mt19937 {
+    unsigned long key[MT19937_STATE_LEN];
+    int pos;
+};
+
+void mt19937Seed(struct mt19937 *state, unsigned long seed);
+
+unsigned long mt19937NextUint32(struct mt19937 *state);
+
+double mt19937NextDouble(struct mt19937 *state);
+
+unsigned long mt19937RandomInt(struct mt19937 *state, unsigned long high);
+
+int mt19937Choice(struct mt19937 *state, const double *weights, int n);
+
+#endif
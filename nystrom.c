@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "parallel.h"
+#include "stats.h"
+#include "spkmeans.h"
+#include "nystrom.h"
+
+/* m distinct point indexes drawn uniformly by a partial Fisher-Yates shuffle */
+int sampleLandmarks(int n, int m, unsigned long seed, int *landmarks) {
+    struct mt19937 rng;
+    int *perm, i, j, tmp;
+
+    perm = memAlloc(n * sizeof(int));
+    if (perm == NULL) {
+        printErrorMessage();
+        return 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+
+    mt19937Seed(&rng, seed);
+    for (i = 0; i < m; i++) {
+        j = i + (int) mt19937RandomInt(&rng, n - i);
+        tmp = perm[i];
+        perm[i] = perm[j];
+        perm[j] = tmp;
+        landmarks[i] = perm[i];
+    }
+
+    memFree(perm);
+    return 0;
+}
+
+struct landmarkJob {
+    struct matrix *points;
+    struct matrix *c;
+    const int *landmarks;
+};
+
+/* C[x][l] = W(x, landmark l), zero where x is the landmark itself */
+static void landmarkAffinity(void *ctx, int begin, int end) {
+    struct landmarkJob *job = ctx;
+    int x, l;
+
+    for (x = begin; x < end; x++) {
+        for (l = 0; l < job->c->cols; l++) {
+            MAT(job->c, x, l) = x == job->landmarks[l] ? 0 :
+                calcWeightBetweenPoints(MAT_ROW(job->points, x), MAT_ROW(job->points, job->landmarks[l]),
+                                        job->points->cols);
+        }
+    }
+}
+
+/* Approximate eigenpairs of L from m landmarks. The landmark graph, with
+ * its weights scaled by n / m, stands in for the full one: its m x m
+ * Laplacian is decomposed exactly and every eigenvector is extended to all
+ * points with the Nyström formula
+ *
+ *     u(x) = (n / m) * sum_l W(x, l) u(l) / (d(x) - lambda)
+ *
+ * which reproduces u on the landmarks. The columns are then normalized.
+ * Runs in O(n m d + m^3); eigen->n is the number of landmarks, which k may
+ * not exceed. */
+struct eigen * nystromEigen(struct matrix *points, int m, int options, int k) {
+    struct landmarkJob job;
+    struct matrix *lMat, *u;
+    struct eigen *eigen;
+    double *degrees, scale, sum, norm, den;
+    int *landmarks, x, a, l, c, n = points->rows;
+    enum memSubsystem previous;
+
+    if (m < 1 || m > n) {
+        m = n;
+    }
+
+    if (k > m) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    scale = (double) n / m;
+    previous = memEnter(MEM_AFFINITY);
+    landmarks = memAlloc(m * sizeof(int));
+    degrees = memAlloc(n * sizeof(double));
+    job.c = allocMatrix(n, m);
+    lMat = allocZeroMatrix(m, m);
+    if (landmarks == NULL || degrees == NULL || job.c == NULL || lMat == NULL ||
+        sampleLandmarks(n, m, NYSTROM_SEED, landmarks) != 0) {
+        printErrorMessage();
+        memFree(landmarks);
+        memFree(degrees);
+        freeMatrix(job.c);
+        freeMatrix(lMat);
+        memLeave(previous);
+        return NULL;
+    }
+
+    STATS_BEGIN(STATS_WAM);
+    job.points = points;
+    job.landmarks = landmarks;
+    parallelFor(n, landmarkAffinity, &job);
+    STATS_ADD(kernelEvaluations, (long) n * m);
+    STATS_END(STATS_WAM);
+
+    for (x = 0; x < n; x++) {
+        sum = 0;
+        for (l = 0; l < m; l++) {
+            sum += MAT(job.c, x, l);
+        }
+        degrees[x] = scale * sum;
+    }
+
+    for (a = 0; a < m; a++) {
+        for (l = 0; l < m; l++) {
+            MAT(lMat, a, l) = (a == l ? degrees[landmarks[a]] : 0) - scale * MAT(job.c, landmarks[a], l);
+        }
+    }
+    memLeave(previous);
+
+    eigen = eigenDecompose(lMat, options, k);
+    freeMatrix(lMat);
+
+    previous = memEnter(MEM_EIGEN);
+    u = eigen == NULL ? NULL : allocMatrix(n, eigen->k);
+    if (u == NULL) {
+        freeEigen(eigen);
+        memFree(landmarks);
+        memFree(degrees);
+        freeMatrix(job.c);
+        memLeave(previous);
+        return NULL;
+    }
+
+    for (x = 0; x < n; x++) {
+        for (c = 0; c < eigen->k; c++) {
+            sum = 0;
+            for (l = 0; l < m; l++) {
+                sum += MAT(job.c, x, l) * MAT(eigen->vectors, l, c);
+            }
+
+            den = degrees[x] - eigen->values[c];
+            MAT(u, x, c) = fabs(den) > 1e-12 ? scale * sum / den : 0;
+        }
+    }
+
+    for (c = 0; c < eigen->k; c++) {
+        norm = 0;
+        for (x = 0; x < n; x++) {
+            norm += MAT(u, x, c) * MAT(u, x, c);
+        }
+
+        norm = sqrt(norm);
+        for (x = 0; norm > 0 && x < n; x++) {
+            MAT(u, x, c) /= norm;
+        }
+    }
+
+    freeMatrix(eigen->vectors);
+    eigen->vectors = u;
+
+    memFree(landmarks);
+    memFree(degrees);
+    freeMatrix(job.c);
+    memLeave(previous);
+
+    return eigen;
+}
+
+/* The spk flow on the Nyström embedding instead of the exact one */
+struct spkResult * spkNystrom(struct matrix *points, int k, int m) {
+    struct eigen *eigen;
+
+    eigen = nystromEigen(points, m, k == 0 ? EIGEN_EIGENGAP : EIGEN_SORTED, k);
+    if (eigen == NULL) {
+        return NULL;
+    }
+
+    return clusterEmbedding(eigen);
+}
+
+static double pairs(double count) {
+    return count * (count - 1) / 2;
+}
+
+/* Adjusted Rand index of two labelings of n points, 1 when they agree up to
+ * renaming the clusters. Returns 0 on success. */
+int adjustedRandIndex(const int *labels1, const int *labels2, int n, int k1, int k2, double *ari) {
+    long *table, *rows, *cols;
+    double index = 0, rowPairs = 0, colPairs = 0, expected, best;
+    int i, j;
+
+    table = memAlloc((size_t) k1 * k2 * sizeof(long));
+    rows = memAlloc(k1 * sizeof(long));
+    cols = memAlloc(k2 * sizeof(long));
+    if (table == NULL || rows == NULL || cols == NULL) {
+        printErrorMessage();
+        memFree(table);
+        memFree(rows);
+        memFree(cols);
+        return 1;
+    }
+
+    memset(table, 0, (size_t) k1 * k2 * sizeof(long));
+    memset(rows, 0, k1 * sizeof(long));
+    memset(cols, 0, k2 * sizeof(long));
+
+    for (i = 0; i < n; i++) {
+        table[(size_t) labels1[i] * k2 + labels2[i]]++;
+        rows[labels1[i]]++;
+        cols[labels2[i]]++;
+    }
+
+    for (i = 0; i < k1; i++) {
+        for (j = 0; j < k2; j++) {
+            index += pairs(table[(size_t) i * k2 + j]);
+        }
+        rowPairs += pairs(rows[i]);
+    }
+
+    for (j = 0; j < k2; j++) {
+        colPairs += pairs(cols[j]);
+    }
+
+    memFree(table);
+    memFree(rows);
+    memFree(cols);
+
+    expected = rowPairs * colPairs / pairs(n);
+    best = (rowPairs + colPairs) / 2;
+    *ari = best == expected ? 1 : (index - expected) / (best - expected);
+
+    return 0;
+}
+
+/* Runs the exact and the Nyström flows on the same points and k (picked by
+ * the exact eigengap when 0) and fills quality. Returns 0 on success and 1
+ * on failures, k above the landmark count included. */
+int compareNystrom(struct matrix *points, int k, int m, struct nystromQuality *quality) {
+    struct matrix *lMat;
+    struct eigen *exact, *approx;
+    struct spkResult *exactResult, *approxResult;
+    double start, *exactValues, error = 0, total = 0;
+    int i, failed;
+
+    start = monotonicMs();
+    lMat = gl(points);
+    exact = lMat == NULL ? NULL : eigenDecompose(lMat, k == 0 ? EIGEN_EIGENGAP : EIGEN_SORTED, k);
+    freeMatrix(lMat);
+    if (exact == NULL) {
+        return 1;
+    }
+
+    k = exact->k;
+    quality->k = k;
+    quality->exactConverged = exact->converged;
+    quality->landmarks = m < 1 || m > points->rows ? points->rows : m;
+    if (k > quality->landmarks) {
+        printErrorMessage();
+        freeEigen(exact);
+        return 1;
+    }
+
+    /* clusterEmbedding() frees the eigen, the values are needed later */
+    exactValues = memAlloc(k * sizeof(double));
+    if (exactValues == NULL) {
+        printErrorMessage();
+        freeEigen(exact);
+        return 1;
+    }
+    memcpy(exactValues, exact->values, k * sizeof(double));
+
+    exactResult = clusterEmbedding(exact);
+    quality->exactMs = monotonicMs() - start;
+
+    start = monotonicMs();
+    approx = exactResult == NULL ? NULL : nystromEigen(points, m, EIGEN_SORTED, k);
+    if (approx == NULL) {
+        memFree(exactValues);
+        freeSpkResult(exactResult);
+        return 1;
+    }
+
+    /* relative to the exact values, summed over the first k of them */
+    for (i = 0; i < k; i++) {
+        error += fabs(approx->values[i] - exactValues[i]);
+        total += fabs(exactValues[i]);
+    }
+    quality->eigenvalueError = total > 0 ? error / total : error;
+    quality->landmarkConverged = approx->converged;
+    memFree(exactValues);
+
+    approxResult = clusterEmbedding(approx);
+    quality->nystromMs = monotonicMs() - start;
+
+    failed = approxResult == NULL ||
+             adjustedRandIndex(exactResult->labels, approxResult->labels, points->rows, k, k, &quality->adjustedRand);
+
+    freeSpkResult(exactResult);
+    freeSpkResult(approxResult);
+    return failed;
+}
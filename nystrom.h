@@ -0,0 +1,35 @@
+# ifndef NYSTROM_H_
+# define NYSTROM_H_
+
+#include "matrix.h"
+#include "spkmeans.h"
+
+#define NYSTROM_DEFAULT_LANDMARKS 200
+#define NYSTROM_SEED 0
+
+/* How far the Nyström flow is from the exact gl + jacobi one on the same
+ * points: label agreement (adjusted Rand index), relative L1 error of the
+ * first k eigenvalues, the time each flow took and whether the exact and
+ * the landmark eigensolves converged. */
+struct nystromQuality {
+    int k;
+    int landmarks;
+    int exactConverged;
+    int landmarkConverged;
+    double adjustedRand;
+    double eigenvalueError;
+    double exactMs;
+    double nystromMs;
+};
+
+int sampleLandmarks(int n, int m, unsigned long seed, int *landmarks);
+
+struct eigen * nystromEigen(struct matrix *points, int m, int options, int k);
+
+struct spkResult * spkNystrom(struct matrix *points, int k, int m);
+
+int adjustedRandIndex(const int *labels1, const int *labels2, int n, int k1, int k2, double *ari);
+
+int compareNystrom(struct matrix *points, int k, int m, struct nystromQuality *quality);
+
+#endif
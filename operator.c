@@ -0,0 +1,190 @@
+#include <stddef.h>
+#include <math.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "distance.h"
+#include "stats.h"
+#include "outofcore.h"
+#include "spkmeans.h"
+#include "operator.h"
+
+/* L = D - W kept as the points and their degrees, plus the first cachedRows
+ * rows of W when some memory was allowed for them */
+struct laplacianContext {
+    struct matrix *points;
+    struct matrix *degrees;
+    struct matrix *cache;
+    int cachedRows;
+};
+
+struct laplacianJob {
+    struct laplacianContext *lap;
+    struct matrix *x;
+    struct matrix *y;
+};
+
+static void applyDense(struct linearOperator *op, struct matrix *x, struct matrix *y) {
+    streamMatMul(op->ctx, x, y);
+}
+
+static void applyDenseF(struct linearOperator *op, struct matrix *x, struct matrix *y) {
+    streamMatMulF(op->ctx, x, y);
+}
+
+/* Wraps a dense symmetric matrix, in memory or in a scratch file. The bound
+ * is the largest Gershgorin row sum, found in one pass over the rows. */
+void denseOperator(struct matrix *a, struct linearOperator *op) {
+    op->n = a->rows;
+    op->bound = gershgorinBound(a);
+    op->apply = applyDense;
+    op->ctx = a;
+}
+
+/* The same over a float matrix; products are still accumulated in double */
+void denseOperatorF(struct matrixf *a, struct linearOperator *op) {
+    op->n = a->rows;
+    op->bound = gershgorinBoundF(a);
+    op->apply = applyDenseF;
+    op->ctx = a;
+}
+
+static int rowBlocks(int rows) {
+    return (rows + TILE_ROWS - 1) / TILE_ROWS;
+}
+
+static void cacheBlocks(void *ctx, int begin, int end) {
+    struct laplacianContext *lap = ctx;
+    distanceKernel distance = squaredDistanceKernel(lap->points->cols);
+    int b, i, j, last, n = lap->points->rows;
+
+    for (b = begin; b < end; b++) {
+        last = (b + 1) * TILE_ROWS < lap->cachedRows ? (b + 1) * TILE_ROWS : lap->cachedRows;
+        for (i = b * TILE_ROWS; i < last; i++) {
+            for (j = 0; j < n; j++) {
+                MAT(lap->cache, i, j) = i == j ? 0 :
+                                        exp(-distance(MAT_ROW(lap->points, i), MAT_ROW(lap->points, j),
+                                                      lap->points->cols) / 2);
+            }
+        }
+    }
+}
+
+/* Y = L X over one row block of L at a time, walking the columns TILE_COLS
+ * points at a time so they stay in cache for every row of the block. Each
+ * row still sums its terms in increasing column order with the same entries
+ * as gl(), so the products match streamMatMul() on gl() bit for bit. */
+static void laplacianBlocks(void *ctx, int begin, int end) {
+    struct laplacianJob *job = ctx;
+    struct laplacianContext *lap = job->lap;
+    struct matrix *points = lap->points;
+    distanceKernel distance = squaredDistanceKernel(points->cols);
+    int b, i, j, c, first, last, tile, tileEnd, n = points->rows, cols = job->x->cols;
+    double weight, value, *xRow, *yRow, *cacheRow;
+
+    for (b = begin; b < end; b++) {
+        first = b * TILE_ROWS;
+        last = first + TILE_ROWS < n ? first + TILE_ROWS : n;
+
+        for (i = first; i < last; i++) {
+            yRow = MAT_ROW(job->y, i);
+            for (c = 0; c < cols; c++) {
+                yRow[c] = 0;
+            }
+        }
+
+        for (tile = 0; tile < n; tile += TILE_COLS) {
+            tileEnd = tile + TILE_COLS < n ? tile + TILE_COLS : n;
+
+            for (i = first; i < last; i++) {
+                yRow = MAT_ROW(job->y, i);
+                cacheRow = i < lap->cachedRows ? MAT_ROW(lap->cache, i) : NULL;
+                for (j = tile; j < tileEnd; j++) {
+                    if (cacheRow != NULL) {
+                        weight = cacheRow[j];
+                    } else {
+                        weight = i == j ? 0 : exp(-distance(MAT_ROW(points, i), MAT_ROW(points, j), points->cols) / 2);
+                    }
+
+                    value = (i == j ? MAT(lap->degrees, 0, i) : 0) - weight;
+                    xRow = MAT_ROW(job->x, j);
+                    for (c = 0; c < cols; c++) {
+                        yRow[c] += value * xRow[c];
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void applyLaplacian(struct linearOperator *op, struct matrix *x, struct matrix *y) {
+    struct laplacianJob job;
+
+    job.lap = op->ctx;
+    job.x = x;
+    job.y = y;
+    parallelFor(rowBlocks(op->n), laplacianBlocks, &job);
+    STATS_ADD(kernelEvaluations, (long) (op->n - job.lap->cachedRows) * (op->n - 1));
+}
+
+/* The Laplacian of the points as an operator that never stores L: every
+ * product recomputes W tile by tile from the coordinates, with the degrees
+ * summed once up front, so memory stays O(n d) besides X and Y. All n x b
+ * columns of X go through in the same pass, sharing each weight evaluated.
+ * Up to cacheBytes of leading W rows are computed once and kept instead.
+ * The points must outlive the operator. Returns 0 on success. */
+int laplacianOperator(struct matrix *points, size_t cacheBytes, struct linearOperator *op) {
+    struct laplacianContext *lap;
+    int i, n = points->rows;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    lap = memCalloc(1, sizeof(struct laplacianContext));
+    if (lap == NULL) {
+        memLeave(previous);
+        return 1;
+    }
+
+    lap->points = points;
+    lap->degrees = degrees(points);
+    lap->cachedRows = cacheBytes / ((size_t) n * sizeof(double)) < (size_t) n ?
+                      (int) (cacheBytes / ((size_t) n * sizeof(double))) : n;
+    lap->cache = lap->cachedRows > 0 ? allocMatrix(lap->cachedRows, n) : NULL;
+    if (lap->degrees == NULL || (lap->cachedRows > 0 && lap->cache == NULL)) {
+        freeMatrix(lap->degrees);
+        freeMatrix(lap->cache);
+        memFree(lap);
+        memLeave(previous);
+        return 1;
+    }
+
+    if (lap->cachedRows > 0) {
+        parallelFor(rowBlocks(lap->cachedRows), cacheBlocks, lap);
+        STATS_ADD(kernelEvaluations, (long) lap->cachedRows * (n - 1));
+    }
+
+    /* the Gershgorin row sum of L is twice the degree */
+    op->n = n;
+    op->bound = 0;
+    for (i = 0; i < n; i++) {
+        if (2 * MAT(lap->degrees, 0, i) > op->bound) {
+            op->bound = 2 * MAT(lap->degrees, 0, i);
+        }
+    }
+
+    op->apply = applyLaplacian;
+    op->ctx = lap;
+    memLeave(previous);
+    return 0;
+}
+
+void freeLaplacianOperator(struct linearOperator *op) {
+    struct laplacianContext *lap = op->ctx;
+
+    if (lap != NULL) {
+        freeMatrix(lap->degrees);
+        freeMatrix(lap->cache);
+        memFree(lap);
+        op->ctx = NULL;
+    }
+}
@@ -0,0 +1,24 @@
+# ifndef OPERATOR_H_
+# define OPERATOR_H_
+
+#include <stddef.h>
+#include "matrix.h"
+
+/* A symmetric n x n linear operator, known only through Y = A X on n x b
+ * blocks. bound is an upper bound on its largest eigenvalue. */
+struct linearOperator {
+    int n;
+    double bound;
+    void (*apply)(struct linearOperator *op, struct matrix *x, struct matrix *y);
+    void *ctx;
+};
+
+void denseOperator(struct matrix *a, struct linearOperator *op);
+
+void denseOperatorF(struct matrixf *a, struct linearOperator *op);
+
+int laplacianOperator(struct matrix *points, size_t cacheBytes, struct linearOperator *op);
+
+void freeLaplacianOperator(struct linearOperator *op);
+
+#endif
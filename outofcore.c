@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/mman.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "distance.h"
+#include "spkmeans.h"
+#include "stats.h"
+#include "outofcore.h"
+
+static int configured = 0;
+static char dirPath[OUT_OF_CORE_MAX_PATH];
+
+/* Out-of-core mode is configured from SPKMEANS_SCRATCH_DIR unless
+ * setOutOfCore() was called first. A NULL or empty dir disables it. */
+void setOutOfCore(const char *dir) {
+    configured = 1;
+    dirPath[0] = '\0';
+
+    if (dir != NULL && strlen(dir) < OUT_OF_CORE_MAX_PATH - 32) {
+        strcpy(dirPath, dir);
+    }
+}
+
+int outOfCoreEnabled(void) {
+    if (!configured) {
+        setOutOfCore(getenv(OUT_OF_CORE_DIR_ENV));
+    }
+
+    return dirPath[0] != '\0';
+}
+
+const char * scratchDir(void) {
+    return outOfCoreEnabled() ? dirPath : NULL;
+}
+
+static int blockCount(int rows) {
+    return (rows + TILE_ROWS - 1) / TILE_ROWS;
+}
+
+#define REAL double
+#define REAL_EXP exp
+#define MATRIX struct matrix
+#define REAL_FN(name) name
+#include "tiles_template.h"
+#undef REAL
+#undef REAL_EXP
+#undef MATRIX
+#undef REAL_FN
+
+#define REAL float
+#define REAL_EXP expf
+#define MATRIX struct matrixf
+#define REAL_FN(name) name##F
+#include "tiles_template.h"
+#undef REAL
+#undef REAL_EXP
+#undef MATRIX
+#undef REAL_FN
@@ -0,0 +1,37 @@
+# ifndef OUTOFCORE_H_
+# define OUTOFCORE_H_
+
+#include "matrix.h"
+
+#define OUT_OF_CORE_DIR_ENV "SPKMEANS_SCRATCH_DIR"
+#define OUT_OF_CORE_MAX_PATH 4096
+
+/* W and L are produced TILE_ROWS rows at a time; within a row block the
+ * columns are walked TILE_COLS points at a time so those points stay in
+ * cache while every row of the block uses them. */
+#define TILE_ROWS 16
+#define TILE_COLS 256
+
+void setOutOfCore(const char *dir);
+
+int outOfCoreEnabled(void);
+
+const char * scratchDir(void);
+
+struct matrix * tiledAffinity(struct matrix *points, int laplacian);
+
+struct matrix * streamedDegrees(struct matrix *points);
+
+void streamMatMul(struct matrix *mat, struct matrix *x, struct matrix *y);
+
+double gershgorinBound(struct matrix *mat);
+
+struct matrixf * tiledAffinityF(struct matrixf *points, int laplacian);
+
+struct matrix * streamedDegreesF(struct matrixf *points);
+
+void streamMatMulF(struct matrixf *mat, struct matrix *x, struct matrix *y);
+
+double gershgorinBoundF(struct matrixf *mat);
+
+#endif
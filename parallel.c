@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "alloc.h"
+#include "parallel.h"
+
+struct parallelRange {
+    parallelTask task;
+    void *ctx;
+    int begin;
+    int end;
+    enum memSubsystem subsystem;
+    struct memFailure failure;
+};
+
+/* Thread count from SPKMEANS_THREADS, defaulting to the online CPUs */
+int getThreadCount(void) {
+    char *env = getenv(PARALLEL_THREADS_ENV);
+    long threads = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (threads < 1) {
+        return 1;
+    }
+
+    return threads > PARALLEL_MAX_THREADS ? PARALLEL_MAX_THREADS : (int) threads;
+}
+
+static void * runRange(void *arg) {
+    struct parallelRange *range = arg;
+    enum memSubsystem previous = memEnter(range->subsystem);
+
+    range->task(range->ctx, range->begin, range->end);
+    memTakeFailure(&range->failure);
+    memLeave(previous);
+    return NULL;
+}
+
+/* Splits [0, count) into one contiguous range per thread and runs task on
+ * each of them, the calling thread taking the first range. Ranges whose
+ * thread could not be started run serially on the caller. */
+void parallelFor(int count, parallelTask task, void *ctx) {
+    struct parallelRange ranges[PARALLEL_MAX_THREADS];
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int started[PARALLEL_MAX_THREADS];
+    int i, threadCount = getThreadCount();
+
+    if (threadCount > count) {
+        threadCount = count;
+    }
+
+    if (threadCount <= 1) {
+        if (count > 0) {
+            task(ctx, 0, count);
+        }
+        return;
+    }
+
+    for (i = 0; i < threadCount; i++) {
+        ranges[i].task = task;
+        ranges[i].ctx = ctx;
+        ranges[i].begin = (int) ((long) count * i / threadCount);
+        ranges[i].end = (int) ((long) count * (i + 1) / threadCount);
+        ranges[i].subsystem = memCurrent();
+    }
+
+    for (i = 1; i < threadCount; i++) {
+        started[i] = pthread_create(&threads[i], NULL, runRange, &ranges[i]) == 0;
+    }
+
+    runRange(&ranges[0]);
+
+    for (i = 1; i < threadCount; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            runRange(&ranges[i]);
+        }
+    }
+
+    /* the caller's own failures went into the first range */
+    for (i = 0; i < threadCount; i++) {
+        memRaiseFailure(&ranges[i].failure);
+    }
+}
+
+/* Work stealing: every worker owns a range of items and takes them from the
+ * front; once it runs dry it moves the back half of another worker's range to
+ * its own. Items only ever move between ranges, so a worker that finds every
+ * range empty can stop. */
+struct stealQueue {
+    pthread_mutex_t lock;
+    int begin;
+    int end;
+};
+
+struct stealPool;
+
+struct stealWorker {
+    struct stealPool *pool;
+    int id;
+    struct memFailure failure;
+};
+
+struct stealPool {
+    struct stealQueue queues[PARALLEL_MAX_THREADS];
+    struct stealWorker workers[PARALLEL_MAX_THREADS];
+    int workerCount;
+    parallelItemTask task;
+    void *ctx;
+    enum memSubsystem subsystem;
+};
+
+static int takeItem(struct stealQueue *queue, int *index) {
+    int found;
+
+    pthread_mutex_lock(&queue->lock);
+    found = queue->begin < queue->end;
+    if (found) {
+        *index = queue->begin++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return found;
+}
+
+static int stealItems(struct stealPool *pool, int thief) {
+    struct stealQueue *victim;
+    int i, begin = 0, end = 0;
+
+    for (i = 1; i < pool->workerCount && begin == end; i++) {
+        victim = &pool->queues[(thief + i) % pool->workerCount];
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->begin < victim->end) {
+            end = victim->end;
+            begin = victim->end - (victim->end - victim->begin + 1) / 2;
+            victim->end = begin;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    if (begin == end) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->queues[thief].lock);
+    pool->queues[thief].begin = begin;
+    pool->queues[thief].end = end;
+    pthread_mutex_unlock(&pool->queues[thief].lock);
+
+    return 1;
+}
+
+static void * runWorker(void *arg) {
+    struct stealWorker *worker = arg;
+    struct stealPool *pool = worker->pool;
+    enum memSubsystem previous = memEnter(pool->subsystem);
+    int index;
+
+    do {
+        while (takeItem(&pool->queues[worker->id], &index)) {
+            pool->task(pool->ctx, worker->id, index);
+        }
+    } while (stealItems(pool, worker->id));
+
+    memTakeFailure(&worker->failure);
+    memLeave(previous);
+    return NULL;
+}
+
+/* Runs task on every index in [0, count), spread over the threads with work
+ * stealing, for items of uneven cost. The worker number passed along (the
+ * caller is worker 0) lets tasks keep per-worker scratch. */
+void parallelForEach(int count, parallelItemTask task, void *ctx) {
+    struct stealPool pool;
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int started[PARALLEL_MAX_THREADS];
+    int i, threadCount = getThreadCount();
+
+    if (threadCount > count) {
+        threadCount = count;
+    }
+
+    if (threadCount <= 1) {
+        for (i = 0; i < count; i++) {
+            task(ctx, 0, i);
+        }
+        return;
+    }
+
+    pool.workerCount = threadCount;
+    pool.task = task;
+    pool.ctx = ctx;
+    pool.subsystem = memCurrent();
+    for (i = 0; i < threadCount; i++) {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+        pool.queues[i].begin = (int) ((long) count * i / threadCount);
+        pool.queues[i].end = (int) ((long) count * (i + 1) / threadCount);
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id = i;
+        pool.workers[i].failure.kind = MEM_FAILURE_NONE;
+    }
+
+    for (i = 1; i < threadCount; i++) {
+        started[i] = pthread_create(&threads[i], NULL, runWorker, &pool.workers[i]) == 0;
+    }
+
+    /* a worker that failed to start leaves its range to be stolen */
+    runWorker(&pool.workers[0]);
+
+    for (i = 1; i < threadCount; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    for (i = 0; i < threadCount; i++) {
+        memRaiseFailure(&pool.workers[i].failure);
+        pthread_mutex_destroy(&pool.queues[i].lock);
+    }
+}
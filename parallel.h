@@ -0,0 +1,17 @@
+# ifndef PARALLEL_H_
+# define PARALLEL_H_
+
+#define PARALLEL_THREADS_ENV "SPKMEANS_THREADS"
+#define PARALLEL_MAX_THREADS 256
+
+typedef void (*parallelTask)(void *ctx, int begin, int end);
+
+typedef void (*parallelItemTask)(void *ctx, int worker, int index);
+
+int getThreadCount(void);
+
+void parallelFor(int count, parallelTask task, void *ctx);
+
+void parallelForEach(int count, parallelItemTask task, void *ctx);
+
+#endif
@@ -0,0 +1,643 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "writer.h"
+#include "cache.h"
+#include "outofcore.h"
+#include "stats.h"
+#include "dedup.h"
+#include "spkmeans.h"
+#include "server.h"
+
+/* A loaded dataset or a kept result. Entries in use by a request hold a
+ * reference; a dropped entry is freed once the last one is released. A
+ * dataset loaded from a file is named by its path and stamped with the
+ * file's identity when it was read. lastUsed orders entries for eviction. */
+struct serverEntry {
+    int id;
+    char *name;
+    struct stat stamp;
+    struct matrix *mat;
+    int *indexes;
+    int k;
+    int refs;
+    int dropped;
+    unsigned long lastUsed;
+};
+
+static struct serverEntry entries[SERVER_MAX_ENTRIES];
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static int nextId = 1;
+static unsigned long useClock = 0;
+
+/* Whether two stat() results describe the same unchanged file */
+static int sameFile(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void clearEntry(struct serverEntry *entry) {
+    memFree(entry->name);
+    freeMatrix(entry->mat);
+    memFree(entry->indexes);
+    memset(entry, 0, sizeof(struct serverEntry));
+}
+
+/* Drops entry, freeing it now unless a request still holds it. Must be
+ * called with the registry locked. */
+static void retireEntry(struct serverEntry *entry) {
+    entry->dropped = 1;
+    if (entry->refs == 0) {
+        clearEntry(entry);
+    }
+}
+
+/* The entry with that id or, when name is not NULL, the dataset read from
+ * that path. A dataset whose file no longer matches stamp is retired, as
+ * if it had never been loaded. Must be called with the registry locked. */
+static struct serverEntry * findEntry(int id, const char *name, const struct stat *stamp) {
+    int i;
+
+    for (i = 0; i < SERVER_MAX_ENTRIES; i++) {
+        if (entries[i].id == 0 || entries[i].dropped) {
+            continue;
+        }
+
+        if (name == NULL ? entries[i].id != id : entries[i].name == NULL || strcmp(entries[i].name, name) != 0) {
+            continue;
+        }
+
+        if (name != NULL && !sameFile(&entries[i].stamp, stamp)) {
+            retireEntry(&entries[i]);
+            return NULL;
+        }
+
+        return &entries[i];
+    }
+
+    return NULL;
+}
+
+/* A free slot, evicting the least recently used entry no request holds when
+ * the registry is full. Must be called with the registry locked. */
+static struct serverEntry * freeSlot(void) {
+    struct serverEntry *oldest = NULL;
+    int i;
+
+    for (i = 0; i < SERVER_MAX_ENTRIES; i++) {
+        if (entries[i].id == 0) {
+            return &entries[i];
+        }
+
+        if (entries[i].refs == 0 && (oldest == NULL || entries[i].lastUsed < oldest->lastUsed)) {
+            oldest = &entries[i];
+        }
+    }
+
+    if (oldest != NULL) {
+        clearEntry(oldest);
+    }
+
+    return oldest;
+}
+
+/* Keeps entry in the registry and returns its id. A named entry loses to one
+ * of the same file registered meanwhile, whose id is returned instead. On
+ * failure (-1) the entry is freed either way. */
+static int registerEntry(struct serverEntry *entry) {
+    struct serverEntry *slot = NULL;
+    int id = -1;
+
+    pthread_mutex_lock(&registryLock);
+    if (entry->name != NULL && (slot = findEntry(0, entry->name, &entry->stamp)) != NULL) {
+        id = slot->id;
+        slot->lastUsed = ++useClock;
+    } else if ((slot = freeSlot()) != NULL) {
+        id = nextId++;
+        *slot = *entry;
+        slot->id = id;
+        slot->lastUsed = ++useClock;
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&registryLock);
+
+    if (entry != NULL) {
+        clearEntry(entry);
+    }
+
+    return id;
+}
+
+static struct serverEntry * acquireEntry(int id, const char *name, const struct stat *stamp) {
+    struct serverEntry *entry;
+
+    pthread_mutex_lock(&registryLock);
+    entry = findEntry(id, name, stamp);
+    if (entry != NULL) {
+        entry->refs++;
+        entry->lastUsed = ++useClock;
+    }
+    pthread_mutex_unlock(&registryLock);
+
+    return entry;
+}
+
+static void releaseEntry(struct serverEntry *entry) {
+    pthread_mutex_lock(&registryLock);
+    if (--entry->refs == 0 && entry->dropped) {
+        clearEntry(entry);
+    }
+    pthread_mutex_unlock(&registryLock);
+}
+
+static int dropEntry(int id) {
+    struct serverEntry *entry;
+
+    pthread_mutex_lock(&registryLock);
+    entry = findEntry(id, NULL, NULL);
+    if (entry != NULL) {
+        retireEntry(entry);
+    }
+    pthread_mutex_unlock(&registryLock);
+
+    return entry == NULL;
+}
+
+static int readFully(int fd, void *data, size_t len) {
+    char *next = data;
+    ssize_t got;
+
+    while (len > 0) {
+        got = read(fd, next, len);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 1;
+        }
+
+        next += got;
+        len -= got;
+    }
+
+    return 0;
+}
+
+/* Without a payload only the header goes out, announcing len bytes the
+ * caller writes itself */
+static int sendFrame(int fd, uint32_t op, const void *payload, size_t len) {
+    struct serverFrame frame;
+
+    frame.op = op;
+    frame.length = len;
+    if (writeAll(fd, (const char *) &frame, sizeof(frame)) != 0) {
+        return 1;
+    }
+
+    return payload != NULL ? writeAll(fd, payload, len) : 0;
+}
+
+/* Copies rows first..last of mat into buffer without the row padding */
+static void packRows(struct matrix *mat, int first, int last, double *buffer) {
+    int i;
+
+    for (i = first; i < last; i++) {
+        memcpy(buffer + (size_t) (i - first) * mat->cols, MAT_ROW(mat, i), mat->cols * sizeof(double));
+    }
+}
+
+static struct matrix * widened(struct matrixf *matF) {
+    struct matrix *mat = matF == NULL ? NULL : matrixToDouble(matF);
+
+    freeMatrixF(matF);
+    return mat;
+}
+
+/* Runs goal on the dataset into result, the way the command line would */
+static int runGoal(struct matrix *points, int goal, int k, int flags, struct serverEntry *result) {
+    struct spkResult *clusters;
+    int useFloat = flags & SERVER_FLOAT;
+
+    switch (goal) {
+        case SERVER_WAM:
+            result->mat = useFloat ? widened(wamF(points)) : wam(points);
+            break;
+        case SERVER_DDG:
+            result->mat = useFloat ? widened(ddgF(points)) : ddg(points);
+            break;
+        case SERVER_GL:
+            result->mat = useFloat ? widened(glF(points)) : gl(points);
+            break;
+        case SERVER_JACOBI:
+            if (points->rows != points->cols) {
+                return 1;
+            }
+
+            result->mat = jacobi(points);
+            break;
+        case SERVER_SPK:
+            if (k < 0 || k > points->rows) {
+                return 1;
+            }
+
+            if (flags & SERVER_COLLAPSE) {
+                clusters = spkCollapsed(points, k);
+            } else {
+                clusters = useFloat ? spkF(points, k) : spk(points, k);
+            }
+            if (clusters == NULL) {
+                return 1;
+            }
+
+            result->mat = clusters->centroids;
+            result->indexes = clusters->indexes;
+            result->k = clusters->k;
+            clusters->centroids = NULL;
+            clusters->indexes = NULL;
+            freeSpkResult(clusters);
+            break;
+        default:
+            return 1;
+    }
+
+    return result->mat == NULL;
+}
+
+static int handleLoad(int fd, const int32_t *request, size_t len) {
+    struct serverEntry entry;
+    int32_t reply;
+    int i;
+
+    if (len < 2 * sizeof(int32_t) || request[0] < 1 || request[1] < 1 ||
+        len != 2 * sizeof(int32_t) + (size_t) request[0] * request[1] * sizeof(double)) {
+        return sendFrame(fd, 1, NULL, 0);
+    }
+
+    memset(&entry, 0, sizeof(struct serverEntry));
+    entry.mat = allocMatrix(request[0], request[1]);
+    if (entry.mat == NULL) {
+        return sendFrame(fd, 1, NULL, 0);
+    }
+
+    for (i = 0; i < entry.mat->rows; i++) {
+        memcpy(MAT_ROW(entry.mat, i), (const double *) (request + 2) + (size_t) i * entry.mat->cols,
+               entry.mat->cols * sizeof(double));
+    }
+
+    reply = registerEntry(&entry);
+    return reply < 0 ? sendFrame(fd, 1, NULL, 0) : sendFrame(fd, 0, &reply, sizeof(reply));
+}
+
+/* Loads the points file at path, or reuses the dataset already read from it
+ * while the file is unchanged. The file is stamped before it is read, so a
+ * change made during the read is picked up by the next request. */
+static int handleLoadFile(int fd, char *path) {
+    struct serverEntry entry, *loaded;
+    int32_t reply[3];
+
+    memset(&entry, 0, sizeof(struct serverEntry));
+    if (stat(path, &entry.stamp) != 0) {
+        return sendFrame(fd, 1, NULL, 0);
+    }
+
+    loaded = acquireEntry(0, path, &entry.stamp);
+    if (loaded == NULL) {
+        entry.name = memAlloc(strlen(path) + 1);
+        entry.mat = entry.name == NULL ? NULL : readPoints(path);
+        if (entry.mat == NULL) {
+            memFree(entry.name);
+            return sendFrame(fd, 1, NULL, 0);
+        }
+
+        strcpy(entry.name, path);
+        reply[0] = registerEntry(&entry);
+        loaded = reply[0] < 0 ? NULL : acquireEntry(reply[0], NULL, NULL);
+        if (loaded == NULL) {
+            return sendFrame(fd, 1, NULL, 0);
+        }
+    }
+
+    reply[0] = loaded->id;
+    reply[1] = loaded->mat->rows;
+    reply[2] = loaded->mat->cols;
+    releaseEntry(loaded);
+
+    return sendFrame(fd, 0, reply, sizeof(reply));
+}
+
+static int handleRun(int fd, const int32_t *request, size_t len) {
+    struct serverEntry result, *dataset;
+    int32_t reply[4];
+    int failed;
+
+    dataset = len == 4 * sizeof(int32_t) ? acquireEntry(request[0], NULL, NULL) : NULL;
+    if (dataset == NULL) {
+        return sendFrame(fd, 1, NULL, 0);
+    }
+
+    memset(&result, 0, sizeof(struct serverEntry));
+    failed = runGoal(dataset->mat, request[1], request[2], request[3], &result);
+    releaseEntry(dataset);
+    if (failed) {
+        clearEntry(&result);
+        return sendFrame(fd, 1, NULL, 0);
+    }
+
+    reply[1] = result.mat->rows;
+    reply[2] = result.mat->cols;
+    reply[3] = result.k;
+    reply[0] = registerEntry(&result);
+
+    return reply[0] < 0 ? sendFrame(fd, 1, NULL, 0) : sendFrame(fd, 0, reply, sizeof(reply));
+}
+
+/* Streams a kept result back a chunk of rows at a time */
+static int handleFetch(int fd, const int32_t *request, size_t len) {
+    struct serverEntry *result;
+    struct matrix *mat;
+    double *buffer;
+    int32_t *header;
+    size_t bytes;
+    int i, first, last, failed;
+
+    result = len == sizeof(int32_t) ? acquireEntry(request[0], NULL, NULL) : NULL;
+    if (result == NULL) {
+        return sendFrame(fd, 1, NULL, 0);
+    }
+
+    mat = result->mat;
+    bytes = (3 + result->k) * sizeof(int32_t) + (size_t) mat->rows * mat->cols * sizeof(double);
+    header = memAlloc((3 + result->k) * sizeof(int32_t));
+    buffer = memAlloc((size_t) SERVER_CHUNK_ROWS * mat->cols * sizeof(double));
+    if (bytes > SERVER_MAX_FRAME || header == NULL || buffer == NULL) {
+        memFree(header);
+        memFree(buffer);
+        releaseEntry(result);
+        return sendFrame(fd, 1, NULL, 0);
+    }
+
+    header[0] = result->k;
+    header[1] = mat->rows;
+    header[2] = mat->cols;
+    for (i = 0; i < result->k; i++) {
+        header[3 + i] = result->indexes[i];
+    }
+
+    failed = sendFrame(fd, 0, NULL, bytes) || writeAll(fd, (const char *) header, (3 + result->k) * sizeof(int32_t));
+    for (first = 0; !failed && first < mat->rows; first = last) {
+        last = first + SERVER_CHUNK_ROWS < mat->rows ? first + SERVER_CHUNK_ROWS : mat->rows;
+        packRows(mat, first, last, buffer);
+        failed = writeAll(fd, (const char *) buffer, (size_t) (last - first) * mat->cols * sizeof(double));
+    }
+
+    memFree(header);
+    memFree(buffer);
+    releaseEntry(result);
+
+    return failed;
+}
+
+/* Answers one request. Bad requests get an error reply; only a broken
+ * connection returns non-zero. */
+static int handleRequest(int fd, uint32_t op, char *payload, size_t len) {
+    switch (op) {
+        case SERVER_LOAD:
+            return handleLoad(fd, (const int32_t *) payload, len);
+        case SERVER_LOAD_FILE:
+            return handleLoadFile(fd, payload);
+        case SERVER_RUN:
+            return handleRun(fd, (const int32_t *) payload, len);
+        case SERVER_FETCH:
+            return handleFetch(fd, (const int32_t *) payload, len);
+        case SERVER_DROP:
+            return len == sizeof(int32_t) && dropEntry(*(const int32_t *) payload) == 0 ?
+                   sendFrame(fd, 0, NULL, 0) : sendFrame(fd, 1, NULL, 0);
+        default:
+            return sendFrame(fd, 1, NULL, 0);
+    }
+}
+
+static void serveConnection(int fd) {
+    struct serverFrame frame;
+    char *payload;
+    int failed = 0;
+
+    while (!failed && readFully(fd, &frame, sizeof(frame)) == 0 && frame.length <= SERVER_MAX_FRAME) {
+        /* 8 byte aligned for the doubles of LOAD, NUL terminated for paths */
+        payload = memAlloc(frame.length + sizeof(double));
+        if (payload == NULL || readFully(fd, payload, frame.length) != 0) {
+            memFree(payload);
+            break;
+        }
+
+        payload[frame.length] = '\0';
+        failed = handleRequest(fd, frame.op, payload, frame.length);
+        memFree(payload);
+    }
+
+    close(fd);
+}
+
+/* One of the resident workers: takes connections off the shared listening
+ * socket and serves each until the client hangs up */
+static void * serverWorker(void *arg) {
+    int listener = *(int *) arg, fd;
+
+    /* requests run side by side, so none of them owns spkStats */
+    statsMuted = 1;
+    for (;;) {
+        fd = accept(listener, NULL, NULL);
+        if (fd >= 0) {
+            serveConnection(fd);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static int socketAddress(const char *socketPath, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address->sun_path)) {
+        return 1;
+    }
+
+    strcpy(address->sun_path, socketPath);
+    return 0;
+}
+
+/* Serves requests on a Unix domain socket at socketPath with SERVER_WORKERS
+ * resident workers, replacing a stale socket file left there. Only returns
+ * when the socket cannot be set up or accept() fails for good. */
+int serve(const char *socketPath) {
+    struct sockaddr_un address;
+    pthread_t threads[SERVER_WORKERS];
+    int listener, i, started = 0;
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || socketAddress(socketPath, &address) != 0) {
+        printErrorMessage();
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 1;
+    }
+
+    unlink(socketPath);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        printErrorMessage();
+        close(listener);
+        return 1;
+    }
+
+    /* a client hanging up mid reply must not take the server down */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* settle the lazily read configuration before the workers look at it */
+    cacheEnabled();
+    outOfCoreEnabled();
+
+    for (i = 1; i < SERVER_WORKERS; i++) {
+        started += pthread_create(&threads[i], NULL, serverWorker, &listener) == 0;
+    }
+    serverWorker(&listener);
+
+    for (i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    close(listener);
+    unlink(socketPath);
+    printErrorMessage();
+    return 1;
+}
+
+/* Sends one request and reads a reply of exactly replyLen bytes */
+static int request(int fd, uint32_t op, const void *payload, size_t len, void *reply, size_t replyLen) {
+    struct serverFrame frame;
+
+    if (sendFrame(fd, op, payload, len) != 0 || readFully(fd, &frame, sizeof(frame)) != 0 ||
+        frame.op != 0 || frame.length != replyLen) {
+        return 1;
+    }
+
+    return replyLen > 0 ? readFully(fd, reply, replyLen) : 0;
+}
+
+/* Reads a FETCH reply into a matrix and its k indexes */
+static struct matrix * fetchResult(int fd, int32_t id, int **indexes, int *k) {
+    struct serverFrame frame;
+    struct matrix *mat;
+    int32_t header[3];
+    int32_t *received;
+    int i;
+
+    if (sendFrame(fd, SERVER_FETCH, &id, sizeof(id)) != 0 || readFully(fd, &frame, sizeof(frame)) != 0 ||
+        frame.op != 0 || readFully(fd, header, sizeof(header)) != 0) {
+        return NULL;
+    }
+
+    *k = header[0];
+    *indexes = memAlloc((header[0] > 0 ? header[0] : 1) * sizeof(int));
+    received = memAlloc((header[0] > 0 ? header[0] : 1) * sizeof(int32_t));
+    mat = allocMatrix(header[1], header[2]);
+    if (*indexes == NULL || received == NULL || mat == NULL ||
+        readFully(fd, received, header[0] * sizeof(int32_t)) != 0) {
+        memFree(*indexes);
+        memFree(received);
+        freeMatrix(mat);
+        return NULL;
+    }
+
+    for (i = 0; i < header[0]; i++) {
+        (*indexes)[i] = received[i];
+    }
+    memFree(received);
+
+    for (i = 0; i < mat->rows; i++) {
+        if (readFully(fd, MAT_ROW(mat, i), mat->cols * sizeof(double)) != 0) {
+            memFree(*indexes);
+            freeMatrix(mat);
+            return NULL;
+        }
+    }
+
+    return mat;
+}
+
+static int goalCode(const char *goal) {
+    const char *goals[] = {"wam", "ddg", "gl", "jacobi", "spk"};
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        if (strcmp(goal, goals[i]) == 0) {
+            return SERVER_WAM + i;
+        }
+    }
+
+    return 0;
+}
+
+/* The command line client: has the server at socketPath load fileName (once,
+ * the server keeps it) and run goal on it, then prints the result exactly as
+ * a local run would. */
+int runRemote(const char *socketPath, const char *goal, const char *fileName, int k, int flags) {
+    struct sockaddr_un address;
+    struct matrix *mat = NULL;
+    char *path;
+    int32_t loaded[3], run[4], ran[4];
+    int *indexes = NULL, count = 0, fd, failed;
+
+    path = realpath(fileName, NULL);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    failed = path == NULL || fd < 0 || goalCode(goal) == 0 || socketAddress(socketPath, &address) != 0 ||
+             connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+             request(fd, SERVER_LOAD_FILE, path, strlen(path), loaded, sizeof(loaded)) != 0;
+
+    if (!failed) {
+        run[0] = loaded[0];
+        run[1] = goalCode(goal);
+        run[2] = k;
+        run[3] = flags;
+        failed = request(fd, SERVER_RUN, run, sizeof(run), ran, sizeof(ran)) != 0;
+    }
+
+    if (!failed) {
+        mat = fetchResult(fd, ran[0], &indexes, &count);
+        failed = mat == NULL || request(fd, SERVER_DROP, ran, sizeof(int32_t), NULL, 0) != 0;
+    }
+
+    free(path);
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (failed) {
+        printErrorMessage();
+        memFree(indexes);
+        freeMatrix(mat);
+        return 1;
+    }
+
+    if (run[1] == SERVER_SPK) {
+        printIndexes(indexes, count);
+    }
+    printMat(mat);
+
+    memFree(indexes);
+    freeMatrix(mat);
+    return 0;
+}
@@ -0,0 +1,55 @@
+# ifndef SERVER_H_
+# define SERVER_H_
+
+#include <stdint.h>
+
+#define SERVER_WORKERS 4
+#define SERVER_MAX_ENTRIES 256
+#define SERVER_CHUNK_ROWS 256
+#define SERVER_MAX_FRAME (1024 * 1024 * 1024)
+
+/* Requests and replies are a serverFrame followed by length payload bytes,
+ * everything in host byte order since both ends share the machine. A reply's
+ * op is its status, 0 on success. Payloads, all made of int32 and doubles:
+ *
+ *   LOAD       rows, cols, rows * cols doubles      -> id
+ *   LOAD_FILE  path of a points file                -> id, rows, cols
+ *   RUN        dataset id, goal, k, flags           -> id, rows, cols, k
+ *   FETCH      result id                            -> k, rows, cols, k indexes, rows * cols doubles
+ *   DROP       dataset or result id                 -> nothing
+ *
+ * LOAD_FILE of a path already in the registry returns the loaded dataset
+ * while the file's device, inode, size and mtime are unchanged, and reads it
+ * again otherwise. RUN keeps its result in the registry until it is dropped;
+ * FETCH streams it back SERVER_CHUNK_ROWS rows at a time. k is 0 for goals
+ * other than spk. Once SERVER_MAX_ENTRIES entries are kept, registering one
+ * more evicts the least recently used entry no request is holding. */
+enum serverOp {
+    SERVER_LOAD = 1,
+    SERVER_LOAD_FILE,
+    SERVER_RUN,
+    SERVER_FETCH,
+    SERVER_DROP
+};
+
+enum serverGoal {
+    SERVER_WAM = 1,
+    SERVER_DDG,
+    SERVER_GL,
+    SERVER_JACOBI,
+    SERVER_SPK
+};
+
+#define SERVER_FLOAT 1
+#define SERVER_COLLAPSE 2
+
+struct serverFrame {
+    uint32_t op;
+    uint32_t length;
+};
+
+int serve(const char *socketPath);
+
+int runRemote(const char *socketPath, const char *goal, const char *fileName, int k, int flags);
+
+#endif
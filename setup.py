@@ -1,6 +1,7 @@
 from setuptools import Extension, setup
 
-module = Extension("mykmeanssp", sources=["spkmeansmodule.c", "spkmeans.c", "kmeans.c", "utils.c"])
+module = Extension("mykmeanssp", sources=["spkmeansmodule.c", "spkmeans.c", "nystrom.c", "dedup.c", "shard.c", "coreset.c", "model.c", "batch.c", "kmeans.c", "distance.c", "mt19937.c", "writer.c", "cache.c", "outofcore.c", "operator.c", "subspace.c", "stats.c", "parallel.c", "matrix.c", "alloc.c", "utils.c"],
+                   define_macros=[("SPKMEANS_NO_MAIN", None), ("SPKMEANS_STATS", None)])
 setup(
     name="mykmeanssp",
     version="1.0.0",
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "kmeans.h"
+#include "stats.h"
+#include "shard.h"
+
+static int configured = 0;
+static int shardsWanted = 1;
+
+/* Shards k-means over that many worker processes from now on; 1 or less
+ * keeps it in process. Unless called first, SPKMEANS_SHARDS is read. */
+void setShards(int shards) {
+    configured = 1;
+    shardsWanted = shards < 1 ? 1 : shards > SHARD_MAX ? SHARD_MAX : shards;
+}
+
+int shardCount(void) {
+    if (!configured) {
+        setShards(getenv(SHARDS_ENV) == NULL ? 1 : atoi(getenv(SHARDS_ENV)));
+    }
+
+    return shardsWanted;
+}
+
+/* One shard's part of a Lloyd iteration: relabels its rows and sums them per
+ * cluster into sums and counts, which are cleared first */
+void shardAssign(struct matrix *shard, const double *weights, struct matrix *centroids, int *labels,
+                 struct matrix *sums, double *counts, long *changed) {
+    *changed = updateClusters(centroids, shard, labels);
+
+    memset(sums->data, 0, sums->bytes);
+    memset(counts, 0, centroids->rows * sizeof(double));
+    accumulateClusters(sums, counts, shard, weights, labels);
+}
+
+/* Synchronization at the start of the shared segment. Each shard has its
+ * own go semaphore so a fast worker cannot take another's turn. */
+struct shardSync {
+    sem_t done;
+    sem_t go[SHARD_MAX];
+    int command;
+};
+
+/* The coordinator's view of the segment; workers inherit a copy when they
+ * are forked. Everything is laid out densely, rows of d doubles. */
+struct sharedMemoryState {
+    void *base;
+    size_t bytes;
+    struct shardSync *sync;
+    int n;
+    int d;
+    int k;
+    double *centroids;
+    double *sums;
+    double *counts;
+    long *changed;
+    double *points;
+    double *weights;
+    int *labels;
+    int first[SHARD_MAX + 1];
+    pid_t workers[SHARD_MAX];
+    pid_t coordinator;
+    int started;
+};
+
+static size_t alignedSize(size_t bytes) {
+    return (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static struct matrix denseView(double *data, int rows, int cols) {
+    struct matrix view;
+
+    memset(&view, 0, sizeof(struct matrix));
+    view.data = data;
+    view.rows = rows;
+    view.cols = cols;
+    view.stride = cols;
+    view.bytes = (size_t) rows * cols * sizeof(double);
+    return view;
+}
+
+/* The CLOCK_REALTIME time SHARD_WAIT_MS from now, as sem_timedwait() takes */
+static void waitDeadline(struct timespec *deadline) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_nsec += SHARD_WAIT_MS * 1000000L;
+    deadline->tv_sec += deadline->tv_nsec / 1000000000L;
+    deadline->tv_nsec %= 1000000000L;
+}
+
+/* Waits for the worker's next command, leaving when the coordinator is gone
+ * (the worker is then reparented) instead of waiting for it forever */
+static void waitForCommand(struct sharedMemoryState *state, int shard) {
+    struct timespec deadline;
+
+    for (;;) {
+        waitDeadline(&deadline);
+        if (sem_timedwait(&state->sync->go[shard], &deadline) == 0) {
+            return;
+        }
+
+        if (errno == ETIMEDOUT && getppid() != state->coordinator) {
+            _exit(1);
+        }
+    }
+}
+
+/* The loop of a forked worker; it leaves with _exit() so nothing inherited
+ * from the coordinator is flushed or freed twice */
+static void runShardWorker(struct sharedMemoryState *state, int shard) {
+    int first = state->first[shard], rows = state->first[shard + 1] - first;
+    struct matrix points = denseView(state->points + (size_t) first * state->d, rows, state->d);
+    struct matrix centroids = denseView(state->centroids, state->k, state->d);
+    struct matrix sums = denseView(state->sums + (size_t) shard * state->k * state->d, state->k, state->d);
+    const double *weights = state->weights == NULL ? NULL : state->weights + first;
+    int *labels = state->labels + first;
+
+    for (;;) {
+        waitForCommand(state, shard);
+        if (state->sync->command == SHARD_EXIT) {
+            _exit(0);
+        }
+
+        if (state->sync->command == SHARD_ASSIGN) {
+            shardAssign(&points, weights, &centroids, labels, &sums, state->counts + (size_t) shard * state->k,
+                        &state->changed[shard]);
+        } else {
+            updateClusters(&centroids, &points, labels);
+        }
+
+        sem_post(&state->sync->done);
+    }
+}
+
+/* Whether a worker has exited. waitpid() fails with ECHILD when SIGCHLD is
+ * ignored or the worker was already reaped, the kernel is then asked
+ * whether the process still exists. */
+static int workerDied(struct sharedMemoryState *state, int shards) {
+    pid_t reaped;
+    int i, status;
+
+    for (i = 0; i < shards; i++) {
+        reaped = waitpid(state->workers[i], &status, WNOHANG);
+        if (reaped > 0) {
+            return 1;
+        }
+
+        if (reaped < 0 && errno == ECHILD && kill(state->workers[i], 0) != 0 && errno == ESRCH) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Waits for every shard to finish the round, giving up when a worker is gone
+ * instead of waiting for it forever */
+static int sharedMemoryRound(struct shardTransport *transport, enum shardCommand command, struct matrix *centroids) {
+    struct sharedMemoryState *state = transport->state;
+    struct timespec deadline;
+    int i, finished = 0;
+
+    for (i = 0; i < state->k; i++) {
+        memcpy(state->centroids + (size_t) i * state->d, MAT_ROW(centroids, i), state->d * sizeof(double));
+    }
+
+    state->sync->command = command;
+    for (i = 0; i < transport->shards; i++) {
+        sem_post(&state->sync->go[i]);
+    }
+
+    while (finished < transport->shards) {
+        waitDeadline(&deadline);
+        if (sem_timedwait(&state->sync->done, &deadline) == 0) {
+            finished++;
+        } else if (errno == ETIMEDOUT && workerDied(state, transport->shards)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int sharedMemoryCollect(struct shardTransport *transport, int shard, struct matrix *sums, double *counts,
+                               long *changed) {
+    struct sharedMemoryState *state = transport->state;
+    const double *partial = state->sums + (size_t) shard * state->k * state->d;
+    const double *partialCounts = state->counts + (size_t) shard * state->k;
+    int i, j;
+
+    for (i = 0; i < state->k; i++) {
+        for (j = 0; j < state->d; j++) {
+            MAT(sums, i, j) += partial[(size_t) i * state->d + j];
+        }
+
+        counts[i] += partialCounts[i];
+    }
+
+    *changed = state->changed[shard];
+    return 0;
+}
+
+static int sharedMemoryCollectLabels(struct shardTransport *transport, int *labels) {
+    struct sharedMemoryState *state = transport->state;
+
+    memcpy(labels, state->labels, state->n * sizeof(int));
+    return 0;
+}
+
+static void sharedMemoryClose(struct shardTransport *transport) {
+    struct sharedMemoryState *state = transport->state;
+    int i;
+
+    state->sync->command = SHARD_EXIT;
+    for (i = 0; i < state->started; i++) {
+        sem_post(&state->sync->go[i]);
+    }
+
+    for (i = 0; i < state->started; i++) {
+        waitpid(state->workers[i], NULL, 0);
+    }
+
+    munmap(state->base, state->bytes);
+    memFree(state);
+    memFree(transport);
+}
+
+/* Maps an unlinked POSIX shared memory object of bytes bytes */
+static void * mapSharedMemory(size_t bytes) {
+    static int counter = 0;
+    char name[64];
+    void *base;
+    int fd;
+
+    sprintf(name, "/spkmeans-%ld-%d", (long) getpid(), counter++);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    shm_unlink(name);
+    if (ftruncate(fd, bytes) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    return base == MAP_FAILED ? NULL : base;
+}
+
+/* Copies the rows of points (and their weights, when not NULL) into shared
+ * memory and forks one worker per shard, each owning a contiguous block of
+ * rows. Returns NULL when the segment or the workers cannot be set up. */
+struct shardTransport * openSharedMemoryTransport(struct matrix *points, const double *weights, int k, int shards) {
+    struct shardTransport *transport;
+    struct sharedMemoryState *state;
+    size_t offsets[8];
+    char *base;
+    int i, n = points->rows, d = points->cols;
+
+    shards = shards > n ? n : shards;
+    transport = memCalloc(1, sizeof(struct shardTransport));
+    state = memCalloc(1, sizeof(struct sharedMemoryState));
+    if (transport == NULL || state == NULL || shards < 1) {
+        memFree(transport);
+        memFree(state);
+        return NULL;
+    }
+
+    offsets[0] = alignedSize(sizeof(struct shardSync));
+    offsets[1] = offsets[0] + alignedSize((size_t) k * d * sizeof(double));
+    offsets[2] = offsets[1] + alignedSize((size_t) shards * k * d * sizeof(double));
+    offsets[3] = offsets[2] + alignedSize((size_t) shards * k * sizeof(double));
+    offsets[4] = offsets[3] + alignedSize(shards * sizeof(long));
+    offsets[5] = offsets[4] + alignedSize((size_t) n * d * sizeof(double));
+    offsets[6] = offsets[5] + (weights == NULL ? 0 : alignedSize(n * sizeof(double)));
+    offsets[7] = offsets[6] + alignedSize(n * sizeof(int));
+
+    state->bytes = offsets[7];
+    state->base = mapSharedMemory(state->bytes);
+    if (state->base == NULL) {
+        memFree(transport);
+        memFree(state);
+        return NULL;
+    }
+
+    base = state->base;
+    state->sync = state->base;
+    state->n = n;
+    state->d = d;
+    state->k = k;
+    state->centroids = (double *) (base + offsets[0]);
+    state->sums = (double *) (base + offsets[1]);
+    state->counts = (double *) (base + offsets[2]);
+    state->changed = (long *) (base + offsets[3]);
+    state->points = (double *) (base + offsets[4]);
+    state->weights = weights == NULL ? NULL : (double *) (base + offsets[5]);
+    state->labels = (int *) (base + offsets[6]);
+
+    sem_init(&state->sync->done, 1, 0);
+    for (i = 0; i < shards; i++) {
+        sem_init(&state->sync->go[i], 1, 0);
+    }
+
+    for (i = 0; i < n; i++) {
+        memcpy(state->points + (size_t) i * d, MAT_ROW(points, i), d * sizeof(double));
+    }
+    if (weights != NULL) {
+        memcpy(state->weights, weights, n * sizeof(double));
+    }
+    memset(state->labels, -1, n * sizeof(int));
+
+    for (i = 0; i <= shards; i++) {
+        state->first[i] = (int) ((long) n * i / shards);
+    }
+
+    transport->shards = shards;
+    transport->state = state;
+    transport->round = sharedMemoryRound;
+    transport->collect = sharedMemoryCollect;
+    transport->collectLabels = sharedMemoryCollectLabels;
+    transport->close = sharedMemoryClose;
+
+    /* the workers must not inherit half written output */
+    fflush(stdout);
+    fflush(stderr);
+    state->coordinator = getpid();
+    for (i = 0; i < shards; i++) {
+        state->workers[i] = fork();
+        if (state->workers[i] == 0) {
+            runShardWorker(state, i);
+        }
+        if (state->workers[i] < 0) {
+            break;
+        }
+        state->started++;
+    }
+
+    if (state->started < shards) {
+        sharedMemoryClose(transport);
+        return NULL;
+    }
+
+    return transport;
+}
+
+/* kmeans() with the assignment and the per-cluster sums done by the shards
+ * of transport. The coordinator reduces the shards' sums in shard order and
+ * moves the centroids, under the same convergence rule as kmeans(); results
+ * match it up to the order the sums are added in. Returns 0 on success. */
+int shardedKmeans(int maxIter, double epsilon, struct shardTransport *transport, struct matrix *centroids,
+                  int *labels) {
+    enum memSubsystem previous = memEnter(MEM_KMEANS);
+    struct matrix *sums;
+    double *counts;
+    double maxDelta = epsilon + 1;
+    long changed, shardChanged;
+    int i, iterCount = 0, failed = 0;
+
+    sums = allocMatrix(centroids->rows, centroids->cols);
+    counts = memAlloc(centroids->rows * sizeof(double));
+    if (sums == NULL || counts == NULL) {
+        printErrorMessage();
+        freeMatrix(sums);
+        memFree(counts);
+        memLeave(previous);
+        return 1;
+    }
+
+    STATS_BEGIN(STATS_KMEANS);
+    while (!failed && kmeansContinues(iterCount, maxIter, maxDelta, epsilon)) {
+        failed = transport->round(transport, SHARD_ASSIGN, centroids);
+        if (failed) {
+            break;
+        }
+
+        memset(sums->data, 0, sums->bytes);
+        memset(counts, 0, centroids->rows * sizeof(double));
+
+        for (i = 0, changed = 0; !failed && i < transport->shards; i++) {
+            failed = transport->collect(transport, i, sums, counts, &shardChanged);
+            changed += shardChanged;
+        }
+
+        STATS_KMEANS_ITERATION(changed);
+        maxDelta = moveCentroids(centroids, sums, counts);
+        iterCount++;
+    }
+
+    failed = failed || transport->round(transport, SHARD_LABEL, centroids) ||
+             (labels != NULL && transport->collectLabels(transport, labels));
+    STATS_END(STATS_KMEANS);
+
+    freeMatrix(sums);
+    memFree(counts);
+    memLeave(previous);
+    if (failed) {
+        printErrorMessage();
+    }
+
+    return failed;
+}
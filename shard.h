@@ -0,0 +1,45 @@
+# ifndef SHARD_H_
+# define SHARD_H_
+
+#include "matrix.h"
+
+#define SHARDS_ENV "SPKMEANS_SHARDS"
+#define SHARD_MAX 64
+#define SHARD_WAIT_MS 100
+
+enum shardCommand {
+    SHARD_ASSIGN,
+    SHARD_LABEL,
+    SHARD_EXIT
+};
+
+/* How the coordinator of sharded k-means drives its shard workers. round()
+ * hands every shard the centroids and a command and returns once all of
+ * them are done: SHARD_ASSIGN has each shard relabel its rows and sum them
+ * per cluster, which collect() adds into the caller's sums and counts;
+ * SHARD_LABEL only relabels, read back with collectLabels(). Shared memory
+ * between local processes is the one transport so far; a network one would
+ * fill in the same calls. */
+struct shardTransport {
+    int shards;
+    void *state;
+    int (*round)(struct shardTransport *transport, enum shardCommand command, struct matrix *centroids);
+    int (*collect)(struct shardTransport *transport, int shard, struct matrix *sums, double *counts,
+                   long *changed);
+    int (*collectLabels)(struct shardTransport *transport, int *labels);
+    void (*close)(struct shardTransport *transport);
+};
+
+void setShards(int shards);
+
+int shardCount(void);
+
+void shardAssign(struct matrix *shard, const double *weights, struct matrix *centroids, int *labels,
+                 struct matrix *sums, double *counts, long *changed);
+
+struct shardTransport * openSharedMemoryTransport(struct matrix *points, const double *weights, int k, int shards);
+
+int shardedKmeans(int maxIter, double epsilon, struct shardTransport *transport, struct matrix *centroids,
+                  int *labels);
+
+#endif
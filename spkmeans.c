@@ -3,8 +3,26 @@
 #include <math.h>
 #include <string.h>
 #include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "kmeans.h"
+#include "distance.h"
+#include "writer.h"
+#include "cache.h"
+#include "stats.h"
+#include "outofcore.h"
+#include "nystrom.h"
+#include "subspace.h"
+#include "dedup.h"
+#include "shard.h"
+#include "coreset.h"
+#include "server.h"
+#include "spkmeans.h"
 
 #define MAX_ITER 100
+#define JACOBI_SWEEPS 50
+#define JACOBI_TOLERANCE 1e-24
 
 struct vector *extractVectors(char* file_name) {
     struct vector *headVec, *currVec, *prevVec = NULL;
@@ -14,8 +32,11 @@ struct vector *extractVectors(char* file_name) {
     char c;
 
     fp = fopen(file_name, "r+");
+    if (fp == NULL) {
+        return NULL;
+    }
 
-    headCord = malloc(sizeof(struct cord));
+    headCord = memAlloc(sizeof(struct cord));
     if (headCord == NULL) {
         printErrorMessage();
         return NULL;
@@ -24,10 +45,10 @@ struct vector *extractVectors(char* file_name) {
     currCord = headCord;
     currCord->next = NULL;
 
-    headVec = malloc(sizeof(struct vector));
+    headVec = memAlloc(sizeof(struct vector));
     if (headVec == NULL) {
         printErrorMessage();
-        free(headCord);
+        memFree(headCord);
         return NULL;
     }
 
@@ -41,7 +62,7 @@ struct vector *extractVectors(char* file_name) {
         {
             currCord->value = n;
             currVec->cords = headCord;
-            currVec->next = malloc(sizeof(struct vector));
+            currVec->next = memAlloc(sizeof(struct vector));
             if (currVec->next == NULL) {
                 printErrorMessage();
                 freeVectorsList(headVec);
@@ -52,7 +73,7 @@ struct vector *extractVectors(char* file_name) {
             currVec = currVec->next;
             currVec->next = NULL;
             currVec->cords = NULL;
-            headCord = malloc(sizeof(struct cord));
+            headCord = memAlloc(sizeof(struct cord));
             if (headCord== NULL) {
                 printErrorMessage();
                 freeVectorsList(headVec);
@@ -65,7 +86,7 @@ struct vector *extractVectors(char* file_name) {
         }
 
         currCord->value = n;
-        currCord->next = malloc(sizeof(struct cord));
+        currCord->next = memAlloc(sizeof(struct cord));
         if (currCord->next == NULL) {
             printErrorMessage();
             freeVectorsList(headVec);
@@ -77,9 +98,13 @@ struct vector *extractVectors(char* file_name) {
         currCord->value = 0.0;
     }
 
-    free(currCord);
+    memFree(currCord);
     freeVectorsList(currVec);
     fclose(fp);
+    if (prevVec == NULL) {
+        return NULL;
+    }
+
     prevVec->next = NULL;
     return headVec;
 }
@@ -97,70 +122,154 @@ int extractVectorAmount(struct vector* vec) {
     return ++count;
 }
 
-void printMat(double ** mat, int m, int n){
-    int i,j;
-    char sep;
+int extractVectorLength(struct vector* vec) {
+    int count = 0;
+    struct cord *currCord;
 
-    for(i=0; i<m; i++) {
-        for(j=0; j<n; j++) {
-            sep = j == n-1 ? '\n' : ',';
-            printf("%.4f%c", mat[i][j], sep);
-        }
-        
+    currCord = vec->cords;
+    while (currCord != NULL) {
+        count++;
+        currCord = currCord->next;
     }
+
+    return count;
 }
 
-void freeMat(double ** mat, int m) {
-    int i;
-    for(i=0; i<m; i++) {
-       free(mat[i]);
+void printMat(struct matrix * mat){
+    /* anything already printed through stdio has to land before the matrix */
+    fflush(stdout);
+
+    if (writeMatrix(WRITER_STDOUT, mat) != 0) {
+        printErrorMessage();
     }
-    free(mat);
 }
 
-double calcWeightBetweenPoints(struct cord *p1, struct cord *p2) {
-    double sum = 0.0;
-    struct cord *currCord1 = p1;
-    struct cord *currCord2 = p2;
+void printMatF(struct matrixf * mat){
+    fflush(stdout);
 
-    while (currCord1 != NULL) {
-        sum += pow(currCord1->value - currCord2->value, 2);
-        currCord1 = currCord1->next;
-        currCord2 = currCord2->next;
+    if (writeMatrixF(WRITER_STDOUT, mat) != 0) {
+        printErrorMessage();
     }
+}
 
-    return exp(-sum/2);
+/* Prints a 1 x n vector one value per line */
+void printColumn(struct matrix * vec){
+    fflush(stdout);
+
+    if (writeColumn(WRITER_STDOUT, vec) != 0) {
+        printErrorMessage();
+    }
 }
 
-double ** wam(struct vector * headVec, int vectorsAmount) {
-    double ** wMat;
+struct matrix * vectorsToMatrix(struct vector * headVec, int rows, int cols) {
+    struct matrix * mat;
     int i,j;
-    struct vector *curr1, *curr2;
+    struct vector *currVec;
+    struct cord *currCord;
 
-    wMat = malloc(vectorsAmount * sizeof(double*));
-    if (wMat == NULL) {
+    mat = allocMatrix(rows, cols);
+    if (mat == NULL) {
+        return NULL;
+    }
+
+    currVec = headVec;
+
+    for (i=0; i < rows; i++) {
+        currCord = currVec->cords;
+
+        for (j=0; j < cols; j++) {
+            MAT(mat, i, j) = currCord->value;
+            currCord = currCord->next;
+        }
+
+        currVec = currVec->next;
+    }
+
+    return mat;
+
+}
+
+/* Parses a points file, charging the parse to MEM_PARSE */
+struct matrix * readPoints(char * fileName) {
+    struct vector *headVector;
+    struct matrix *points;
+    enum memSubsystem previous = memEnter(MEM_PARSE);
+
+    headVector = extractVectors(fileName);
+    if (headVector == NULL) {
+        memLeave(previous);
         printErrorMessage();
         return NULL;
     }
 
-    curr1 = headVec;
+    points = vectorsToMatrix(headVector, extractVectorAmount(headVector), extractVectorLength(headVector));
+    freeVectorsList(headVector);
+    memLeave(previous);
 
-    for (i=0; i < vectorsAmount; i++) {
-        wMat[i] = malloc(vectorsAmount * sizeof(double));
-        if (wMat[i] == NULL) {
-            printErrorMessage();
-            return NULL;
+    return points;
+}
+
+double calcWeightBetweenPoints(const double *p1, const double *p2, int d) {
+    return exp(-squaredDistance(p1, p2, d)/2);
+}
+
+static struct matrix * inCoreAffinity(struct matrix * points) {
+    struct matrix * wMat;
+    distanceKernel distance = squaredDistanceKernel(points->cols);
+    int i,j;
+    int n = points->rows;
+    double weight;
+
+    wMat = allocMatrix(n, n);
+    if (wMat == NULL) {
+        return NULL;
+    }
+
+    /* W is symmetric, so every pair is evaluated once and mirrored */
+    for (i=0; i < n; i++) {
+        MAT(wMat, i, i) = 0;
+
+        for (j = i + 1; j < n; j++) {
+            weight = exp(-distance(MAT_ROW(points, i), MAT_ROW(points, j), points->cols)/2);
+            MAT(wMat, i, j) = weight;
+            MAT(wMat, j, i) = weight;
         }
-        
-        curr2 = headVec;
-        for (j = 0; j < vectorsAmount; j++) {
-            wMat[i][j] = i == j ? 0 : calcWeightBetweenPoints(curr1->cords, curr2->cords);
-            curr2 = curr2->next;
+    }
+
+    STATS_ADD(kernelEvaluations, (long) n * (n - 1) / 2);
+    return wMat;
+}
+
+/* W is computed in memory, or tiled into a scratch file in out-of-core mode */
+struct matrix * wam(struct matrix * points) {
+    struct matrix * wMat;
+    uint64_t key = 0;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    if (cacheEnabled()) {
+        key = hashMatrix(points);
+        wMat = cacheLoad(key, "wam", points->rows, points->rows);
+        if (wMat != NULL) {
+            memLeave(previous);
+            return wMat;
         }
+    }
+
+    STATS_BEGIN(STATS_WAM);
+    wMat = outOfCoreEnabled() ? tiledAffinity(points, 0) : inCoreAffinity(points);
+    if (wMat == NULL) {
+        STATS_END(STATS_WAM);
+        memLeave(previous);
+        return NULL;
+    }
+
+    STATS_END(STATS_WAM);
 
-        curr1 = curr1->next;
+    if (cacheEnabled()) {
+        cacheStore(key, "wam", wMat);
     }
 
+    memLeave(previous);
     return wMat;
 }
 
@@ -175,78 +284,201 @@ double arraySum(double * arr, int len) {
     return result;
 }
 
-double ** ddg(struct vector * headVec, int vectorsAmount){
-    double ** wMat, ** dMat;
-    double rowSum;
-    int i, j;
+/* The degree of every point as a 1 x n matrix. The row sums of W are taken
+ * block by block as its entries are computed, so W is never stored and only
+ * O(n) memory is used; the sums match those of wam() bit for bit. */
+struct matrix * degrees(struct matrix * points) {
+    struct matrix * degreeVec;
+    uint64_t key = 0;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    if (cacheEnabled()) {
+        key = hashMatrix(points);
+        degreeVec = cacheLoad(key, "ddg", 1, points->rows);
+        if (degreeVec != NULL) {
+            memLeave(previous);
+            return degreeVec;
+        }
+    }
+
+    degreeVec = streamedDegrees(points);
+    if (degreeVec == NULL) {
+        memLeave(previous);
+        return NULL;
+    }
 
-    wMat = wam(headVec, vectorsAmount);
+    if (cacheEnabled()) {
+        cacheStore(key, "ddg", degreeVec);
+    }
+
+    memLeave(previous);
+    return degreeVec;
+}
+
+struct matrix * ddg(struct matrix * points){
+    struct matrix * degreeVec, * dMat;
+    int i, n = points->rows;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    STATS_BEGIN(STATS_DDG);
+    degreeVec = degrees(points);
+    if (degreeVec == NULL) {
+        dMat = NULL;
+    } else if (outOfCoreEnabled()) {
+        dMat = allocScratchMatrix(scratchDir(), n, n);
+    } else {
+        dMat = allocZeroMatrix(n, n);
+    }
 
-    dMat = malloc(vectorsAmount * sizeof(double*));
     if (dMat == NULL) {
-        printErrorMessage();
+        freeMatrix(degreeVec);
+        STATS_END(STATS_DDG);
+        memLeave(previous);
         return NULL;
     }
 
-    for (i=0; i < vectorsAmount; i++) {
-        dMat[i] = malloc(vectorsAmount * sizeof(double));
-        rowSum = arraySum(wMat[i], vectorsAmount);
-        if (dMat[i] == NULL) {
-            printErrorMessage();
-            return NULL;
-        }
-        
-        for (j = 0; j < vectorsAmount; j++) {
-            dMat[i][j] = i == j ? rowSum : 0;
+    for (i=0; i < n; i++) {
+        MAT(dMat, i, i) = MAT(degreeVec, 0, i);
+        if ((i + 1) % TILE_ROWS == 0 || i == n - 1) {
+            releaseMatrixRows(dMat, i - i % TILE_ROWS, i + 1);
         }
     }
 
-    freeMat(wMat, vectorsAmount);
+    freeMatrix(degreeVec);
+    STATS_END(STATS_DDG);
+    memLeave(previous);
 
     return dMat;
 
 }
 
-double ** gl(struct vector * headVec, int vectorsAmount) {
-    double ** wMat, ** dMat, ** glMat;
-    int i, j;
-
-    wMat = wam(headVec, vectorsAmount);
-    dMat = ddg(headVec, vectorsAmount);
+struct matrix * gl(struct matrix * points) {
+    struct matrix * glMat;
+    double rowSum;
+    int i, j, n = points->rows;
+    uint64_t key = 0;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    if (cacheEnabled()) {
+        key = hashMatrix(points);
+        glMat = cacheLoad(key, "gl", points->rows, points->rows);
+        if (glMat != NULL) {
+            memLeave(previous);
+            return glMat;
+        }
+    }
 
-    glMat = malloc(vectorsAmount * sizeof(double*));
+    /* L = D - W is built in place from a single W evaluation, or tiled
+     * straight into a scratch file in out-of-core mode */
+    STATS_BEGIN(STATS_GL);
+    glMat = outOfCoreEnabled() ? tiledAffinity(points, 1) : wam(points);
     if (glMat == NULL) {
-        printErrorMessage();
+        STATS_END(STATS_GL);
+        memLeave(previous);
         return NULL;
     }
 
-    for (i=0; i < vectorsAmount; i++) {
-        glMat[i] = malloc(vectorsAmount * sizeof(double));
-        if (glMat[i] == NULL) {
-            printErrorMessage();
+    for (i=0; glMat->backing != MATRIX_SCRATCH && i < n; i++) {
+        rowSum = arraySum(MAT_ROW(glMat, i), n);
+
+        for (j = 0; j < n; j++) {
+            MAT(glMat, i, j) = (i == j ? rowSum : 0) - MAT(glMat, i, j);
+        }
+    }
+
+    STATS_END(STATS_GL);
+
+    if (cacheEnabled()) {
+        cacheStore(key, "gl", glMat);
+    }
+
+    memLeave(previous);
+    return glMat;
+
+}
+
+/* degrees() from float copies of the points, still summed in double. Not
+ * cached. */
+struct matrix * degreesF(struct matrix * points) {
+    struct matrixf * pointsF;
+    struct matrix * degreeVec;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    pointsF = matrixToFloat(points);
+    degreeVec = pointsF == NULL ? NULL : streamedDegreesF(pointsF);
+    freeMatrixF(pointsF);
+    memLeave(previous);
+
+    return degreeVec;
+}
+
+/* Single precision W, D or L of double points, selected by goal. The n x n
+ * stages run on float copies of the points and move half the bytes, while
+ * the row sums are still accumulated in double. Results are not cached. */
+static struct matrixf * affinityF(struct matrix * points, const char * goal) {
+    struct matrixf * pointsF, * result;
+    struct matrix * degreeVec;
+    int i, n = points->rows;
+    enum memSubsystem previous = memEnter(MEM_AFFINITY);
+
+    if (strcmp(goal, "ddg") != 0) {
+        pointsF = matrixToFloat(points);
+        if (pointsF == NULL) {
+            memLeave(previous);
             return NULL;
         }
-        
-        for (j = 0; j < vectorsAmount; j++) {
-            glMat[i][j] = dMat[i][j] - wMat[i][j];
+
+        STATS_BEGIN(goal[0] == 'w' ? STATS_WAM : STATS_GL);
+        result = tiledAffinityF(pointsF, goal[0] != 'w');
+        STATS_END(goal[0] == 'w' ? STATS_WAM : STATS_GL);
+        freeMatrixF(pointsF);
+        memLeave(previous);
+        return result;
+    }
+
+    STATS_BEGIN(STATS_DDG);
+    degreeVec = degreesF(points);
+    if (degreeVec == NULL) {
+        result = NULL;
+    } else if (outOfCoreEnabled()) {
+        result = allocScratchMatrixF(scratchDir(), n, n);
+    } else {
+        result = allocZeroMatrixF(n, n);
+    }
+
+    for (i = 0; result != NULL && i < n; i++) {
+        MAT(result, i, i) = MAT(degreeVec, 0, i);
+        if ((i + 1) % TILE_ROWS == 0 || i == n - 1) {
+            releaseMatrixRowsF(result, i - i % TILE_ROWS, i + 1);
         }
     }
 
-    freeMat(wMat, vectorsAmount);
-    freeMat(dMat, vectorsAmount);
+    freeMatrix(degreeVec);
+    STATS_END(STATS_DDG);
+    memLeave(previous);
+    return result;
+}
 
-    return glMat;
+struct matrixf * wamF(struct matrix * points) {
+    return affinityF(points, "wam");
+}
 
+struct matrixf * ddgF(struct matrix * points) {
+    return affinityF(points, "ddg");
 }
 
-void findPivot(double ** mat, int n, int * pivotIndexes) {
-    int i, j;
+struct matrixf * glF(struct matrix * points) {
+    return affinityF(points, "gl");
+}
+
+void findPivot(struct matrix * mat, int * pivotIndexes) {
+    int i, j, n = mat->rows;
     double max = -1;
 
     for (i=0; i<n; i++) {
         for(j=0; j<n; j++) {
-            if (fabs(mat[i][j]) > max && i != j) {
-                max = fabs(mat[i][j]);
+            if (fabs(MAT(mat, i, j)) > max && i != j) {
+                max = fabs(MAT(mat, i, j));
                 pivotIndexes[0] = i;
                 pivotIndexes[1] = j;
             }
@@ -254,88 +486,69 @@ void findPivot(double ** mat, int n, int * pivotIndexes) {
     }
 }
 
-double calcTheta(double **mat, int * pivotIndexes) {
+double calcTheta(struct matrix *mat, int * pivotIndexes) {
     int i, j;
 
     i = pivotIndexes[0];
     j = pivotIndexes[1];
 
-    return (mat[j][j] - mat[i][i]) / (2 * mat[i][j]);
+    return (MAT(mat, j, j) - MAT(mat, i, i)) / (2 * MAT(mat, i, j));
 }
 
-void calcParametes(double **mat, int *pivotIndexes, double *params) {
+void calcParametes(struct matrix *mat, int *pivotIndexes, double *params) {
     int sign;
     double t,c,s,theta;
 
     theta = calcTheta(mat, pivotIndexes);
 
     sign = theta >= 0 ? 1 : -1;
-    t = sign / (fabs(theta) + sqrt(pow(theta,2)+1));
-    c = 1 / (sqrt(pow(t,2)+1));
+    t = sign / (fabs(theta) + sqrt(theta*theta+1));
+    c = 1 / (sqrt(t*t+1));
     s = t*c;
 
     params[0] = c;
     params[1] = s;
 }
 
-double ** buildPivotMat(double ** mat, int n) {
-    double ** pivotMat;
+struct matrix * buildPivotMat(struct matrix * mat) {
+    struct matrix * pivotMat;
     double params[2];
     int pivotIndexes[2];
-    int i, j;
+    int i, n = mat->rows;
     double c,s;
 
-    findPivot(mat, n, pivotIndexes);
+    findPivot(mat, pivotIndexes);
     calcParametes(mat, pivotIndexes, params);
 
     c = params[0];
     s = params[1];
 
-    pivotMat = malloc(n * sizeof(double*));
+    pivotMat = allocZeroMatrix(n, n);
     if (pivotMat == NULL) {
-        printErrorMessage();
         return NULL;
     }
 
     for (i=0; i < n; i++) {
-        pivotMat[i] = malloc(n * sizeof(double));
-        if (pivotMat[i] == NULL) {
-            printErrorMessage();
-            return NULL;
-        }
-        
-        for (j = 0; j < n; j++) {
-
-            if (i == j) {
-                if (i == pivotIndexes[0] || i == pivotIndexes[1]) {
-                    pivotMat[i][j] = c;
-                } else {
-                    pivotMat[i][j] = 1;
-                }
-            } else {
-                if (i == pivotIndexes[0] && j == pivotIndexes[1]) {
-                    pivotMat[i][j] = s;
-                } else if (i == pivotIndexes[1] && j == pivotIndexes[0]) {
-                    pivotMat[i][j] = -s;
-                } else {
-                    pivotMat[i][j] = 0;
-                }
-            } 
-        }
+        MAT(pivotMat, i, i) = 1;
     }
 
+    MAT(pivotMat, pivotIndexes[0], pivotIndexes[0]) = c;
+    MAT(pivotMat, pivotIndexes[1], pivotIndexes[1]) = c;
+    MAT(pivotMat, pivotIndexes[0], pivotIndexes[1]) = s;
+    MAT(pivotMat, pivotIndexes[1], pivotIndexes[0]) = -s;
+
     return pivotMat;
 
 }
 
-double calcOff(double ** mat, int n) {
-    int i, j;
+double calcOff(struct matrix * mat) {
+    int i, j, n = mat->rows;
     double sum = 0;
 
     for (i=0; i < n; i++) {
         for (j = 0; j < n; j++) {
             if (i != j) {
-                sum += pow(mat[i][j], 2);
+                sum += MAT(mat, i, j) * MAT(mat, i, j);
             }
         }
     }
@@ -343,249 +556,1066 @@ double calcOff(double ** mat, int n) {
     return sum;
 }
 
-double ** transposeMat(double ** mat, int n) {
+struct matrix * transposeMat(struct matrix * mat) {
     int i, j;
+    struct matrix * transposed = allocMatrix(mat->cols, mat->rows);
 
-    double ** transposed = malloc(n * sizeof(double*));
     if (transposed == NULL) {
-        printErrorMessage();
         return NULL;
     }
 
-    for (i = 0; i < n; i++) {
-        transposed[i] = malloc(n * sizeof(double));
-        if (transposed[i] == NULL) {
-            printErrorMessage();
-            return NULL;
-        }
-
-        for (j = 0; j < n; j++) {
-            transposed[i][j] = mat[j][i];
+    for (i = 0; i < mat->cols; i++) {
+        for (j = 0; j < mat->rows; j++) {
+            MAT(transposed, i, j) = MAT(mat, j, i);
         }
     }
 
     return transposed;
 }
 
-double ** matrixMultiply(double ** mat1, double ** mat2, int n) {
+struct matrix * matrixMultiply(struct matrix * mat1, struct matrix * mat2) {
     int i, j, k;
-    double ** result = malloc(n * sizeof(double *));
+    double a;
+    double *resultRow, *row2;
+    struct matrix * result = allocZeroMatrix(mat1->rows, mat2->cols);
+
     if (result == NULL) {
-        printErrorMessage();
         return NULL;
     }
 
-    for (i = 0; i < n; i++) {
-        result[i] = malloc(n * sizeof(double));
-        if (result[i] == NULL) {
-            printErrorMessage();
-            return NULL;
-        }
+    /* i-k-j order streams through rows of both operands while still summing
+     * every entry in increasing k */
+    for (i = 0; i < mat1->rows; i++) {
+        resultRow = MAT_ROW(result, i);
 
-        for (j = 0; j < n; j++) {
-            result[i][j] = 0;
-            for (k = 0; k < n; k++) {
-                result[i][j] += mat1[i][k] * mat2[k][j];
+        for (k = 0; k < mat1->cols; k++) {
+            a = MAT(mat1, i, k);
+            row2 = MAT_ROW(mat2, k);
+
+            for (j = 0; j < mat2->cols; j++) {
+                resultRow[j] += a * row2[j];
             }
         }
     }
+
     return result;
 }
 
-double ** makePivot(double ** p, double ** a, int n) {
-    double **pT, **aTag, **temp;
-    pT = transposeMat(p, n);
-    temp = matrixMultiply(pT, a, n);
-    aTag = matrixMultiply(temp, p, n);
+struct matrix * makePivot(struct matrix * p, struct matrix * a) {
+    struct matrix *pT, *aTag, *temp;
 
-    freeMat(pT, n);
-    freeMat(temp, n);
+    pT = transposeMat(p);
+    if (pT == NULL) {
+        return NULL;
+    }
+
+    temp = matrixMultiply(pT, a);
+    freeMatrix(pT);
+    if (temp == NULL) {
+        return NULL;
+    }
+
+    aTag = matrixMultiply(temp, p);
+    freeMatrix(temp);
 
     return aTag;
 }
 
-double ** calcEigenVectors(double *** pivotArray, int stepCount, int n) {
-    int i;
-    double **result = pivotArray[0];
-    double ** resultArray[MAX_ITER] = {NULL};
+int isMinusZero(double number) {
+    int i=0;
+
+    if (number >= 0 ) {
+        return 1;
+    }
+
+    for (i=0; i<5; i++) {
+        if ((int) number != 0) {
+            return 1;
+        
+        } 
 
-    for (i=1; i < stepCount; i++) {
-        resultArray[i-1] = result;
-        result = matrixMultiply(result, pivotArray[i], n);
+        number = number * 10;
     }
 
-    for (i=0; i < stepCount; i++) {
-        freeMat(pivotArray[i], n);
+    return 0;
+}
+
+/* Applies the rotation P of buildPivotMat() for pivot (p, q), p < q, to A in
+ * place as A <- P^T A P, and accumulates it into V as V <- V P, touching
+ * only rows and columns p and q. Every updated entry is summed as 0 + t1 + t2,
+ * the order in which matrixMultiply() would add the two nonzero products, so
+ * the results are the same as the dense products bit for bit. */
+static void applyRotation(struct matrix * a, struct matrix * v, int p, int q, double c, double s) {
+    double ap, aq;
+    int i, n = a->rows;
+
+    for (i = 0; i < n; i++) {
+        ap = MAT(a, p, i);
+        aq = MAT(a, q, i);
+        MAT(a, p, i) = 0.0 + c * ap + -s * aq;
+        MAT(a, q, i) = 0.0 + s * ap + c * aq;
     }
 
-    for (i=1; i < stepCount - 1; i++) {
-        freeMat(resultArray[i], n);
+    for (i = 0; i < n; i++) {
+        ap = MAT(a, i, p);
+        aq = MAT(a, i, q);
+        MAT(a, i, p) = 0.0 + ap * c + aq * -s;
+        MAT(a, i, q) = 0.0 + ap * s + aq * c;
+
+        ap = MAT(v, i, p);
+        aq = MAT(v, i, q);
+        MAT(v, i, p) = 0.0 + ap * c + aq * -s;
+        MAT(v, i, q) = 0.0 + ap * s + aq * c;
     }
+}
 
-    return result;
+/* A copy of mat with every -0 turned into +0, as a dense product would */
+static struct matrix * normalizedCopy(struct matrix * mat) {
+    struct matrix * copy = allocMatrix(mat->rows, mat->cols);
+    int i, j;
+
+    for (i = 0; copy != NULL && i < mat->rows; i++) {
+        for (j = 0; j < mat->cols; j++) {
+            MAT(copy, i, j) = 0.0 + MAT(mat, i, j);
+        }
+    }
+
+    return copy;
 }
 
-double ** buildSymetricMat(struct vector * headVec, int n) {
-    double ** mat;
-    int i,j;
-    struct vector *currVec;
-    struct cord *currCord;
+/* Sets *a to a copy of input, or of basis^T * input * basis when basis is not
+ * NULL, and *v to the identity or a copy of basis, the matrices a Jacobi run
+ * rotates. Returns 0 on success. */
+static int startRotations(struct matrix * input, struct matrix * basis, struct matrix ** a, struct matrix ** v) {
+    struct matrix * rotated;
+    int i, n = input->rows;
+
+    if (basis != NULL) {
+        rotated = makePivot(basis, input);
+        *a = rotated == NULL ? NULL : normalizedCopy(rotated);
+        *v = *a == NULL ? NULL : normalizedCopy(basis);
+        freeMatrix(rotated);
+    } else {
+        *a = normalizedCopy(input);
+        *v = *a == NULL ? NULL : allocZeroMatrix(n, n);
+        for (i = 0; *v != NULL && i < n; i++) {
+            MAT(*v, i, i) = 1;
+        }
+    }
 
-    mat = malloc(n * sizeof(double*));
-    if (mat == NULL) {
-        printErrorMessage();
+    if (*a == NULL || *v == NULL) {
+        freeMatrix(*a);
+        freeMatrix(*v);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Diagonalizes input by at most MAX_ITER Jacobi rotations from the
+ * identity, each on the largest off-diagonal entry and costing O(n) plus
+ * the O(n^2) pivot search, as the jacobi goal's output is defined. The
+ * diagonal left after the last rotation goes to values, how the run ended to
+ * run, and the accumulated rotation matrix, whose columns are the
+ * eigenvectors, is returned. */
+static struct matrix * rotate(struct matrix * input, double * values, struct jacobiRun * run) {
+    struct matrix *a, *eigenVectors;
+    double params[2];
+    int pivotIndexes[2];
+    int i, n = input->rows, stepCount = 0;
+    double epsilon = 1.0 * pow(10, -5); 
+    double off = epsilon * 2, offTag, prevOff;
+
+    STATS_BEGIN(STATS_JACOBI);
+    if (startRotations(input, NULL, &a, &eigenVectors) != 0) {
+        STATS_END(STATS_JACOBI);
         return NULL;
     }
 
-    currVec = headVec;
+    prevOff = calcOff(a);
+    while (stepCount < MAX_ITER && off > epsilon) {
+        findPivot(a, pivotIndexes);
+        calcParametes(a, pivotIndexes, params);
+        applyRotation(a, eigenVectors, pivotIndexes[0], pivotIndexes[1], params[0], params[1]);
+
+        offTag = calcOff(a);
+        off = prevOff - offTag;
+        prevOff = offTag;
+        STATS_ADD(jacobiRotations, 1);
+        STATS_SET(finalOff, offTag);
+        stepCount++;
+    }
 
+    STATS_END(STATS_JACOBI);
+    run->rotations = stepCount;
+    run->off = prevOff;
+    run->converged = off <= epsilon;
     for (i=0; i < n; i++) {
-        currCord = currVec->cords;
-        mat[i] = malloc(n * sizeof(double));
-        if (mat[i] == NULL) {
-            printErrorMessage();
-            return NULL;
+        values[i] = MAT(a, i, i);
+    }
+
+    freeMatrix(a);
+    return eigenVectors;
+}
+
+/* Diagonalizes input by cyclic Jacobi sweeps, rotating every nonzero
+ * off-diagonal entry once per sweep in row order, until the off-diagonal
+ * sum of squares is within JACOBI_TOLERANCE of the whole matrix's or
+ * JACOBI_SWEEPS sweeps have run. Starts from the identity or, when basis is
+ * not NULL, from basis^T * input * basis with the rotations accumulated onto
+ * basis. The diagonal goes to values, how the run ended to run, and the
+ * eigenvectors are returned as columns. */
+static struct matrix * sweep(struct matrix * input, struct matrix * basis, double * values, struct jacobiRun * run) {
+    struct matrix *a, *eigenVectors;
+    double params[2], norm = 0, off;
+    int pivotIndexes[2];
+    int i, j, sweeps, n = input->rows;
+
+    STATS_BEGIN(STATS_JACOBI);
+    run->rotations = 0;
+    if (startRotations(input, basis, &a, &eigenVectors) != 0) {
+        STATS_END(STATS_JACOBI);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            norm += MAT(a, i, j) * MAT(a, i, j);
         }
+    }
 
-        for (j=0; j < n; j++) {
-            mat[i][j] = currCord->value;
-            currCord = currCord->next;
+    off = calcOff(a);
+    for (sweeps = 0; sweeps < JACOBI_SWEEPS && off > JACOBI_TOLERANCE * norm; sweeps++) {
+        for (pivotIndexes[0] = 0; pivotIndexes[0] < n; pivotIndexes[0]++) {
+            for (pivotIndexes[1] = pivotIndexes[0] + 1; pivotIndexes[1] < n; pivotIndexes[1]++) {
+                if (MAT(a, pivotIndexes[0], pivotIndexes[1]) == 0) {
+                    continue;
+                }
+
+                calcParametes(a, pivotIndexes, params);
+                applyRotation(a, eigenVectors, pivotIndexes[0], pivotIndexes[1], params[0], params[1]);
+                STATS_ADD(jacobiRotations, 1);
+                run->rotations++;
+            }
         }
 
-        currVec = currVec->next;
+        off = calcOff(a);
+        STATS_SET(finalOff, off);
     }
 
-    return mat;
+    STATS_END(STATS_JACOBI);
+    run->off = off;
+    run->converged = off <= JACOBI_TOLERANCE * norm;
+    for (i = 0; i < n; i++) {
+        values[i] = MAT(a, i, i);
+    }
 
+    freeMatrix(a);
+    return eigenVectors;
 }
 
-int isMinusZero(double number) {
-    int i=0;
+/* sweep() from the identity, the shape cachedRotations() expects */
+static struct matrix * sweepFromIdentity(struct matrix * input, double * values, struct jacobiRun * run) {
+    return sweep(input, NULL, values, run);
+}
 
-    if (number >= 0 ) {
+/* Runs solve on input through the cache, the eigenvalues followed by the
+ * run's final off and converged flag stored under valKind and the
+ * eigenvectors under vecKind. A cache hit reports no rotations. */
+static struct matrix * cachedRotations(struct matrix * input, double * values, struct jacobiRun * run,
+                                       const char * valKind, const char * vecKind,
+                                       struct matrix * (*solve)(struct matrix *, double *, struct jacobiRun *)) {
+    struct matrix *eigenVectors, *cachedValues;
+    int n = input->rows;
+    uint64_t key = 0;
+
+    if (cacheEnabled()) {
+        key = hashMatrix(input);
+        cachedValues = cacheLoad(key, valKind, 1, n + 2);
+        eigenVectors = cachedValues == NULL ? NULL : cacheLoad(key, vecKind, n, n);
+        if (eigenVectors != NULL) {
+            memcpy(values, cachedValues->data, n * sizeof(double));
+            run->rotations = 0;
+            run->off = MAT(cachedValues, 0, n);
+            run->converged = MAT(cachedValues, 0, n + 1) != 0;
+            freeMatrix(cachedValues);
+            return eigenVectors;
+        }
+
+        freeMatrix(cachedValues);
+    }
+
+    eigenVectors = solve(input, values, run);
+    if (eigenVectors != NULL && cacheEnabled()) {
+        cachedValues = allocMatrix(1, n + 2);
+        if (cachedValues != NULL) {
+            memcpy(cachedValues->data, values, n * sizeof(double));
+            MAT(cachedValues, 0, n) = run->off;
+            MAT(cachedValues, 0, n + 1) = run->converged;
+            cacheStore(key, valKind, cachedValues);
+            cacheStore(key, vecKind, eigenVectors);
+            freeMatrix(cachedValues);
+        }
+    }
+
+    return eigenVectors;
+}
+
+/* Diagonalizes a copy of `input` by Jacobi rotations, stopping after
+ * MAX_ITER of them as the jacobi goal's output is defined. The diagonal left
+ * after the last rotation is written to values and the accumulated rotation
+ * matrix, whose columns are the eigenvectors, is returned. */
+struct matrix * jacobiRotations(struct matrix * input, double * values) {
+    struct jacobiRun run;
+
+    return cachedRotations(input, values, &run, "eigval", "eigvec", rotate);
+}
+
+/* Diagonalizes a copy of `input` to JACOBI_TOLERANCE by cyclic sweeps, for
+ * everything that needs the eigenpairs themselves rather than the jacobi
+ * goal's printout. run tells whether the tolerance was reached. */
+struct matrix * convergedRotations(struct matrix * input, double * values, struct jacobiRun * run) {
+    return cachedRotations(input, values, run, "sweepval", "sweepvec", sweepFromIdentity);
+}
+
+struct matrix * jacobi(struct matrix * input) {
+    struct matrix *jMat, *eigenVectors;
+    int i, j, n = input->rows;
+    enum memSubsystem previous;
+
+    if (input->rows != input->cols) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    previous = memEnter(MEM_EIGEN);
+    /* +1 beuacse of eigen values */
+    jMat = allocMatrix(n + 1, n);
+    eigenVectors = jMat == NULL ? NULL : jacobiRotations(input, MAT_ROW(jMat, 0));
+    memLeave(previous);
+    if (eigenVectors == NULL) {
+        freeMatrix(jMat);
+        return NULL;
+    }
+
+    for (i=1; i <= n; i++) {
+        for(j=0; j < n; j++) {
+            MAT(jMat, i, j) = (isMinusZero(MAT(jMat, 0, i-1)) == 1) ? 
+                          MAT(eigenVectors, i-1, j) : -MAT(eigenVectors, i-1, j);
+        }
+
+        MAT(jMat, 0, i-1) = (isMinusZero(MAT(jMat, 0, i-1)) == 1) ? MAT(jMat, 0, i-1) : -MAT(jMat, 0, i-1);
+    }
+
+    freeMatrix(eigenVectors);
+
+    return jMat;
+
+}
+
+struct eigenEntry {
+    double value;
+    int index;
+};
+
+int compareEigenEntries(const void *a, const void *b) {
+    const struct eigenEntry *e1 = a, *e2 = b;
+
+    if (e1->value != e2->value) {
+        return e1->value < e2->value ? -1 : 1;
+    }
+
+    return e1->index - e2->index;
+}
+
+/* Fills order with the indexes of values sorted by increasing value, ties
+ * kept in their original order. */
+int sortEigenValues(double * values, int n, int * order) {
+    struct eigenEntry *entries;
+    int i;
+
+    entries = memAlloc(n * sizeof(struct eigenEntry));
+    if (entries == NULL) {
+        printErrorMessage();
         return 1;
     }
 
-    for (i=0; i<5; i++) {
-        if ((int) number != 0) {
-            return 1;
-        
-        } 
+    for (i = 0; i < n; i++) {
+        entries[i].value = values[i];
+        entries[i].index = i;
+    }
 
-        number = number * 10;
+    qsort(entries, n, sizeof(struct eigenEntry), compareEigenEntries);
+
+    for (i = 0; i < n; i++) {
+        order[i] = entries[i].index;
     }
 
+    memFree(entries);
     return 0;
 }
 
-double ** jacobi(double ** a, int n) {
-    double **aTag, **p, **jMat, **eigenVectors;
-    double ** pivotArray[MAX_ITER];
-    int i, j, stepCount = 0;
-    double epsilon = 1.0 * pow(10, -5); 
-    double off = epsilon * 2;
+/* Eigengap heuristic over eigenvalues sorted in increasing order, scanning
+ * the first half of the spectrum. */
+int calcK(double * sortedValues, int n) {
+    int i, k = 0;
+    double gap, maxGap = 0;
+
+    for (i = 1; i < n / 2; i++) {
+        gap = fabs(sortedValues[i] - sortedValues[i + 1]);
+        if (maxGap < gap) {
+            maxGap = gap;
+            k = i;
+        }
+    }
 
-    while (stepCount < MAX_ITER && off > epsilon) {
-        p = buildPivotMat(a, n);
-        pivotArray[stepCount] = p;
-        aTag = makePivot(p, a, n);
+    return k + 1;
+}
 
-        off = calcOff(a, n) - calcOff(aTag, n);
-        freeMat(a, n);
-        a = aTag;
-        stepCount++;
+void freeEigen(struct eigen * eigen) {
+    if (eigen == NULL) {
+        return;
     }
 
-    eigenVectors = calcEigenVectors(pivotArray, stepCount, n);
+    memFree(eigen->values);
+    freeMatrix(eigen->vectors);
+    memFree(eigen);
+}
 
-    /* +1 beuacse of eigen values */
-    jMat = malloc((n + 1) * sizeof(double*));
-    if (jMat == NULL) {
+/* Eigendecomposition of the symmetric matrix a. With EIGEN_SORTED the pairs
+ * come in increasing eigenvalue order, with EIGEN_EIGENGAP (which implies
+ * sorting) k is picked by the eigengap heuristic. Only the first k eigenvector
+ * columns are materialized, k == 0 keeps all of them. */
+static struct eigen * decompose(struct matrix * a, struct matrix * basis, int options, int k) {
+    struct eigen * eigen;
+    struct matrix * eigenVectors;
+    double * values;
+    int * order;
+    int i, j, n = a->rows;
+    struct jacobiRun run;
+
+    /* Jacobi walks the n x n upper triangle, a non-square a would overrun it */
+    if (a->rows != a->cols) {
         printErrorMessage();
         return NULL;
     }
 
-    jMat[0] = malloc(n * sizeof(double));
-    if (jMat[0] == NULL) {
+    if (options & EIGEN_EIGENGAP) {
+        options |= EIGEN_SORTED;
+    }
+
+    values = memAlloc(n * sizeof(double));
+    order = memAlloc(n * sizeof(int));
+    eigen = memAlloc(sizeof(struct eigen));
+    if (values == NULL || order == NULL || eigen == NULL) {
         printErrorMessage();
+        memFree(values);
+        memFree(order);
+        memFree(eigen);
         return NULL;
     }
-    
-    for (i=0; i < n; i++) {
-        jMat[0][i] = a[i][i];
+
+    eigenVectors = basis == NULL ? convergedRotations(a, values, &run) : sweep(a, basis, values, &run);
+    if (eigenVectors == NULL) {
+        memFree(values);
+        memFree(order);
+        memFree(eigen);
+        return NULL;
     }
 
-    for (i=1; i <= n; i++) {
-        jMat[i] = malloc(n * sizeof(double));
-        if (jMat[i] == NULL) {
-            printErrorMessage();
+    /* an eigenvalue that would print as -0.0000 is flipped together with its
+     * eigenvector column */
+    for (i = 0; i < n; i++) {
+        if (isMinusZero(values[i]) == 0) {
+            values[i] = -values[i];
+            for (j = 0; j < n; j++) {
+                MAT(eigenVectors, j, i) = -MAT(eigenVectors, j, i);
+            }
+        }
+    }
+
+    if (options & EIGEN_SORTED) {
+        if (sortEigenValues(values, n, order) != 0) {
+            memFree(values);
+            memFree(order);
+            memFree(eigen);
+            freeMatrix(eigenVectors);
             return NULL;
         }
+    } else {
+        for (i = 0; i < n; i++) {
+            order[i] = i;
+        }
+    }
 
-        for(j=0; j < n; j++) {
-            jMat[i][j] = (isMinusZero(jMat[0][i-1]) == 1) ? 
-                          eigenVectors[i-1][j] : -eigenVectors[i-1][j];
+    eigen->n = n;
+    eigen->converged = run.converged;
+    eigen->values = memAlloc(n * sizeof(double));
+    if (eigen->values != NULL) {
+        for (i = 0; i < n; i++) {
+            eigen->values[i] = values[order[i]];
         }
+    }
 
-        jMat[0][i-1] = (isMinusZero(jMat[0][i-1]) == 1) ? jMat[0][i-1] : -jMat[0][i-1];
+    if (options & EIGEN_EIGENGAP) {
+        k = calcK(eigen->values, n);
     }
 
-    freeMat(eigenVectors, n);
-    freeMat(a, n);
+    eigen->k = k > 0 && k < n ? k : n;
+    eigen->vectors = eigen->values == NULL ? NULL : allocMatrix(n, eigen->k);
+    if (eigen->vectors != NULL) {
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < eigen->k; j++) {
+                MAT(eigen->vectors, i, j) = MAT(eigenVectors, i, order[j]);
+            }
+        }
+    }
 
-    return jMat;
+    memFree(values);
+    memFree(order);
+    freeMatrix(eigenVectors);
+
+    if (eigen->values == NULL || eigen->vectors == NULL) {
+        printErrorMessage();
+        freeEigen(eigen);
+        return NULL;
+    }
+
+    return eigen;
+}
+
+struct eigen * eigenDecompose(struct matrix * a, int options, int k) {
+    struct eigen * eigen;
+    enum memSubsystem previous = memEnter(MEM_EIGEN);
 
+    eigen = decompose(a, NULL, options, k);
+    memLeave(previous);
+
+    return eigen;
 }
 
+/* Largest absolute row sum of basis^T * basis - I, 0 for an orthogonal
+ * basis */
+double orthogonalityError(struct matrix * basis) {
+    double dot, rowSum, error = 0;
+    int i, j, r;
+
+    for (i = 0; i < basis->cols; i++) {
+        rowSum = 0;
+        for (j = 0; j < basis->cols; j++) {
+            dot = i == j ? -1 : 0;
+            for (r = 0; r < basis->rows; r++) {
+                dot += MAT(basis, r, i) * MAT(basis, r, j);
+            }
+            rowSum += fabs(dot);
+        }
+        error = rowSum > error ? rowSum : error;
+    }
+
+    return error;
+}
+
+/* eigenDecompose() warm started from basis, an n x n orthogonal matrix such
+ * as the eigenvectors of a nearby matrix: Jacobi continues from
+ * basis^T * a * basis, which is nearly diagonal when basis is close, and the
+ * eigenvectors come out composed with basis. A basis further than
+ * WARM_START_ORTHOGONALITY from orthogonal is rejected, the eigenvalues of
+ * basis^T * a * basis would not be a's. Bypasses the cache. */
+struct eigen * eigenDecomposeFrom(struct matrix * a, struct matrix * basis, int options, int k) {
+    struct eigen * eigen;
+    enum memSubsystem previous;
+
+    if (basis->rows != a->rows || basis->cols != a->rows || orthogonalityError(basis) > WARM_START_ORTHOGONALITY) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    previous = memEnter(MEM_EIGEN);
+    eigen = decompose(a, basis, options, k);
+    memLeave(previous);
+
+    return eigen;
+}
+
+/* Largest difference between the eigenvalues of two decompositions once
+ * both are sorted, or a negative value when sorting fails */
+static double eigenvalueDistance(double * values1, double * values2, int n) {
+    int *order1, *order2;
+    double diff = -1;
+    int i;
+
+    order1 = memAlloc(n * sizeof(int));
+    order2 = memAlloc(n * sizeof(int));
+    if (order1 != NULL && order2 != NULL && sortEigenValues(values1, n, order1) == 0 &&
+        sortEigenValues(values2, n, order2) == 0) {
+        for (i = 0, diff = 0; i < n; i++) {
+            if (fabs(values1[order1[i]] - values2[order2[i]]) > diff) {
+                diff = fabs(values1[order1[i]] - values2[order2[i]]);
+            }
+        }
+    }
+
+    memFree(order1);
+    memFree(order2);
+    return diff;
+}
+
+/* Cold against warm started Jacobi over steps matrices, each the one before
+ * plus a symmetric perturbation uniform in [-noise, noise], starting from a:
+ * every step is diagonalized from the identity and from the eigenvectors of
+ * the step before. Fills quality with every step and, over the steps where
+ * both runs converged, the rotations and time of both and the largest
+ * difference between their eigenvalues; a step where either run hit its cap
+ * is not counted. Returns 0 on success, quality->runs is then released with
+ * freeWarmStartQuality(). */
+int compareWarmStart(struct matrix * a, int steps, double noise, struct warmStartQuality * quality) {
+    struct mt19937 rng;
+    struct matrix *current, *cold, *warm, *basis = NULL;
+    struct warmStartRun *stepRun;
+    double *coldValues, *warmValues;
+    double start, diff;
+    int i, j, step, n = a->rows, failed = 0;
+    struct jacobiRun run;
+    enum memSubsystem previous = memEnter(MEM_EIGEN);
+
+    memset(quality, 0, sizeof(struct warmStartQuality));
+    quality->steps = steps;
+    quality->runs = memAlloc(steps * sizeof(struct warmStartRun));
+    current = copyMatrix(a);
+    coldValues = memAlloc(n * sizeof(double));
+    warmValues = memAlloc(n * sizeof(double));
+    if (quality->runs == NULL || current == NULL || coldValues == NULL || warmValues == NULL) {
+        printErrorMessage();
+        failed = 1;
+    }
+
+    /* the first matrix only seeds the basis */
+    basis = failed ? NULL : sweep(current, NULL, warmValues, &run);
+    failed = basis == NULL;
+
+    mt19937Seed(&rng, WARM_START_SEED);
+    for (step = 0; !failed && step < steps; step++) {
+        for (i = 0; i < n; i++) {
+            for (j = i; j < n; j++) {
+                MAT(current, i, j) += noise * (2 * mt19937NextDouble(&rng) - 1);
+                MAT(current, j, i) = MAT(current, i, j);
+            }
+        }
+
+        stepRun = &quality->runs[step];
+        start = monotonicMs();
+        cold = sweep(current, NULL, coldValues, &run);
+        stepRun->coldMs = monotonicMs() - start;
+        stepRun->coldRotations = run.rotations;
+        stepRun->coldOff = run.off;
+        stepRun->coldConverged = run.converged;
+
+        start = monotonicMs();
+        warm = cold == NULL ? NULL : sweep(current, basis, warmValues, &run);
+        stepRun->warmMs = monotonicMs() - start;
+        stepRun->warmRotations = run.rotations;
+        stepRun->warmOff = run.off;
+        stepRun->warmConverged = run.converged;
+
+        freeMatrix(cold);
+        freeMatrix(basis);
+        basis = warm;
+        diff = warm == NULL ? -1 : eigenvalueDistance(coldValues, warmValues, n);
+        failed = diff < 0;
+        if (failed || !stepRun->coldConverged || !stepRun->warmConverged) {
+            continue;
+        }
+
+        quality->measuredSteps++;
+        quality->coldMs += stepRun->coldMs;
+        quality->warmMs += stepRun->warmMs;
+        quality->coldRotations += stepRun->coldRotations;
+        quality->warmRotations += stepRun->warmRotations;
+        quality->eigenvalueError = diff > quality->eigenvalueError ? diff : quality->eigenvalueError;
+    }
+
+    freeMatrix(current);
+    freeMatrix(basis);
+    memFree(coldValues);
+    memFree(warmValues);
+    if (failed) {
+        freeWarmStartQuality(quality);
+    }
+
+    memLeave(previous);
+    return failed;
+}
+
+void freeWarmStartQuality(struct warmStartQuality * quality) {
+    memFree(quality->runs);
+    quality->runs = NULL;
+}
+
+void freeSpkResult(struct spkResult * result) {
+    if (result == NULL) {
+        return;
+    }
+
+    memFree(result->indexes);
+    memFree(result->labels);
+    freeMatrix(result->centroids);
+    memFree(result);
+}
+
+/* k-means++ seeded k-means on the rows of the n x k embedding U. Takes
+ * ownership of eigen. */
+struct spkResult * clusterEmbedding(struct eigen * eigen) {
+    return clusterGroupedEmbedding(eigen, NULL, NULL, eigen->vectors->rows);
+}
+
+/* k-means on the rows of U: on a coreset when one is configured and U has
+ * more rows (and no weights of its own), else sharded over worker processes
+ * when configured and the shared memory transport can be set up */
+static int clusterRows(struct matrix * u, const double * weights, struct matrix * centroids, int * labels) {
+    struct shardTransport *transport;
+    int failed;
+
+    if (weights == NULL && coresetSize() > 0 && u->rows > coresetSize()) {
+        return coresetKmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, u, coresetSize(), centroids, labels);
+    }
+
+    transport = shardCount() > 1 ? openSharedMemoryTransport(u, weights, centroids->rows, shardCount()) : NULL;
+    if (transport == NULL) {
+        return weightedKmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, u, weights, centroids, labels);
+    }
+
+    failed = shardedKmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, transport, centroids, labels);
+    transport->close(transport);
+    return failed;
+}
+
+/* clusterEmbedding() where row groupOf[i] of U stands for input row i, and
+ * row a of U for weights[a] input rows. Indexes and labels refer to the n
+ * input rows. */
+struct spkResult * clusterGroupedEmbedding(struct eigen * eigen, const double * weights, const int * groupOf, int n) {
+    struct spkResult * result;
+    struct matrix *u;
+    int *labels;
+    int i, k;
+    enum memSubsystem previous;
+
+    k = eigen->k;
+    u = eigen->vectors;
+    eigen->vectors = NULL;
+    freeEigen(eigen);
+
+    previous = memEnter(MEM_KMEANS);
+    result = memAlloc(sizeof(struct spkResult));
+    if (result == NULL) {
+        printErrorMessage();
+        freeMatrix(u);
+        memLeave(previous);
+        return NULL;
+    }
+
+    result->k = k;
+    result->indexes = memAlloc(k * sizeof(int));
+    result->labels = memAlloc(n * sizeof(int));
+    result->centroids = NULL;
+    labels = groupOf == NULL ? result->labels : memAlloc(u->rows * sizeof(int));
+    if (result->indexes == NULL || result->labels == NULL || labels == NULL) {
+        printErrorMessage();
+        if (labels != result->labels) {
+            memFree(labels);
+        }
+        freeSpkResult(result);
+        freeMatrix(u);
+        memLeave(previous);
+        return NULL;
+    }
+
+    result->centroids = groupOf == NULL ? kmeansPlusPlus(u, k, KMEANS_SEED, result->indexes) :
+                        groupedKmeansPlusPlus(u, groupOf, n, k, KMEANS_SEED, result->indexes);
+    if (result->centroids == NULL ||
+        clusterRows(u, weights, result->centroids, labels) != 0) {
+        if (labels != result->labels) {
+            memFree(labels);
+        }
+        freeSpkResult(result);
+        freeMatrix(u);
+        memLeave(previous);
+        return NULL;
+    }
+
+    for (i = 0; groupOf != NULL && i < n; i++) {
+        result->labels[i] = labels[groupOf[i]];
+    }
+
+    if (labels != result->labels) {
+        memFree(labels);
+    }
+
+    freeMatrix(u);
+    memLeave(previous);
+    return result;
+}
+
+/* The full spectral clustering flow: L, its eigendecomposition, k (from the
+ * eigengap when k is 0), U and k-means++ seeded k-means on the rows of U. */
+struct spkResult * spk(struct matrix * points, int k) {
+    struct matrix *lMat;
+    struct eigen *eigen;
+
+    lMat = gl(points);
+    if (lMat == NULL) {
+        return NULL;
+    }
+
+    eigen = eigenDecompose(lMat, k == 0 ? EIGEN_EIGENGAP : EIGEN_SORTED, k);
+    freeMatrix(lMat);
+    if (eigen == NULL) {
+        return NULL;
+    }
+
+    return clusterEmbedding(eigen);
+}
+
+/* spk with L built in single precision. Jacobi keeps rotating in double, so
+ * L is widened once before the eigendecomposition. */
+struct spkResult * spkF(struct matrix * points, int k) {
+    struct matrixf *lMatF;
+    struct matrix *lMat;
+    struct eigen *eigen;
+
+    lMatF = glF(points);
+    if (lMatF == NULL) {
+        return NULL;
+    }
+
+    lMat = matrixToDouble(lMatF);
+    freeMatrixF(lMatF);
+    if (lMat == NULL) {
+        return NULL;
+    }
+
+    eigen = eigenDecompose(lMat, k == 0 ? EIGEN_EIGENGAP : EIGEN_SORTED, k);
+    freeMatrix(lMat);
+    if (eigen == NULL) {
+        return NULL;
+    }
+
+    return clusterEmbedding(eigen);
+}
+
+void printIndexes(int * indexes, int len) {
+    int i;
+
+    for (i = 0; i < len; i++) {
+        printf("%d%c", indexes[i], i == len - 1 ? '\n' : ',');
+    }
+}
+
+/* benchmark and library builds link this file without its CLI entry point */
+#ifndef SPKMEANS_NO_MAIN
 int main(int argc, char *argv[]) {
-    struct vector *headVector;
-    double **wMat, **dMat, **glMat, **jMat, **symetricMat;
-    char *goal, *fileName;
-    int vectorsAmount;
+    struct matrix *points, *result = NULL;
+    struct matrixf *resultF = NULL;
+    struct spkResult *spkResult;
+    char *goal, *fileName, *socketPath = NULL;
+    int k = 0, showStats = 0, failed = 0, i, j;
+    int landmarks = NYSTROM_DEFAULT_LANDMARKS, useSubspace = 0, useFloat = 0, collapse = 0, compact = 0;
+    int localOnly = 0;
+    struct subspaceOptions subspace;
+
+    /* The options may appear anywhere among the arguments.
+     * --stats prints the run's counters to stderr.
+     * --landmarks M sets the landmark count of the nystrom goal.
+     * --solver jacobi, the default, subspace or matrixfree picks how spk
+     * finds its eigenvectors; any other solver is an error.
+     * --oversampling P and --iterations Q tune the subspace iteration.
+     * --operator-cache BYTES caps the W rows matrixfree keeps.
+     * --precision float or double, the default, sets the precision of the
+     * affinity stages of wam, ddg, gl and spk; any other is an error.
+     * --collapse makes spk merge exact duplicate points first and solve
+     * the reduced problem in double with Jacobi, whatever the other options.
+     * --shards N runs the k-means of spk over N worker processes.
+     * --coreset M runs it on a coreset of M rows of U.
+     * --compact prints ddg as one degree per line.
+     * --socket PATH sends the goal to a `spkmeans serve --socket PATH` server.
+     * Only --precision and --collapse go with --socket; the other options
+     * and the nystrom goal are errors with it. */
+    defaultSubspaceOptions(&subspace);
+    for (i = 1, j = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            showStats = 1;
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--landmarks") == 0 && i + 1 < argc) {
+            landmarks = atoi(argv[++i]);
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--solver") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "jacobi") != 0 && strcmp(argv[i], "subspace") != 0 &&
+                strcmp(argv[i], "matrixfree") != 0) {
+                printErrorMessage();
+                return 1;
+            }
+            subspace.matrixFree = strcmp(argv[i], "matrixfree") == 0;
+            useSubspace = subspace.matrixFree || strcmp(argv[i], "subspace") == 0;
+            localOnly |= useSubspace;
+        } else if (strcmp(argv[i], "--operator-cache") == 0 && i + 1 < argc) {
+            subspace.operatorCache = (size_t) atol(argv[++i]);
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--collapse") == 0) {
+            collapse = 1;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact = 1;
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "float") != 0 && strcmp(argv[i], "double") != 0) {
+                printErrorMessage();
+                return 1;
+            }
+            useFloat = strcmp(argv[i], "float") == 0;
+        } else if (strcmp(argv[i], "--oversampling") == 0 && i + 1 < argc) {
+            subspace.oversampling = atoi(argv[++i]);
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            subspace.iterations = atoi(argv[++i]);
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            setShards(atoi(argv[++i]));
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--coreset") == 0 && i + 1 < argc) {
+            setCoresetSize(atoi(argv[++i]));
+            localOnly = 1;
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else {
+            argv[j++] = argv[i];
+        }
+    }
+    argc = j;
+
+    if (argc == 2 && strcmp(argv[1], "serve") == 0 && socketPath != NULL) {
+        return serve(socketPath);
+    }
 
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
         printErrorMessage();
         return 1;
     }
 
-    goal = argv[1];
-    fileName = argv[2];
+    statsReset();
 
-    headVector = extractVectors(fileName);
-    if (headVector == NULL) {
+    if (argc == 4) {
+        k = atoi(argv[1]);
+    }
+
+    goal = argv[argc - 2];
+    fileName = argv[argc - 1];
+
+    if (socketPath != NULL && localOnly) {
         printErrorMessage();
         return 1;
     }
 
-    vectorsAmount = extractVectorAmount(headVector);
+    if (socketPath != NULL) {
+        return runRemote(socketPath, goal, fileName, k, (useFloat ? SERVER_FLOAT : 0) |
+                         (collapse ? SERVER_COLLAPSE : 0));
+    }
 
-    if (strcmp(goal, "wam") == 0) {
-        wMat = wam(headVector, vectorsAmount);
-        printMat(wMat, vectorsAmount, vectorsAmount);
-        freeMat(wMat, vectorsAmount);
+    STATS_BEGIN(STATS_PARSE);
+    points = readPoints(fileName);
+    STATS_END(STATS_PARSE);
+    if (points == NULL) {
+        return 1;
     }
 
-    if (strcmp(goal, "ddg") == 0) {
-        dMat = ddg(headVector, vectorsAmount);
-        printMat(dMat, vectorsAmount, vectorsAmount);
-        freeMat(dMat, vectorsAmount);
+    if (argc == 4 && (k < 1 || k > points->rows)) {
+        printErrorMessage();
+        freeMatrix(points);
+        return 1;
+    }
+
+    if (strcmp(goal, "spk") == 0 || strcmp(goal, "nystrom") == 0) {
+        if (strcmp(goal, "nystrom") == 0) {
+            spkResult = spkNystrom(points, k, landmarks);
+        } else {
+            if (collapse) {
+                spkResult = spkCollapsed(points, k);
+            } else if (useSubspace) {
+                spkResult = useFloat ? spkSubspaceF(points, k, &subspace) : spkSubspace(points, k, &subspace);
+            } else {
+                spkResult = useFloat ? spkF(points, k) : spk(points, k);
+            }
+        }
+        if (spkResult != NULL) {
+            STATS_BEGIN(STATS_OUTPUT);
+            printIndexes(spkResult->indexes, spkResult->k);
+            printMat(spkResult->centroids);
+            STATS_END(STATS_OUTPUT);
+            freeSpkResult(spkResult);
+        } else {
+            failed = 1;
+        }
     }
 
-    if (strcmp(goal, "gl") == 0) {
-        glMat = gl(headVector, vectorsAmount);
-        printMat(glMat, vectorsAmount, vectorsAmount);
-        freeMat(glMat, vectorsAmount);
+    if (strcmp(goal, "wam") == 0 && useFloat) {
+        resultF = wamF(points);
+        failed = resultF == NULL;
+    } else if (strcmp(goal, "wam") == 0) {
+        result = wam(points);
+        failed = result == NULL;
+    }
+
+    if (strcmp(goal, "ddg") == 0 && compact) {
+        result = useFloat ? degreesF(points) : degrees(points);
+        failed = result == NULL;
+        if (result != NULL) {
+            STATS_BEGIN(STATS_OUTPUT);
+            printColumn(result);
+            STATS_END(STATS_OUTPUT);
+            freeMatrix(result);
+            result = NULL;
+        }
+    } else if (strcmp(goal, "ddg") == 0 && useFloat) {
+        resultF = ddgF(points);
+        failed = resultF == NULL;
+    } else if (strcmp(goal, "ddg") == 0) {
+        result = ddg(points);
+        failed = result == NULL;
+    }
+
+    if (strcmp(goal, "gl") == 0 && useFloat) {
+        resultF = glF(points);
+        failed = resultF == NULL;
+    } else if (strcmp(goal, "gl") == 0) {
+        result = gl(points);
+        failed = result == NULL;
     }
 
     if (strcmp(goal, "jacobi") == 0) {
-        symetricMat = buildSymetricMat(headVector, vectorsAmount);
-        jMat = jacobi(symetricMat, vectorsAmount);
-        printMat(jMat, vectorsAmount + 1, vectorsAmount);
-        freeMat(jMat, vectorsAmount + 1);
+        result = jacobi(points);
+        failed = result == NULL;
     }
 
-    freeVectorsList(headVector);
+    if (result != NULL) {
+        STATS_BEGIN(STATS_OUTPUT);
+        printMat(result);
+        STATS_END(STATS_OUTPUT);
+        freeMatrix(result);
+    }
 
-    return 0;
+    if (resultF != NULL) {
+        STATS_BEGIN(STATS_OUTPUT);
+        printMatF(resultF);
+        STATS_END(STATS_OUTPUT);
+        freeMatrixF(resultF);
+    }
 
-}
\ No newline at end of file
+    freeMatrix(points);
+
+    if (showStats) {
+        printStatsJson(stderr);
+    }
+
+    return failed;
+
+}
+#endif
@@ -1,18 +1,140 @@
 # ifndef SPKMEANS_H_
 # define SPKMEANS_H_
 
-double ** wam(struct vector * headVec, int vectorsAmount);
+#include "matrix.h"
 
-double ** ddg(struct vector * headVec, int vectorsAmount);
+double calcWeightBetweenPoints(const double *p1, const double *p2, int d);
 
-double ** gl(struct vector * headVec, int vectorsAmount);
+struct matrix * wam(struct matrix * points);
 
-double ** buildSymetricMat(struct vector * headVec, int n);
+struct matrix * degrees(struct matrix * points);
 
-double ** jacobi(double ** a, int n);
+struct matrix * ddg(struct matrix * points);
 
-void freeMat(double ** mat, int m);
-void printMat(double ** mat, int m, int n);
+struct matrix * gl(struct matrix * points);
 
+struct matrix * degreesF(struct matrix * points);
 
-#endif
\ No newline at end of file
+struct matrixf * wamF(struct matrix * points);
+
+struct matrixf * ddgF(struct matrix * points);
+
+struct matrixf * glF(struct matrix * points);
+
+struct matrix * vectorsToMatrix(struct vector * headVec, int rows, int cols);
+
+struct matrix * readPoints(char * fileName);
+
+void findPivot(struct matrix * mat, int * pivotIndexes);
+
+double calcOff(struct matrix * mat);
+
+struct matrix * transposeMat(struct matrix * mat);
+
+struct matrix * matrixMultiply(struct matrix * mat1, struct matrix * mat2);
+
+struct matrix * buildPivotMat(struct matrix * mat);
+
+struct matrix * makePivot(struct matrix * p, struct matrix * a);
+
+/* How a Jacobi run ended: the rotations applied, the off-diagonal sum of
+ * squares left and whether the run met its stopping rule before its cap */
+struct jacobiRun {
+    long rotations;
+    double off;
+    int converged;
+};
+
+struct matrix * jacobiRotations(struct matrix * input, double * values);
+
+struct matrix * convergedRotations(struct matrix * input, double * values, struct jacobiRun * run);
+
+struct matrix * jacobi(struct matrix * a);
+
+struct spkResult {
+    int k;
+    int *indexes;
+    int *labels;
+    struct matrix *centroids;
+};
+
+#define EIGEN_SORTED 1
+#define EIGEN_EIGENGAP 2
+
+/* n eigenvalues and the eigenvectors of the first k of them, as columns.
+ * converged is 0 when the solver stopped at its cap short of its tolerance. */
+struct eigen {
+    int n;
+    int k;
+    int converged;
+    double *values;
+    struct matrix *vectors;
+};
+
+int sortEigenValues(double * values, int n, int * order);
+
+int calcK(double * sortedValues, int n);
+
+struct eigen * eigenDecompose(struct matrix * a, int options, int k);
+
+struct eigen * eigenDecomposeFrom(struct matrix * a, struct matrix * basis, int options, int k);
+
+#define WARM_START_SEED 0
+#define WARM_START_ORTHOGONALITY 1e-8
+
+/* One step of compareWarmStart(): rotations, time, off-diagonal sum of
+ * squares left and convergence of the cold and the warm run */
+struct warmStartRun {
+    long coldRotations;
+    long warmRotations;
+    double coldMs;
+    double warmMs;
+    double coldOff;
+    double warmOff;
+    int coldConverged;
+    int warmConverged;
+};
+
+/* Warm started Jacobi against Jacobi from the identity over a sequence of
+ * perturbed matrices: every step in runs, and over the measured steps, those
+ * where both runs converged, the total rotations and time of each and the
+ * largest eigenvalue difference between them */
+struct warmStartQuality {
+    int steps;
+    int measuredSteps;
+    struct warmStartRun *runs;
+    long coldRotations;
+    long warmRotations;
+    double coldMs;
+    double warmMs;
+    double eigenvalueError;
+};
+
+int compareWarmStart(struct matrix * a, int steps, double noise, struct warmStartQuality * quality);
+
+void freeWarmStartQuality(struct warmStartQuality * quality);
+
+double orthogonalityError(struct matrix * basis);
+
+void freeEigen(struct eigen * eigen);
+
+struct spkResult * clusterEmbedding(struct eigen * eigen);
+
+struct spkResult * clusterGroupedEmbedding(struct eigen * eigen, const double * weights, const int * groupOf, int n);
+
+struct spkResult * spk(struct matrix * points, int k);
+
+struct spkResult * spkF(struct matrix * points, int k);
+
+void freeSpkResult(struct spkResult * result);
+
+void printMat(struct matrix * mat);
+
+void printMatF(struct matrixf * mat);
+
+void printColumn(struct matrix * vec);
+
+void printIndexes(int * indexes, int len);
+
+
+#endif
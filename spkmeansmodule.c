@@ -2,319 +2,1659 @@
 #include <Python.h>
 #include "utils.h"
 #include "kmeans.h"
+#include "matrix.h"
 #include "spkmeans.h"
+#include "writer.h"
+#include "cache.h"
+#include "stats.h"
+#include "alloc.h"
+#include "outofcore.h"
+#include "nystrom.h"
+#include "subspace.h"
+#include "dedup.h"
+#include "model.h"
+#include "batch.h"
+#include "coreset.h"
 
 #define SPK_DOC_STRING "Runs the k-means clustering algorithm on the given data points using the provided initial centroids.\n\n"\
                        "The algorithm will run for a maximum of max_iter iterations or until the centroids stop moving more than epsilon distance.\n\n"\
                        "Parameters:\n"\
                        "\tk (int): The number of clusters to create.\n"\
                        "\tcentroids (list): A list of initialized centroids\n"\
-                       "\tdata (list): A list of data points to cluster.\n\n"\
+                       "\tdata (list): A list of data points to cluster.\n"\
+                       "\tdeadline_ms (float): Optional positive wall-clock budget; k-means stops once it is spent.\n"\
+                       "\t                     Raises ValueError for zero, negative or NaN budgets.\n"\
+                       "\tprogress (callable): Optional progress(iteration, max_shift, inertia) called after every\n"\
+                       "\t                     iteration; a true return value stops k-means.\n\n"\
                        "Returns:\n"\
-                       "\tA list of the calculated centroids for the clusters.\n"
+                       "\tA list of the calculated centroids for the clusters. With deadline_ms or progress, a dict\n"\
+                       "\twith the centroids, labels, converged (False when stopped early, with the best centroids\n"\
+                       "\tand labels so far), iterations and inertia.\n"
 
-#define WAM_DOC_STRING "Runs the wam algorithm on the given data points.\n"
+#define PRECISION_DOC_STRING "Parameters:\n"\
+                            "\tprecision (str): \"double\" (default) or \"float\" to compute in single precision,\n"\
+                            "\t                 which gives a float32 Matrix of half the size.\n"
 
-#define DDG_DOC_STRING "Runs the ddg algorithm on the given data points.\n"
+#define WAM_DOC_STRING "Runs the wam algorithm on the given data points.\n\n" PRECISION_DOC_STRING
 
-#define GL_DOC_STRING "Runs the gl algorithm on the given data points.\n"
+#define DDG_DOC_STRING "Runs the ddg algorithm on the given data points.\n\n" PRECISION_DOC_STRING\
+                       "\tcompact (bool): Return only the degrees, as a 1 x n Matrix, instead of the n x n D.\n"\
+                       "\t                They are summed as W is computed, which is never stored.\n"
+
+#define GL_DOC_STRING "Runs the gl algorithm on the given data points.\n\n" PRECISION_DOC_STRING
 
 #define JACOBI_DOC_STRING "Runs the jacobi algorithm on the given data points.\n"
 
-int getK(PyObject *lst) {
-    PyObject *item;
+#define SET_CACHE_DOC_STRING "Configures the on-disk cache of W, degrees, L and eigenpairs used by every goal.\n\n"\
+                             "Overrides SPKMEANS_CACHE_DIR and SPKMEANS_CACHE_MAX_BYTES.\n\n"\
+                             "Parameters:\n"\
+                             "\tdir (str): The cache directory, or None to disable the cache.\n"\
+                             "\tmax_bytes (int): Size bound, least recently used entries are evicted past it.\n"
+
+#define SET_OUT_OF_CORE_DOC_STRING "Switches wam, ddg and gl to out-of-core mode: W and L are computed in tiles\n"\
+                                   "into memory-mapped scratch files, so n x n results need not fit in RAM.\n\n"\
+                                   "Overrides SPKMEANS_SCRATCH_DIR.\n\n"\
+                                   "Parameters:\n"\
+                                   "\tdir (str): The directory for the scratch files, or None to compute in memory.\n"
+
+#define SET_CORESET_DOC_STRING "Runs the k-means stage of spk, pipeline and fit on a sensitivity sampled weighted\n"\
+                           "coreset of the rows of U, followed by one assignment pass over all of them.\n\n"\
+                           "Overrides SPKMEANS_CORESET.\n\n"\
+                           "Parameters:\n"\
+                           "\tsize (int): The number of rows to sample, or 0 to run k-means on all of them.\n"
+
+#define CORESET_QUALITY_DOC_STRING "Compares coreset k-means against full k-means on the embedding U of the data,\n"\
+                                   "both started from the same k-means++ seeds.\n\n"\
+                                   "Parameters:\n"\
+                                   "\tk (int): The number of clusters, or 0/None to pick it by the eigengap heuristic.\n"\
+                                   "\tm (int): The coreset size, or 0/None for the default.\n"\
+                                   "\tdata (list): A list of data points to cluster.\n\n"\
+                                   "Returns:\n"\
+                                   "\tA dict with k, size, coreset_cost and full_cost (sums of squared distances of\n"\
+                                   "\tevery row of U to its closest centroid), cost_ratio (coreset over full),\n"\
+                                   "\tadjusted_rand (label agreement), coreset_ms and full_ms.\n"
+
+#define WRITE_MATRIX_DOC_STRING "Writes a Matrix as %.4f comma separated rows straight to a file descriptor.\n\n"\
+                                "Parameters:\n"\
+                                "\tmatrix (Matrix): The matrix to write.\n"\
+                                "\tfd (int): The file descriptor to write to (default 1, stdout).\n"\
+                                "\t          Flush any Python-side buffering of that descriptor first.\n"
+
+#define EIGEN_DOC_STRING "Eigendecomposition of a symmetric matrix by Jacobi rotations.\n\n"\
+                         "Parameters:\n"\
+                         "\tmatrix (list): A list holding the matrix (list of rows, Matrix or 2-d buffer).\n"\
+                         "\tsort (bool): Return the eigenpairs in increasing eigenvalue order (default True).\n"\
+                         "\tk (int): Keep only the first k eigenvectors, 0 picks k by the eigengap heuristic,\n"\
+                         "\t         None keeps all of them (default).\n"\
+                         "\tbasis (Matrix): Optional n x n orthogonal matrix to warm start from, such as the\n"\
+                         "\t                eigenvectors of a nearby matrix (k=None); Jacobi then continues from\n"\
+                         "\t                basis^T A basis and the eigenvectors are composed with it. Raises\n"\
+                         "\t                ValueError when basis^T basis is further than 1e-8 from I.\n\n"\
+                         "Returns:\n"\
+                         "\tA tuple of the eigenvalues list and an n x k Matrix whose columns are the eigenvectors.\n"
+
+#define WARM_START_QUALITY_DOC_STRING "Compares warm started Jacobi against Jacobi from the identity over a sequence of\n"\
+                                      "perturbed matrices, each one warm started from the eigenvectors of the one before.\n\n"\
+                                      "Parameters:\n"\
+                                      "\tmatrix (list): A list holding the first symmetric matrix.\n"\
+                                      "\tsteps (int): The number of perturbed matrices that follow it (default 5).\n"\
+                                      "\tnoise (float): The perturbation of every entry is uniform in [-noise, noise]\n"\
+                                      "\t               (default 1e-3).\n\n"\
+                                      "Returns:\n"\
+                                      "\tA dict with steps, runs (per step rotations, ms, final off-diagonal sum of squares\n"\
+                                      "\tand converged flag of the cold and warm run), measured_steps (steps where both\n"\
+                                      "\tconverged), and over the measured steps only cold_rotations and warm_rotations,\n"\
+                                      "\tcold_ms and warm_ms (totals), speedup (None when no step was measured) and\n"\
+                                      "\teigenvalue_error (the largest difference between the sorted eigenvalues of the two).\n"
+
+#define PIPELINE_DOC_STRING "Runs the full spectral clustering flow natively: L, its eigendecomposition,\n"\
+                            "the eigengap heuristic, U and k-means++ seeded k-means on the rows of U.\n\n"\
+                            "Parameters:\n"\
+                            "\tk (int): The number of clusters, or 0/None to pick it by the eigengap heuristic.\n"\
+                            "\tdata (list): A list of data points to cluster.\n"\
+                            "\tsolver (str): \"jacobi\" (default), \"subspace\" for randomized subspace iteration or\n"\
+                            "\t              \"matrixfree\" for subspace iteration on products that recompute W from\n"\
+                            "\t              the points instead of storing L.\n"\
+                            "\toperator_cache (int): Bytes of W rows the matrix-free solver may keep (default 0).\n"\
+                            "\toversampling (int): Extra block columns of the subspace solver (default 10).\n"\
+                            "\titerations (int): Subspace iterations (default 20).\n"\
+                            "\tprecision (str): \"double\" (default) or \"float\" to build L in single precision.\n"\
+                            "\tcollapse (bool): Collapse exact duplicate points into weighted ones first (default False).\n"\
+                            "\t                 The reduced problem always runs with Jacobi in double precision.\n\n"\
+                            "Returns:\n"\
+                            "\tA tuple of the initial centroid indexes and a Matrix of the final centroids.\n"
+
+#define BATCH_DOC_STRING "Clusters many small independent datasets in one call, spread over the threads.\n\n"\
+                         "Parameters:\n"\
+                         "\toffsets (list): count + 1 row offsets; problem i is rows offsets[i] to offsets[i + 1] of data.\n"\
+                         "\tdata (list or Matrix): All the problems' points packed one after another.\n"\
+                         "\tks (list): The number of clusters of each problem, 0 picks it by the eigengap\n"\
+                         "\t           heuristic (default None, every problem picks its own).\n\n"\
+                         "Returns:\n"\
+                         "\tA dict of packed results: k and status (0 on success) per problem, labels per row\n"\
+                         "\t(-1 in failed problems), indexes and centroid_offsets, centroids and centroid_values\n"\
+                         "\t(problem i's k x k centroids start at centroids[centroid_values[i]]), elapsed_ms and\n"\
+                         "\tproblems_per_second.\n"
+
+#define FIT_DOC_STRING "Fits a spectral clustering model that can label new points without a refit.\n\n"\
+                       "Parameters:\n"\
+                       "\tk (int): The number of clusters, or 0/None to pick it by the eigengap heuristic.\n"\
+                       "\tdata (list): A list of training points (list of rows, Matrix or 2-d buffer).\n\n"\
+                       "Returns:\n"\
+                       "\tA Model holding the training points, degrees, eigenpairs and centroids.\n"
+
+#define MODEL_DOC_STRING "Spectral clustering model returned by fit().\n\n"\
+                         "New points are embedded by the Nystrom extension of the fitted eigenvectors,\n"\
+                         "u(x) = sum_j W(x, x_j) u_j / (d(x) - lambda), and take the nearest centroid,\n"\
+                         "in O(n d) per point.\n"
+
+#define STATS_DOC_STRING "Returns the timers and counters collected by the last wam, ddg, gl, jacobi, spk,\n"\
+                         "eigen or pipeline call.\n\n"\
+                         "Returns:\n"\
+                         "\tA dict with stages_ms (per stage milliseconds), kernel_evaluations, jacobi_rotations,\n"\
+                         "\tfinal_off, kmeans_iterations and reassignments (points that changed cluster per\n"\
+                         "\titeration), plus memory as returned by memory(). kernel_evaluations counts the\n"\
+                         "\tGaussian weights actually computed, so it depends on the path: in-core wam evaluates\n"\
+                         "\teach pair once, the tiled, streamed and matrix-free paths every off-diagonal entry.\n"\
+                         "\tenabled is False when the module was built without SPKMEANS_STATS.\n"
+
+#define MEMORY_DOC_STRING "Returns the C-side allocation accounting.\n\n"\
+                          "Returns:\n"\
+                          "\tA dict with the budget and, for the total and every subsystem (parse, affinity,\n"\
+                          "\teigen, kmeans, output, module), a dict of in_use and peak bytes and the number of\n"\
+                          "\tallocations and frees. Peaks restart with every wam, ddg, gl, jacobi, spk, eigen\n"\
+                          "\tor pipeline call.\n"
+
+#define SET_MEMORY_BUDGET_DOC_STRING "Caps the bytes the C core may have allocated at once; allocations past it fail.\n\n"\
+                                     "Overrides SPKMEANS_MEMORY_BUDGET. wam, ddg, gl and jacobi raise MemoryError\n"\
+                                     "with the failed request when they run past it.\n\n"\
+                                     "Parameters:\n"\
+                                     "\tbytes (int): The budget, 0 for unlimited.\n"
+
+#define NYSTROM_DOC_STRING "Runs the spectral clustering flow on a Nystrom approximation of the embedding:\n"\
+                           "m landmarks are sampled, their m x m Laplacian is decomposed by Jacobi rotations\n"\
+                           "and the eigenvectors are extended to all points, in O(n m d + m^3).\n\n"\
+                           "Parameters:\n"\
+                           "\tk (int): The number of clusters, or 0/None to pick it by the eigengap heuristic.\n"\
+                           "\tm (int): The number of landmarks, or 0/None for the default.\n"\
+                           "\tdata (list): A list of data points to cluster.\n\n"\
+                           "Raises ValueError when k exceeds the landmark count.\n\n"\
+                           "Returns:\n"\
+                           "\tA tuple of the initial centroid indexes and a Matrix of the final centroids.\n"
+
+#define NYSTROM_QUALITY_DOC_STRING "Compares the Nystrom flow against the exact gl + jacobi one on the same data.\n\n"\
+                                   "Parameters:\n"\
+                                   "\tk (int): The number of clusters, or 0/None to pick it by the exact eigengap.\n"\
+                                   "\tm (int): The number of landmarks, or 0/None for the default.\n"\
+                                   "\tdata (list): A list of data points to cluster.\n\n"\
+                                   "Raises ValueError when k exceeds the landmark count.\n\n"\
+                                   "Returns:\n"\
+                                   "\tA dict with k, landmarks, adjusted_rand (label agreement, 1 is identical),\n"\
+                                   "\teigenvalue_error (relative L1 error of the first k eigenvalues), exact_ms,\n"\
+                                   "\tnystrom_ms, and exact_converged and landmark_converged telling whether the\n"\
+                                   "\texact and landmark eigensolves reached their tolerance.\n"
+
+#define MATRIX_DOC_STRING "Contiguous row-major matrix returned by wam, ddg, gl and jacobi.\n\n"\
+                          "Supports the buffer protocol, so numpy.asarray() views it without copying,\n"\
+                          "and can be passed back to jacobi as-is. Single precision results hold float32.\n"
+
+/* Matrix results are handed to Python as-is: the object owns the C matrix and
+ * exposes its rows through the buffer protocol, so numpy.asarray() or
+ * memoryview() can read it without copying. Exactly one of mat and matf is
+ * set, matf for single precision results. */
+typedef struct {
+    PyObject_HEAD
+    struct matrix *mat;
+    struct matrixf *matf;
+    Py_ssize_t shape[2];
+    Py_ssize_t strides[2];
+} MatrixObject;
+
+static void Matrix_dealloc(MatrixObject *self) {
+    freeMatrix(self->mat);
+    freeMatrixF(self->matf);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static int Matrix_getbuffer(MatrixObject *self, Py_buffer *view, int flags) {
+    Py_ssize_t itemsize = self->strides[1];
+    int padded = self->mat != NULL ? self->mat->stride != self->mat->cols : self->matf->stride != self->matf->cols;
+
+    if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && padded && self->shape[0] > 1) {
+        PyErr_SetString(PyExc_BufferError, "matrix rows are padded, a strided buffer is required");
+        return -1;
+    }
+
+    view->obj = (PyObject *) self;
+    view->buf = self->mat != NULL ? (void *) self->mat->data : (void *) self->matf->data;
+    view->len = self->shape[0] * self->shape[1] * itemsize;
+    view->readonly = 0;
+    view->itemsize = itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (self->mat != NULL ? "d" : "f") : NULL;
+    view->ndim = 2;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+
+    Py_INCREF(self);
+    return 0;
+}
+
+static PyObject * matrixToList(struct matrix *mat) {
+    PyObject *lst, *row;
+    int i, j;
+
+    lst = PyList_New(mat->rows);
+    if (lst == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < mat->rows; i++) {
+        row = PyList_New(mat->cols);
+        if (row == NULL) {
+            Py_DECREF(lst);
+            return NULL;
+        }
+
+        for (j = 0; j < mat->cols; j++) {
+            PyList_SET_ITEM(row, j, PyFloat_FromDouble(MAT(mat, i, j)));
+        }
+
+        PyList_SET_ITEM(lst, i, row);
+    }
+
+    return lst;
+}
+
+static PyObject * Matrix_tolist(MatrixObject *self, PyObject *Py_UNUSED(ignored)) {
+    struct matrix *mat;
+    PyObject *lst;
+
+    if (self->mat != NULL) {
+        return matrixToList(self->mat);
+    }
+
+    mat = matrixToDouble(self->matf);
+    if (mat == NULL) {
+        return PyErr_NoMemory();
+    }
+
+    lst = matrixToList(mat);
+    freeMatrix(mat);
+    return lst;
+}
+
+static PyObject * Matrix_getshape(MatrixObject *self, void *Py_UNUSED(closure)) {
+    return Py_BuildValue("(nn)", self->shape[0], self->shape[1]);
+}
+
+static PyBufferProcs Matrix_as_buffer = {
+    (getbufferproc) Matrix_getbuffer,
+    NULL
+};
+
+static PyMethodDef Matrix_methods[] = {
+    {"tolist", (PyCFunction) Matrix_tolist, METH_NOARGS, "Returns the matrix as a list of rows.\n"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Matrix_getset[] = {
+    {"shape", (getter) Matrix_getshape, NULL, "(rows, cols) of the matrix.\n", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject MatrixType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mykmeanssp.Matrix",
+    .tp_basicsize = sizeof(MatrixObject),
+    .tp_dealloc = (destructor) Matrix_dealloc,
+    .tp_as_buffer = &Matrix_as_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = MATRIX_DOC_STRING,
+    .tp_methods = Matrix_methods,
+    .tp_getset = Matrix_getset,
+};
+
+static PyObject * wrapMatrix(struct matrix *mat) {
+    MatrixObject *obj;
+
+    if (mat == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    obj = PyObject_New(MatrixObject, &MatrixType);
+    if (obj == NULL) {
+        freeMatrix(mat);
+        return NULL;
+    }
+
+    obj->mat = mat;
+    obj->matf = NULL;
+    obj->shape[0] = mat->rows;
+    obj->shape[1] = mat->cols;
+    obj->strides[0] = (Py_ssize_t) mat->stride * sizeof(double);
+    obj->strides[1] = sizeof(double);
 
-    item = PyList_GetItem(lst, 0);
-    return (int) PyLong_AsLong(item);
+    return (PyObject *) obj;
 }
 
-void extractVectorsArray(int numOfVectors, int vectorLength, double vectorsArray[numOfVectors][vectorLength], PyObject *vectors) {
+static PyObject * wrapMatrixF(struct matrixf *mat) {
+    MatrixObject *obj;
+
+    if (mat == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    obj = PyObject_New(MatrixObject, &MatrixType);
+    if (obj == NULL) {
+        freeMatrixF(mat);
+        return NULL;
+    }
+
+    obj->mat = NULL;
+    obj->matf = mat;
+    obj->shape[0] = mat->rows;
+    obj->shape[1] = mat->cols;
+    obj->strides[0] = (Py_ssize_t) mat->stride * sizeof(float);
+    obj->strides[1] = sizeof(float);
+
+    return (PyObject *) obj;
+}
+
+static struct matrix * matrixFromBuffer(PyObject *obj) {
+    Py_buffer view;
+    struct matrix *mat;
     int i, j;
-    double cord;
-    PyObject *item, *vector;
+    char *row;
+
+    if (PyObject_GetBuffer(obj, &view, PyBUF_RECORDS_RO) < 0) {
+        return NULL;
+    }
 
-    for (i = 0; i < numOfVectors; i++) {
-        vector = PyList_GetItem(vectors, i);
+    if (view.ndim != 2 || view.itemsize != sizeof(double) || (view.format != NULL && strcmp(view.format, "d") != 0)) {
+        PyBuffer_Release(&view);
+        PyErr_SetString(PyExc_TypeError, "expected a 2-d buffer of doubles");
+        return NULL;
+    }
+
+    mat = allocMatrix((int) view.shape[0], (int) view.shape[1]);
+    if (mat != NULL) {
+        for (i = 0; i < mat->rows; i++) {
+            row = (char *) view.buf + i * view.strides[0];
+            for (j = 0; j < mat->cols; j++) {
+                MAT(mat, i, j) = *(double *) (row + j * view.strides[1]);
+            }
+        }
+    }
+
+    PyBuffer_Release(&view);
+    return mat;
+}
+
+static struct matrix * matrixFromList(PyObject *points) {
+    PyObject *point;
+    struct matrix *mat;
+    int numOfPoints, vectorLength, i, j;
+
+    numOfPoints = PyObject_Length(points);
+    point = PyList_GetItem(points, 0);
+    if (point == NULL) {
+        return NULL;
+    }
+
+    vectorLength = PyObject_Length(point);
+
+    mat = allocMatrix(numOfPoints, vectorLength);
+    if (mat == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < numOfPoints; i++) {
+        point = PyList_GetItem(points, i);
 
         for (j = 0; j < vectorLength; j++) {
-            item = PyList_GetItem(vector, j);
-            cord = PyFloat_AsDouble(item);
-            vectorsArray[i][j] = cord;
+            MAT(mat, i, j) = PyFloat_AsDouble(PyList_GetItem(point, j));
         }
     }
+
+    return mat;
+}
+
+/* Returns the matrix held by obj. A Matrix produced by an earlier call is
+ * used in place (*owned is set to 0); lists, other buffers and single
+ * precision Matrix objects are copied once. */
+static struct matrix * matrixFromPyObject(PyObject *obj, int *owned) {
+    *owned = 1;
+    if (PyObject_TypeCheck(obj, &MatrixType) && ((MatrixObject *) obj)->mat == NULL) {
+        return matrixToDouble(((MatrixObject *) obj)->matf);
+    }
+
+    if (PyObject_TypeCheck(obj, &MatrixType)) {
+        *owned = 0;
+        return ((MatrixObject *) obj)->mat;
+    }
+
+    if (PyObject_CheckBuffer(obj)) {
+        return matrixFromBuffer(obj);
+    }
+
+    return matrixFromList(obj);
 }
 
-static PyObject* cKmeans(PyObject *self, PyObject *args) {
-    PyObject *lst, *centroid, *centroids, *points, *centroidsList, *centroidCords, *listCord;
-    int n, k, maxIter, vectorLength, numOfPoints, i=0, j=0;
-    double epsilon;
-    struct vector *headCentroid, *currCentroid;
-    struct cord *currCord;
+static struct matrix * getMatrixFromPyObject(PyObject *lst, int lstIndex, int *owned) {
+    PyObject *obj;
+
+    obj = PyList_GetItem(lst, lstIndex);
+    if (obj == NULL) {
+        return NULL;
+    }
+
+    return matrixFromPyObject(obj, owned);
+}
+
+/* Installed while a goal runs, whose failure is reported once it returns */
+static void deferError(void) {
+}
+
+/* Reports the failure of a goal run under deferError(): MemoryError with
+ * the allocator's message when an allocation failed, the budget included,
+ * the usual message otherwise */
+static PyObject * goalFailed(void) {
+    if (memLastFailure()->kind != MEM_FAILURE_NONE) {
+        PyErr_SetString(PyExc_MemoryError, memLastFailure()->message);
+        return NULL;
+    }
+
+    printErrorMessage();
+    return NULL;
+}
+
+/* Runs goal, or goalF when it is given, on the points at lst[0] */
+static PyObject * applyGoal(PyObject *lst, struct matrix * (*goal)(struct matrix *),
+                            struct matrixf * (*goalF)(struct matrix *)) {
+    struct matrix *points, *result = NULL;
+    struct matrixf *resultF = NULL;
+    errorHandler previous;
+    int n, owned;
+
+    n = PyObject_Length(lst);
+
+    if (n < 0) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    memClearFailure();
+    previous = setErrorHandler(deferError);
+    points = getMatrixFromPyObject(lst, 0, &owned);
+    if (points == NULL) {
+        setErrorHandler(previous);
+        return goalFailed();
+    }
+
+    statsReset();
+    if (goalF != NULL) {
+        resultF = goalF(points);
+    } else {
+        result = goal(points);
+    }
+    setErrorHandler(previous);
+
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    if (result == NULL && resultF == NULL) {
+        return goalFailed();
+    }
+
+    return goalF != NULL ? wrapMatrixF(resultF) : wrapMatrix(result);
+}
+
+static PyObject * runGoal(PyObject *args, struct matrix * (*goal)(struct matrix *)) {
+    PyObject *lst;
 
     if(!PyArg_ParseTuple(args, "O", &lst)) {
         printErrorMessage();
         return NULL;
     }
 
+    return applyGoal(lst, goal, NULL);
+}
+
+/* runGoal with a precision keyword, "float" runs goalF instead of goal */
+static PyObject * runPrecisionGoal(PyObject *args, PyObject *kwargs, struct matrix * (*goal)(struct matrix *),
+                                   struct matrixf * (*goalF)(struct matrix *)) {
+    static char *keywords[] = {"", "precision", NULL};
+    PyObject *lst;
+    const char *precision = "double";
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|s", keywords, &lst, &precision)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    if (strcmp(precision, "float") != 0 && strcmp(precision, "double") != 0) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    return applyGoal(lst, goal, strcmp(precision, "float") == 0 ? goalF : NULL);
+}
+
+static PyObject * cWam(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return runPrecisionGoal(args, kwargs, wam, wamF);
+}
+
+static PyObject * cDdg(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"", "precision", "compact", NULL};
+    PyObject *lst;
+    const char *precision = "double";
+    int compact = 0, useFloat;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|sp", keywords, &lst, &precision, &compact)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    if (strcmp(precision, "float") != 0 && strcmp(precision, "double") != 0) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    useFloat = strcmp(precision, "float") == 0;
+    if (compact) {
+        return applyGoal(lst, useFloat ? degreesF : degrees, NULL);
+    }
+
+    return applyGoal(lst, ddg, useFloat ? ddgF : NULL);
+}
+
+static PyObject * cGl(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return runPrecisionGoal(args, kwargs, gl, glF);
+}
+
+static PyObject * cJacobi(PyObject *self, PyObject *args) {
+    return runGoal(args, jacobi);
+}
+
+/* kmeansProgress for a Python callable; an exception also stops k-means and
+ * is raised once it returns */
+static int callProgress(void *ctx, int iteration, double maxShift, double inertia) {
+    PyObject *stop = PyObject_CallFunction((PyObject *) ctx, "idd", iteration, maxShift, inertia);
+    int truth = stop == NULL ? 1 : PyObject_IsTrue(stop);
+
+    Py_XDECREF(stop);
+    return truth != 0;
+}
+
+static PyObject * labelsToList(const int *labels, int n) {
+    PyObject *lst;
+    int i;
+
+    lst = PyList_New(n);
+    for (i = 0; lst != NULL && i < n; i++) {
+        PyList_SET_ITEM(lst, i, PyLong_FromLong(labels[i]));
+    }
+
+    return lst;
+}
+
+static PyObject * anytimeResultToDict(struct matrix *centroids, int *labels, int n,
+                                      struct kmeansControl *control) {
+    return Py_BuildValue("{s:N,s:N,s:O,s:i,s:d}",
+                         "centroids", matrixToList(centroids),
+                         "labels", labelsToList(labels, n),
+                         "converged", control->converged ? Py_True : Py_False,
+                         "iterations", control->iterations,
+                         "inertia", control->inertia);
+}
+
+static PyObject* cKmeans(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"", "deadline_ms", "progress", NULL};
+    PyObject *lst, *centroidsList, *deadlineObj = Py_None, *progress = Py_None;
+    struct kmeansControl control;
+    struct matrix *centroids, *points;
+    double deadlineMs = 0;
+    int *labels = NULL;
+    int n, ownedCentroids = 0, ownedPoints = 0, failed;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO", keywords, &lst, &deadlineObj, &progress)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    /* a budget that is already spent is a caller error, not "no deadline" */
+    if (deadlineObj != Py_None) {
+        deadlineMs = PyFloat_AsDouble(deadlineObj);
+        if (!(deadlineMs > 0) && PyErr_Occurred() == NULL) {
+            PyErr_SetString(PyExc_ValueError, "deadline_ms must be positive");
+        }
+        if (PyErr_Occurred() != NULL) {
+            printErrorMessage();
+            return NULL;
+        }
+    }
+
+    if (progress != Py_None && !PyCallable_Check(progress)) {
+        printErrorMessage();
+        return NULL;
+    }
+
     n = PyObject_Length(lst);
     if (n < 0) {
         printErrorMessage();
         return NULL;
     }
 
-    k = getK(lst);
-    maxIter = 300;
-    epsilon = 0;
+    centroids = getMatrixFromPyObject(lst, 1, &ownedCentroids);
+    points = getMatrixFromPyObject(lst, 2, &ownedPoints);
+    if (centroids == NULL || points == NULL) {
+        printErrorMessage();
+        if (ownedCentroids) {
+            freeMatrix(centroids);
+        }
+        return NULL;
+    }
 
-    centroids = PyList_GetItem(lst, 1);
-    centroid = PyList_GetItem(centroids, 0);
-    vectorLength = PyObject_Length(centroid);
+    /* the centroids are updated in place, so never run on a caller's Matrix */
+    if (!ownedCentroids) {
+        centroids = copyMatrix(centroids);
+    }
 
-    double centroidsArray[k][vectorLength];
-    extractVectorsArray(k, vectorLength, centroidsArray, centroids);
+    statsReset();
+    if (deadlineObj == Py_None && progress == Py_None) {
+        failed = centroids == NULL || kmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, points, centroids, NULL) != 0;
+    } else {
+        memset(&control, 0, sizeof(struct kmeansControl));
+        control.deadlineMs = deadlineMs;
+        control.progress = progress != Py_None ? callProgress : NULL;
+        control.ctx = progress;
+        labels = memAlloc(points->rows * sizeof(int));
+        failed = centroids == NULL || labels == NULL ||
+                 anytimeKmeans(KMEANS_MAX_ITER, KMEANS_EPSILON, points, NULL, centroids, labels, &control) != 0 ||
+                 PyErr_Occurred() != NULL;
+    }
 
-    points = PyList_GetItem(lst, 2);
-    numOfPoints = PyObject_Length(points);
+    n = points->rows;
+    if (ownedPoints) {
+        freeMatrix(points);
+    }
 
-    double pointsArray[numOfPoints][vectorLength];
-    extractVectorsArray(numOfPoints, vectorLength, pointsArray, points);
+    if (failed) {
+        freeMatrix(centroids);
+        memFree(labels);
+        return NULL;
+    }
 
-    headCentroid = kmeans(k, maxIter, epsilon, vectorLength, numOfPoints, pointsArray, centroidsArray);
+    centroidsList = labels == NULL ? matrixToList(centroids) : anytimeResultToDict(centroids, labels, n, &control);
+    freeMatrix(centroids);
+    memFree(labels);
 
-    centroidsList = PyList_New(k);
-    currCentroid = headCentroid;
+    return centroidsList;
+}
 
-    while(currCentroid != NULL) {
-        j=0;
-        centroidCords = PyList_New(vectorLength);
-        currCord = currCentroid->cords;
-        PyList_SetItem(centroidsList, i, centroidCords);
+static PyObject * cSetCache(PyObject *self, PyObject *args) {
+    const char *dir = NULL;
+    Py_ssize_t maxBytes = 0;
 
-        while (currCord != NULL) {
-            listCord = Py_BuildValue("d", currCord->value);
-            PyList_SetItem(centroidCords, j, listCord);
-            currCord = currCord->next;
-            j++;
+    if(!PyArg_ParseTuple(args, "z|n", &dir, &maxBytes)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    setCacheConfig(dir, maxBytes > 0 ? (size_t) maxBytes : 0);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * cSetOutOfCore(PyObject *self, PyObject *args) {
+    const char *dir = NULL;
+
+    if(!PyArg_ParseTuple(args, "z", &dir)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    setOutOfCore(dir);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * cSetCoreset(PyObject *self, PyObject *args) {
+    int size;
+
+    if(!PyArg_ParseTuple(args, "i", &size)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    setCoresetSize(size);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject * cWriteMatrix(PyObject *self, PyObject *args) {
+    PyObject *obj;
+    struct matrix *mat;
+    struct matrixf *matf;
+    int fd = WRITER_STDOUT, failed;
+
+    if(!PyArg_ParseTuple(args, "O!|i", &MatrixType, &obj, &fd)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    mat = ((MatrixObject *) obj)->mat;
+    matf = ((MatrixObject *) obj)->matf;
+
+    Py_BEGIN_ALLOW_THREADS
+    failed = mat != NULL ? writeMatrix(fd, mat) : writeMatrixF(fd, matf);
+    Py_END_ALLOW_THREADS
+
+    if (failed) {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* A fitted model, owned by the object */
+typedef struct {
+    PyObject_HEAD
+    struct spkModel *model;
+} ModelObject;
+
+static void Model_dealloc(ModelObject *self) {
+    freeModel(self->model);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject * doublesToList(const double *values, int n) {
+    PyObject *lst;
+    int i;
+
+    lst = PyList_New(n);
+    for (i = 0; lst != NULL && i < n; i++) {
+        PyList_SET_ITEM(lst, i, PyFloat_FromDouble(values[i]));
+    }
+
+    return lst;
+}
+
+/* Labels of the points in data, through predictModel() or, when fit is set,
+ * partialFitModel() */
+static PyObject * modelLabels(ModelObject *self, PyObject *args, int fit) {
+    PyObject *obj, *lst;
+    struct matrix *points;
+    int *labels;
+    int owned, failed;
+
+    if(!PyArg_ParseTuple(args, "O", &obj)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    points = matrixFromPyObject(obj, &owned);
+    if (points == NULL || points->cols != self->model->points->cols) {
+        printErrorMessage();
+        if (owned) {
+            freeMatrix(points);
         }
+        return NULL;
+    }
 
-        currCentroid = currCentroid->next;
-        i++;
+    labels = memAlloc(points->rows * sizeof(int));
+    if (labels == NULL) {
+        printErrorMessage();
+        if (owned) {
+            freeMatrix(points);
+        }
+        return NULL;
     }
 
-    freeVectorsList(headCentroid);
-    
-    return centroidsList;
+    statsReset();
+    failed = fit ? partialFitModel(self->model, points, labels) : predictModel(self->model, points, labels);
+    lst = failed ? NULL : labelsToList(labels, points->rows);
+    memFree(labels);
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    if (failed) {
+        printErrorMessage();
+    }
+
+    return lst;
 }
 
+static PyObject * Model_predict(ModelObject *self, PyObject *args) {
+    return modelLabels(self, args, 0);
+}
 
-static struct vector* getVectorFromPyObject(PyObject *lst, int lstIndex) {
-    PyObject *points, *point;
-    int numOfPoints, vectorLength;
+static PyObject * Model_partial_fit(ModelObject *self, PyObject *args) {
+    return modelLabels(self, args, 1);
+}
 
-    points = PyList_GetItem(lst, lstIndex);
-    numOfPoints = PyObject_Length(points);
+static PyObject * Model_embed(ModelObject *self, PyObject *args) {
+    PyObject *obj;
+    struct matrix *points, *embedding;
+    int owned;
 
-    point = PyList_GetItem(points, 0);
-    vectorLength = PyObject_Length(point);
+    if(!PyArg_ParseTuple(args, "O", &obj)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    points = matrixFromPyObject(obj, &owned);
+    if (points == NULL || points->cols != self->model->points->cols) {
+        printErrorMessage();
+        if (owned) {
+            freeMatrix(points);
+        }
+        return NULL;
+    }
+
+    statsReset();
+    embedding = embedPoints(self->model, points);
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    return wrapMatrix(embedding);
+}
 
-    double pointsArray[numOfPoints][vectorLength];
+static PyObject * Model_getk(ModelObject *self, void *Py_UNUSED(closure)) {
+    return PyLong_FromLong(self->model->k);
+}
 
-    extractVectorsArray(numOfPoints, vectorLength, pointsArray, points);
+static PyObject * Model_getn(ModelObject *self, void *Py_UNUSED(closure)) {
+    return PyLong_FromLong(self->model->points->rows);
+}
 
-    return extractVectorsListFromArray(numOfPoints, vectorLength, pointsArray);
+static PyObject * Model_getlabels(ModelObject *self, void *Py_UNUSED(closure)) {
+    return labelsToList(self->model->labels, self->model->points->rows);
 }
 
+static PyObject * Model_getdegrees(ModelObject *self, void *Py_UNUSED(closure)) {
+    return doublesToList(self->model->degrees, self->model->points->rows);
+}
 
-static PyObject * cWam(PyObject *self, PyObject *args) {
-    PyObject *lst, *points, *wMatPython, *row, *listVal;
-    double **wMat;
-    struct vector *headVector;
-    int n, numOfPoints, i, j;
+static PyObject * Model_geteigenvalues(ModelObject *self, void *Py_UNUSED(closure)) {
+    return doublesToList(self->model->values, self->model->k);
+}
 
-    if(!PyArg_ParseTuple(args, "O", &lst)) {
+static PyObject * Model_getcentroids(ModelObject *self, void *Py_UNUSED(closure)) {
+    return wrapMatrix(copyMatrix(self->model->centroids));
+}
+
+static PyMethodDef Model_methods[] = {
+    {"predict", (PyCFunction) Model_predict, METH_VARARGS,
+     "Returns the cluster of every point in data, leaving the model unchanged.\n"},
+    {"partial_fit", (PyCFunction) Model_partial_fit, METH_VARARGS,
+     "Adds the points in data to the model and returns their clusters. Degrees and\n"
+     "centroids are updated incrementally, the eigenpairs are kept from the fit.\n"},
+    {"embed", (PyCFunction) Model_embed, METH_VARARGS,
+     "Returns the Nystrom embedding of the points in data as a Matrix.\n"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef Model_getset[] = {
+    {"k", (getter) Model_getk, NULL, "Number of clusters.\n", NULL},
+    {"n", (getter) Model_getn, NULL, "Number of points the model holds.\n", NULL},
+    {"labels", (getter) Model_getlabels, NULL, "Cluster of every point the model holds.\n", NULL},
+    {"degrees", (getter) Model_getdegrees, NULL, "Degree of every point the model holds.\n", NULL},
+    {"eigenvalues", (getter) Model_geteigenvalues, NULL, "The k smallest eigenvalues of L.\n", NULL},
+    {"centroids", (getter) Model_getcentroids, NULL, "Copy of the centroids in embedding space.\n", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject ModelType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "mykmeanssp.Model",
+    .tp_basicsize = sizeof(ModelObject),
+    .tp_dealloc = (destructor) Model_dealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = MODEL_DOC_STRING,
+    .tp_methods = Model_methods,
+    .tp_getset = Model_getset,
+};
+
+static PyObject * cFit(PyObject *self, PyObject *args) {
+    PyObject *lst, *kObj;
+    ModelObject *obj;
+    struct matrix *points;
+    struct spkModel *model;
+    int k = 0, owned = 0;
+
+    if(!PyArg_ParseTuple(args, "O", &lst) || PyObject_Length(lst) < 2) {
         printErrorMessage();
         return NULL;
     }
 
-    n = PyObject_Length(lst);
+    kObj = PyList_GetItem(lst, 0);
+    if (kObj != NULL && kObj != Py_None) {
+        k = (int) PyLong_AsLong(kObj);
+    }
 
-    if (n < 0) {
+    points = getMatrixFromPyObject(lst, 1, &owned);
+    if (points == NULL || k < 0 || k > points->rows) {
         printErrorMessage();
+        if (owned) {
+            freeMatrix(points);
+        }
         return NULL;
     }
 
-    points = PyList_GetItem(lst, 0);
-    numOfPoints = PyObject_Length(points);
+    statsReset();
+    model = fitModel(points, k);
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    if (model == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    obj = PyObject_New(ModelObject, &ModelType);
+    if (obj == NULL) {
+        freeModel(model);
+        return NULL;
+    }
+
+    obj->model = model;
+    return (PyObject *) obj;
+}
+
+static PyObject * cEigen(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"", "sort", "k", "basis", NULL};
+    PyObject *lst, *kObj = Py_None, *basisObj = Py_None, *values, *vectors;
+    struct matrix *a, *basis = NULL;
+    struct eigen *eigen;
+    int sort = 1, k = 0, options, owned = 0, ownedBasis = 0, i;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pOO", keywords, &lst, &sort, &kObj, &basisObj)) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    options = sort ? EIGEN_SORTED : 0;
+    if (kObj != Py_None) {
+        k = (int) PyLong_AsLong(kObj);
+        if (k == 0) {
+            options |= EIGEN_EIGENGAP;
+        }
+    }
 
-    headVector = getVectorFromPyObject(lst, 0);
-    wMat = wam(headVector, numOfPoints);
-    wMatPython = PyList_New(numOfPoints);
+    a = getMatrixFromPyObject(lst, 0, &owned);
+    if (basisObj != Py_None) {
+        basis = matrixFromPyObject(basisObj, &ownedBasis);
+    }
 
-    for (i=0; i < numOfPoints; i++){
-        row = PyList_New(numOfPoints);
-        PyList_SetItem(wMatPython, i, row);
+    if (a != NULL && a->rows != a->cols) {
+        PyErr_SetString(PyExc_ValueError, "eigen expects a square matrix");
+    } else if (a != NULL && basis != NULL &&
+               (basis->rows != a->rows || basis->cols != a->rows || orthogonalityError(basis) > WARM_START_ORTHOGONALITY)) {
+        PyErr_SetString(PyExc_ValueError, "basis must be an n x n orthogonal matrix");
+    }
 
-        for (j=0; j < numOfPoints; j++){
-            listVal = Py_BuildValue("d", wMat[i][j]);
-            PyList_SetItem(row, j, listVal);
+    if (a == NULL || a->rows != a->cols || k < 0 || (basisObj != Py_None && basis == NULL) || PyErr_Occurred() != NULL) {
+        printErrorMessage();
+        if (owned) {
+            freeMatrix(a);
+        }
+        if (ownedBasis) {
+            freeMatrix(basis);
         }
+        return NULL;
+    }
+
+    statsReset();
+    eigen = basis == NULL ? eigenDecompose(a, options, k) : eigenDecomposeFrom(a, basis, options, k);
+    if (owned) {
+        freeMatrix(a);
+    }
+    if (ownedBasis) {
+        freeMatrix(basis);
     }
 
-    freeMat(wMat, numOfPoints);
+    if (eigen == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    values = PyList_New(eigen->n);
+    for (i = 0; values != NULL && i < eigen->n; i++) {
+        PyList_SET_ITEM(values, i, PyFloat_FromDouble(eigen->values[i]));
+    }
+
+    vectors = wrapMatrix(eigen->vectors);
+    eigen->vectors = NULL;
+    freeEigen(eigen);
 
-    return wMatPython;
+    if (values == NULL || vectors == NULL) {
+        Py_XDECREF(values);
+        Py_XDECREF(vectors);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", values, vectors);
 }
 
-static PyObject * cDdg(PyObject *self, PyObject *args) {
-    PyObject *lst, *points, *dMatPython, *row, *listVal;
-    double **dMat;
-    struct vector *headVector;
-    int n, numOfPoints, i, j;
+/* Parses [k, m, data] of the sampled flows, m defaulting to defaultM */
+static struct matrix * parseSampledArgs(PyObject *args, int *k, int *m, int defaultM, int *owned) {
+    PyObject *lst, *obj;
+    struct matrix *points;
+    int i, *values[2];
 
-    if(!PyArg_ParseTuple(args, "O", &lst)) {
+    if(!PyArg_ParseTuple(args, "O", &lst) || PyObject_Length(lst) < 3) {
         printErrorMessage();
         return NULL;
     }
 
-    n = PyObject_Length(lst);
+    values[0] = k;
+    values[1] = m;
+    for (i = 0; i < 2; i++) {
+        obj = PyList_GetItem(lst, i);
+        *values[i] = obj == NULL || obj == Py_None ? 0 : (int) PyLong_AsLong(obj);
+    }
 
-    if (n < 0) {
+    if (*m == 0) {
+        *m = defaultM;
+    }
+
+    points = getMatrixFromPyObject(lst, 2, owned);
+    if (points == NULL || *k < 0 || *k > points->rows || *m < 0) {
         printErrorMessage();
+        if (*owned) {
+            freeMatrix(points);
+        }
         return NULL;
     }
 
-    points = PyList_GetItem(lst, 0);
-    numOfPoints = PyObject_Length(points);
+    return points;
+}
+
+/* Reads count ints from a sequence into a new array */
+static int * intsFromPyObject(PyObject *obj, int count) {
+    PyObject *seq;
+    int *values;
+    int i;
+
+    seq = PySequence_Fast(obj, "expected a sequence");
+    if (seq == NULL || PySequence_Fast_GET_SIZE(seq) != count) {
+        Py_XDECREF(seq);
+        return NULL;
+    }
+
+    values = memAlloc((count > 0 ? count : 1) * sizeof(int));
+    for (i = 0; values != NULL && i < count; i++) {
+        values[i] = (int) PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+    }
+    Py_DECREF(seq);
 
-    headVector = getVectorFromPyObject(lst, 0);
-    dMat = ddg(headVector, numOfPoints);
+    if (values != NULL && PyErr_Occurred()) {
+        memFree(values);
+        return NULL;
+    }
+
+    return values;
+}
 
-    dMatPython = PyList_New(numOfPoints);
+static PyObject * batchResultToDict(struct spkBatchResult *result, int rows) {
+    int clusters = result->centroidOffsets[result->count];
+    int values = result->centroidValues[result->count];
+    double seconds = result->elapsedMs / 1000;
+
+    return Py_BuildValue("{s:N,s:N,s:N,s:N,s:N,s:N,s:N,s:d,s:d}",
+                         "k", labelsToList(result->k, result->count),
+                         "status", labelsToList(result->status, result->count),
+                         "labels", labelsToList(result->labels, rows),
+                         "indexes", labelsToList(result->indexes, clusters),
+                         "centroid_offsets", labelsToList(result->centroidOffsets, result->count + 1),
+                         "centroids", doublesToList(result->centroids, values),
+                         "centroid_values", labelsToList(result->centroidValues, result->count + 1),
+                         "elapsed_ms", result->elapsedMs,
+                         "problems_per_second", seconds > 0 ? result->count / seconds : 0.0);
+}
+
+static PyObject * cBatch(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"offsets", "data", "ks", NULL};
+    PyObject *offsetsObj, *dataObj, *ksObj = Py_None, *dict;
+    struct spkBatch batch;
+    struct spkBatchResult result;
+    int *offsets, *ks = NULL;
+    int count, owned = 0, failed;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|O", keywords, &offsetsObj, &dataObj, &ksObj)) {
+        printErrorMessage();
+        return NULL;
+    }
 
-    for (i=0; i < numOfPoints; i++){
-        row = PyList_New(numOfPoints);
-        PyList_SetItem(dMatPython, i, row);
+    count = PyObject_Length(offsetsObj) - 1;
+    if (count < 0) {
+        printErrorMessage();
+        return NULL;
+    }
 
-        for (j=0; j < numOfPoints; j++){
-            listVal = Py_BuildValue("d", dMat[i][j]);
-            PyList_SetItem(row, j, listVal);
+    offsets = intsFromPyObject(offsetsObj, count + 1);
+    if (ksObj != Py_None) {
+        ks = intsFromPyObject(ksObj, count);
+    }
+    batch.points = matrixFromPyObject(dataObj, &owned);
+    if (offsets == NULL || (ksObj != Py_None && ks == NULL) || batch.points == NULL) {
+        printErrorMessage();
+        memFree(offsets);
+        memFree(ks);
+        if (owned) {
+            freeMatrix(batch.points);
         }
+        return NULL;
     }
 
-    freeMat(dMat, numOfPoints);
+    batch.count = count;
+    batch.offsets = offsets;
+    batch.ks = ks;
 
-    return dMatPython;
+    statsReset();
+    Py_BEGIN_ALLOW_THREADS
+    failed = spkBatchRun(&batch, &result);
+    Py_END_ALLOW_THREADS
+
+    dict = failed ? NULL : batchResultToDict(&result, offsets[count]);
+    if (!failed) {
+        freeSpkBatchResult(&result);
+    }
+
+    memFree(offsets);
+    memFree(ks);
+    if (owned) {
+        freeMatrix(batch.points);
+    }
+
+    return dict;
 }
 
-static PyObject * cGl(PyObject *self, PyObject *args) {
-    PyObject *lst, *points, *gMatPython, *row, *listVal;
-    double ** gMat;
-    struct vector *headVector;
-    int n, numOfPoints, i, j;
+/* k clusters need k landmark eigenvectors; m below 1 or above n means
+ * every point is a landmark */
+static int tooFewLandmarks(struct matrix *points, int k, int m) {
+    if (k <= (m < 1 || m > points->rows ? points->rows : m)) {
+        return 0;
+    }
 
-    if(!PyArg_ParseTuple(args, "O", &lst)) {
+    PyErr_SetString(PyExc_ValueError, "k must not exceed the landmark count");
+    printErrorMessage();
+    return 1;
+}
+
+static PyObject * cNystrom(PyObject *self, PyObject *args) {
+    PyObject *indexes, *centroids;
+    struct matrix *points;
+    struct spkResult *result;
+    int k, m, owned = 0, i;
+
+    points = parseSampledArgs(args, &k, &m, NYSTROM_DEFAULT_LANDMARKS, &owned);
+    if (points == NULL) {
+        return NULL;
+    }
+
+    if (tooFewLandmarks(points, k, m)) {
+        if (owned) {
+            freeMatrix(points);
+        }
+        return NULL;
+    }
+
+    statsReset();
+    result = spkNystrom(points, k, m);
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    if (result == NULL) {
         printErrorMessage();
         return NULL;
     }
 
-    n = PyObject_Length(lst);
+    indexes = PyList_New(result->k);
+    for (i = 0; indexes != NULL && i < result->k; i++) {
+        PyList_SET_ITEM(indexes, i, PyLong_FromLong(result->indexes[i]));
+    }
 
-    if (n < 0) {
+    centroids = wrapMatrix(result->centroids);
+    result->centroids = NULL;
+    freeSpkResult(result);
+
+    if (indexes == NULL || centroids == NULL) {
+        Py_XDECREF(indexes);
+        Py_XDECREF(centroids);
+        return NULL;
+    }
+
+    return Py_BuildValue("(NN)", indexes, centroids);
+}
+
+static PyObject * cNystromQuality(PyObject *self, PyObject *args) {
+    struct nystromQuality quality;
+    struct matrix *points;
+    int k, m, owned = 0, failed;
+
+    points = parseSampledArgs(args, &k, &m, NYSTROM_DEFAULT_LANDMARKS, &owned);
+    if (points == NULL) {
+        return NULL;
+    }
+
+    if (tooFewLandmarks(points, k, m)) {
+        if (owned) {
+            freeMatrix(points);
+        }
+        return NULL;
+    }
+
+    statsReset();
+    failed = compareNystrom(points, k, m, &quality);
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    if (failed) {
         printErrorMessage();
         return NULL;
     }
 
-    points = PyList_GetItem(lst, 0);
-    numOfPoints = PyObject_Length(points);
+    return Py_BuildValue("{s:i,s:i,s:d,s:d,s:d,s:d,s:O,s:O}",
+                         "k", quality.k,
+                         "landmarks", quality.landmarks,
+                         "adjusted_rand", quality.adjustedRand,
+                         "eigenvalue_error", quality.eigenvalueError,
+                         "exact_ms", quality.exactMs,
+                         "nystrom_ms", quality.nystromMs,
+                         "exact_converged", quality.exactConverged ? Py_True : Py_False,
+                         "landmark_converged", quality.landmarkConverged ? Py_True : Py_False);
+}
+
+static PyObject * cCoresetQuality(PyObject *self, PyObject *args) {
+    struct coresetQuality quality;
+    struct matrix *points;
+    int k, m, owned = 0, failed;
+
+    points = parseSampledArgs(args, &k, &m, CORESET_DEFAULT_SIZE, &owned);
+    if (points == NULL) {
+        return NULL;
+    }
+
+    statsReset();
+    failed = compareCoreset(points, k, m, &quality);
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    if (failed) {
+        printErrorMessage();
+        return NULL;
+    }
 
-    headVector = getVectorFromPyObject(lst, 0);
-    gMat = gl(headVector, numOfPoints);
+    return Py_BuildValue("{s:i,s:i,s:d,s:d,s:d,s:d,s:d,s:d}",
+                         "k", quality.k,
+                         "size", quality.size,
+                         "coreset_cost", quality.coresetCost,
+                         "full_cost", quality.fullCost,
+                         "cost_ratio", quality.costRatio,
+                         "adjusted_rand", quality.adjustedRand,
+                         "coreset_ms", quality.coresetMs,
+                         "full_ms", quality.fullMs);
+}
 
-    gMatPython = PyList_New(numOfPoints);
+static PyObject * cWarmStartQuality(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"", "steps", "noise", NULL};
+    struct warmStartQuality quality;
+    struct warmStartRun *run;
+    struct matrix *a;
+    PyObject *lst, *runs, *item, *speedup;
+    double noise = 1e-3;
+    int steps = 5, owned = 0, failed, i;
 
-    for (i=0; i < numOfPoints; i++){
-        row = PyList_New(numOfPoints);
-        PyList_SetItem(gMatPython, i, row);
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|id", keywords, &lst, &steps, &noise)) {
+        printErrorMessage();
+        return NULL;
+    }
 
-        for (j=0; j < numOfPoints; j++){
-            listVal = Py_BuildValue("d", gMat[i][j]);
-            PyList_SetItem(row, j, listVal);
+    a = getMatrixFromPyObject(lst, 0, &owned);
+    if (a == NULL || a->rows != a->cols || steps < 1) {
+        printErrorMessage();
+        if (owned) {
+            freeMatrix(a);
         }
+        return NULL;
+    }
+
+    statsReset();
+    failed = compareWarmStart(a, steps, noise, &quality);
+    if (owned) {
+        freeMatrix(a);
     }
 
-    freeMat(gMat, numOfPoints);
+    if (failed) {
+        printErrorMessage();
+        return NULL;
+    }
 
-    return gMatPython;
+    runs = PyList_New(quality.steps);
+    for (i = 0; runs != NULL && i < quality.steps; i++) {
+        run = &quality.runs[i];
+        item = Py_BuildValue("{s:l,s:l,s:d,s:d,s:d,s:d,s:O,s:O}",
+                             "cold_rotations", run->coldRotations,
+                             "warm_rotations", run->warmRotations,
+                             "cold_ms", run->coldMs,
+                             "warm_ms", run->warmMs,
+                             "cold_off", run->coldOff,
+                             "warm_off", run->warmOff,
+                             "cold_converged", run->coldConverged ? Py_True : Py_False,
+                             "warm_converged", run->warmConverged ? Py_True : Py_False);
+        if (item == NULL) {
+            Py_CLEAR(runs);
+            break;
+        }
+        PyList_SET_ITEM(runs, i, item);
+    }
+    freeWarmStartQuality(&quality);
+
+    if (runs == NULL) {
+        return NULL;
+    }
+
+    /* no speedup is claimed unless some step was measured to convergence */
+    if (quality.measuredSteps > 0 && quality.warmMs > 0) {
+        speedup = PyFloat_FromDouble(quality.coldMs / quality.warmMs);
+    } else {
+        Py_INCREF(Py_None);
+        speedup = Py_None;
+    }
+
+    return Py_BuildValue("{s:i,s:i,s:l,s:l,s:d,s:d,s:N,s:d,s:N}",
+                         "steps", quality.steps,
+                         "measured_steps", quality.measuredSteps,
+                         "cold_rotations", quality.coldRotations,
+                         "warm_rotations", quality.warmRotations,
+                         "cold_ms", quality.coldMs,
+                         "warm_ms", quality.warmMs,
+                         "speedup", speedup,
+                         "eigenvalue_error", quality.eigenvalueError,
+                         "runs", runs);
 }
 
-static PyObject * cJacobi(PyObject *self, PyObject *args) {
-    PyObject *lst, *points, *jMatPython, *row, *listVal;
-    double **jMat, **symMat;
-    struct vector *headVector;
-    int n, numOfPoints, i, j;
+static PyObject * cPipeline(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"", "solver", "oversampling", "iterations", "precision", "collapse", "operator_cache",
+                               NULL};
+    PyObject *lst, *kObj, *indexes, *centroids;
+    struct matrix *points;
+    struct spkResult *result;
+    struct subspaceOptions subspace;
+    const char *solver = "jacobi", *precision = "double";
+    Py_ssize_t operatorCache = 0;
+    int n, k = 0, owned = 0, i, useSubspace, useFloat, collapse = 0;
+
+    defaultSubspaceOptions(&subspace);
+    if(!PyArg_ParseTupleAndKeywords(args, kwargs, "O|siispn", keywords, &lst, &solver,
+                                    &subspace.oversampling, &subspace.iterations, &precision, &collapse,
+                                    &operatorCache)) {
+        printErrorMessage();
+        return NULL;
+    }
 
-    if(!PyArg_ParseTuple(args, "O", &lst)) {
+    subspace.matrixFree = strcmp(solver, "matrixfree") == 0;
+    subspace.operatorCache = operatorCache > 0 ? (size_t) operatorCache : 0;
+    useSubspace = subspace.matrixFree || strcmp(solver, "subspace") == 0;
+    useFloat = strcmp(precision, "float") == 0;
+    if ((!useSubspace && strcmp(solver, "jacobi") != 0) || (!useFloat && strcmp(precision, "double") != 0)) {
         printErrorMessage();
         return NULL;
     }
 
     n = PyObject_Length(lst);
+    if (n < 2) {
+        printErrorMessage();
+        return NULL;
+    }
 
-    if (n < 0) {
+    kObj = PyList_GetItem(lst, 0);
+    if (kObj != Py_None) {
+        k = (int) PyLong_AsLong(kObj);
+    }
+
+    points = getMatrixFromPyObject(lst, 1, &owned);
+    if (points == NULL || k < 0 || k > points->rows) {
         printErrorMessage();
+        if (owned) {
+            freeMatrix(points);
+        }
         return NULL;
     }
 
-    points = PyList_GetItem(lst, 0);
-    numOfPoints = PyObject_Length(points);
+    statsReset();
+    if (collapse) {
+        result = spkCollapsed(points, k);
+    } else if (useSubspace) {
+        result = useFloat ? spkSubspaceF(points, k, &subspace) : spkSubspace(points, k, &subspace);
+    } else {
+        result = useFloat ? spkF(points, k) : spk(points, k);
+    }
+    if (owned) {
+        freeMatrix(points);
+    }
+
+    if (result == NULL) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    indexes = PyList_New(result->k);
+    for (i = 0; indexes != NULL && i < result->k; i++) {
+        PyList_SET_ITEM(indexes, i, PyLong_FromLong(result->indexes[i]));
+    }
+
+    centroids = wrapMatrix(result->centroids);
+    result->centroids = NULL;
+    freeSpkResult(result);
+
+    if (indexes == NULL || centroids == NULL) {
+        Py_XDECREF(indexes);
+        Py_XDECREF(centroids);
+        return NULL;
+    }
 
-    headVector = getVectorFromPyObject(lst, 0);
-    symMat = buildSymetricMat(headVector, numOfPoints);
-    jMat = jacobi(symMat, numOfPoints);
-    
-    jMatPython = PyList_New(numOfPoints+1);
+    return Py_BuildValue("(NN)", indexes, centroids);
+}
+
+static PyObject * usageToDict(int subsystem) {
+    struct memUsage usage;
+
+    getMemoryUsage(subsystem, &usage);
+    return Py_BuildValue("{s:n,s:n,s:l,s:l}",
+                         "in_use", (Py_ssize_t) usage.inUse,
+                         "peak", (Py_ssize_t) usage.peak,
+                         "allocations", usage.allocations,
+                         "frees", usage.frees);
+}
+
+static PyObject * memoryToDict(void) {
+    PyObject *memory, *value;
+    int i;
+
+    memory = Py_BuildValue("{s:n,s:N}", "budget", (Py_ssize_t) getMemoryBudget(), "total", usageToDict(MEM_SUBSYSTEMS));
+    for (i = 0; memory != NULL && i < MEM_SUBSYSTEMS; i++) {
+        value = usageToDict(i);
+        if (value == NULL || PyDict_SetItemString(memory, memSubsystemNames[i], value) < 0) {
+            Py_XDECREF(value);
+            Py_CLEAR(memory);
+            break;
+        }
+        Py_DECREF(value);
+    }
+
+    return memory;
+}
+
+static PyObject * cMemory(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    return memoryToDict();
+}
+
+static PyObject * cSetMemoryBudget(PyObject *self, PyObject *args) {
+    Py_ssize_t bytes = 0;
+
+    if(!PyArg_ParseTuple(args, "n", &bytes)) {
+        printErrorMessage();
+        return NULL;
+    }
 
-    for (i=0; i <= numOfPoints; i++){
-        row = PyList_New(numOfPoints);
-        PyList_SetItem(jMatPython, i, row);
+    setMemoryBudget(bytes > 0 ? (size_t) bytes : 0);
 
-        for (j=0; j < numOfPoints; j++){
-            listVal = Py_BuildValue("d", jMat[i][j]);
-            PyList_SetItem(row, j, listVal);
+    Py_RETURN_NONE;
+}
+
+static PyObject * cStats(PyObject *self, PyObject *Py_UNUSED(ignored)) {
+    PyObject *stages, *reassignments, *value;
+    int i, recorded;
+
+    stages = PyDict_New();
+    for (i = 0; stages != NULL && i < STATS_STAGES; i++) {
+        value = PyFloat_FromDouble(spkStats.stageMs[i]);
+        if (value == NULL || PyDict_SetItemString(stages, statsStageNames[i], value) < 0) {
+            Py_XDECREF(value);
+            Py_CLEAR(stages);
+            break;
         }
+        Py_DECREF(value);
+    }
+
+    recorded = spkStats.kmeansIterations < STATS_MAX_ITERATIONS ? spkStats.kmeansIterations : STATS_MAX_ITERATIONS;
+    reassignments = PyList_New(recorded);
+    for (i = 0; reassignments != NULL && i < recorded; i++) {
+        PyList_SET_ITEM(reassignments, i, PyLong_FromLong(spkStats.reassignments[i]));
     }
 
-    freeMat(jMat, numOfPoints+1);
+    if (stages == NULL || reassignments == NULL) {
+        Py_XDECREF(stages);
+        Py_XDECREF(reassignments);
+        return NULL;
+    }
 
-    return jMatPython;
+    return Py_BuildValue("{s:O,s:N,s:l,s:l,s:d,s:i,s:N,s:N}",
+                         "enabled", statsCompiledIn() ? Py_True : Py_False,
+                         "stages_ms", stages,
+                         "kernel_evaluations", spkStats.kernelEvaluations,
+                         "jacobi_rotations", spkStats.jacobiRotations,
+                         "final_off", spkStats.finalOff,
+                         "kmeans_iterations", spkStats.kmeansIterations,
+                         "reassignments", reassignments,
+                         "memory", memoryToDict());
 }
 
 static PyMethodDef cKmeans_FunctionsTable[] = {
     {
         "spk", 
-        cKmeans,
-        METH_VARARGS,
+        (PyCFunction) cKmeans,
+        METH_VARARGS | METH_KEYWORDS,
         SPK_DOC_STRING
     } , {
         "wam", 
-        cWam,
-        METH_VARARGS,
+        (PyCFunction) cWam,
+        METH_VARARGS | METH_KEYWORDS,
         WAM_DOC_STRING
     } , {
         "ddg", 
-        cDdg,
-        METH_VARARGS,
+        (PyCFunction) cDdg,
+        METH_VARARGS | METH_KEYWORDS,
         DDG_DOC_STRING
     } , {
         "gl", 
-        cGl,
-        METH_VARARGS,
+        (PyCFunction) cGl,
+        METH_VARARGS | METH_KEYWORDS,
         GL_DOC_STRING
     } , {
         "jacobi", 
         cJacobi,
         METH_VARARGS,
         JACOBI_DOC_STRING
+    } , {
+        "set_cache", 
+        cSetCache,
+        METH_VARARGS,
+        SET_CACHE_DOC_STRING
+    } , {
+        "set_out_of_core",
+        cSetOutOfCore,
+        METH_VARARGS,
+        SET_OUT_OF_CORE_DOC_STRING
+    } , {
+        "set_coreset",
+        cSetCoreset,
+        METH_VARARGS,
+        SET_CORESET_DOC_STRING
+    } , {
+        "write_matrix", 
+        cWriteMatrix,
+        METH_VARARGS,
+        WRITE_MATRIX_DOC_STRING
+    } , {
+        "eigen", 
+        (PyCFunction) cEigen,
+        METH_VARARGS | METH_KEYWORDS,
+        EIGEN_DOC_STRING
+    } , {
+        "warm_start_quality",
+        (PyCFunction) cWarmStartQuality,
+        METH_VARARGS | METH_KEYWORDS,
+        WARM_START_QUALITY_DOC_STRING
+    } , {
+        "pipeline", 
+        (PyCFunction) cPipeline,
+        METH_VARARGS | METH_KEYWORDS,
+        PIPELINE_DOC_STRING
+    } , {
+        "batch",
+        (PyCFunction) cBatch,
+        METH_VARARGS | METH_KEYWORDS,
+        BATCH_DOC_STRING
+    } , {
+        "fit",
+        cFit,
+        METH_VARARGS,
+        FIT_DOC_STRING
+    } , {
+        "nystrom",
+        cNystrom,
+        METH_VARARGS,
+        NYSTROM_DOC_STRING
+    } , {
+        "nystrom_quality",
+        cNystromQuality,
+        METH_VARARGS,
+        NYSTROM_QUALITY_DOC_STRING
+    } , {
+        "coreset_quality",
+        cCoresetQuality,
+        METH_VARARGS,
+        CORESET_QUALITY_DOC_STRING
+    } , {
+        "stats",
+        cStats,
+        METH_NOARGS,
+        STATS_DOC_STRING
+    } , {
+        "memory",
+        cMemory,
+        METH_NOARGS,
+        MEMORY_DOC_STRING
+    } , {
+        "set_memory_budget",
+        cSetMemoryBudget,
+        METH_VARARGS,
+        SET_MEMORY_BUDGET_DOC_STRING
     } , {
         NULL, NULL, 0, NULL
     }
@@ -329,5 +1669,30 @@ static struct PyModuleDef cKmeans_Module = {
 };
 
 PyMODINIT_FUNC PyInit_mykmeanssp(void) {
-    return PyModule_Create(&cKmeans_Module);
+    PyObject *module;
+
+    if (PyType_Ready(&MatrixType) < 0 || PyType_Ready(&ModelType) < 0) {
+        return NULL;
+    }
+
+    module = PyModule_Create(&cKmeans_Module);
+    if (module == NULL) {
+        return NULL;
+    }
+
+    Py_INCREF(&MatrixType);
+    if (PyModule_AddObject(module, "Matrix", (PyObject *) &MatrixType) < 0) {
+        Py_DECREF(&MatrixType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    Py_INCREF(&ModelType);
+    if (PyModule_AddObject(module, "Model", (PyObject *) &ModelType) < 0) {
+        Py_DECREF(&ModelType);
+        Py_DECREF(module);
+        return NULL;
+    }
+
+    return module;
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "alloc.h"
+#include "stats.h"
+
+struct spkStats spkStats;
+
+__thread int statsMuted = 0;
+
+const char *statsStageNames[STATS_STAGES] = {"parse", "wam", "ddg", "gl", "jacobi", "kmeans", "output"};
+
+double monotonicMs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+int statsCompiledIn(void) {
+#ifdef SPKMEANS_STATS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void statsReset(void) {
+    memset(&spkStats, 0, sizeof(spkStats));
+    resetMemoryPeaks();
+}
+
+void statsBegin(enum statsStage stage) {
+    if (!statsMuted) {
+        spkStats.stageStart[stage] = monotonicMs();
+    }
+}
+
+void statsEnd(enum statsStage stage) {
+    if (!statsMuted) {
+        spkStats.stageMs[stage] += monotonicMs() - spkStats.stageStart[stage];
+    }
+}
+
+void statsKmeansIteration(long changed) {
+    if (statsMuted) {
+        return;
+    }
+
+    if (spkStats.kmeansIterations < STATS_MAX_ITERATIONS) {
+        spkStats.reassignments[spkStats.kmeansIterations] = changed;
+    }
+
+    spkStats.kmeansIterations++;
+}
+
+void printStatsJson(FILE *fp) {
+    int i, recorded;
+
+    /* allocation accounting is always on, so memory is reported either way */
+    fprintf(fp, "{\"memory\": ");
+    printMemoryJson(fp);
+
+    if (!statsCompiledIn()) {
+        fprintf(fp, ", \"enabled\": false}\n");
+        return;
+    }
+
+    fprintf(fp, ", \"enabled\": true, \"stages_ms\": {");
+    for (i = 0; i < STATS_STAGES; i++) {
+        fprintf(fp, "\"%s\": %.3f%s", statsStageNames[i], spkStats.stageMs[i], i == STATS_STAGES - 1 ? "" : ", ");
+    }
+
+    fprintf(fp, "}, \"kernel_evaluations\": %ld, \"jacobi_rotations\": %ld, \"final_off\": %.10g, "
+                "\"kmeans_iterations\": %d, \"reassignments\": [",
+            spkStats.kernelEvaluations, spkStats.jacobiRotations, spkStats.finalOff, spkStats.kmeansIterations);
+
+    recorded = spkStats.kmeansIterations < STATS_MAX_ITERATIONS ? spkStats.kmeansIterations : STATS_MAX_ITERATIONS;
+    for (i = 0; i < recorded; i++) {
+        fprintf(fp, "%ld%s", spkStats.reassignments[i], i == recorded - 1 ? "" : ", ");
+    }
+
+    fprintf(fp, "]}\n");
+}
@@ -0,0 +1,72 @@
+# ifndef STATS_H_
+# define STATS_H_
+
+#include <stdio.h>
+
+#define STATS_MAX_ITERATIONS 512
+
+enum statsStage {
+    STATS_PARSE,
+    STATS_WAM,
+    STATS_DDG,
+    STATS_GL,
+    STATS_JACOBI,
+    STATS_KMEANS,
+    STATS_OUTPUT,
+    STATS_STAGES
+};
+
+/* Stage timers (inclusive, in ms) and algorithm counters of the current run.
+ * Everything is collected only when built with SPKMEANS_STATS; otherwise
+ * the macros below expand to nothing. statsReset() also restarts the peak
+ * memory measurement. kernelEvaluations counts Gaussian weights actually
+ * computed, not distinct pairs: in-core wam() mirrors each pair and counts
+ * n(n-1)/2, while the tiled, streamed and matrix-free paths evaluate every
+ * off-diagonal entry and count n(n-1) per pass. */
+struct spkStats {
+    double stageMs[STATS_STAGES];
+    double stageStart[STATS_STAGES];
+    long kernelEvaluations;
+    long jacobiRotations;
+    double finalOff;
+    int kmeansIterations;
+    long reassignments[STATS_MAX_ITERATIONS];
+};
+
+extern struct spkStats spkStats;
+
+/* set by threads whose work must stay out of spkStats, such as the workers
+ * of a batch running many problems at once */
+extern __thread int statsMuted;
+
+extern const char *statsStageNames[STATS_STAGES];
+
+#ifdef SPKMEANS_STATS
+#define STATS_BEGIN(stage) statsBegin(stage)
+#define STATS_END(stage) statsEnd(stage)
+#define STATS_ADD(counter, amount) (statsMuted ? (void) 0 : (void) (spkStats.counter += (amount)))
+#define STATS_SET(counter, value) (statsMuted ? (void) 0 : (void) (spkStats.counter = (value)))
+#define STATS_KMEANS_ITERATION(changed) statsKmeansIteration(changed)
+#else
+#define STATS_BEGIN(stage) ((void) 0)
+#define STATS_END(stage) ((void) 0)
+#define STATS_ADD(counter, amount) ((void) 0)
+#define STATS_SET(counter, value) ((void) 0)
+#define STATS_KMEANS_ITERATION(changed) ((void) (changed))
+#endif
+
+double monotonicMs(void);
+
+int statsCompiledIn(void);
+
+void statsReset(void);
+
+void statsBegin(enum statsStage stage);
+
+void statsEnd(enum statsStage stage);
+
+void statsKmeansIteration(long changed);
+
+void printStatsJson(FILE *fp);
+
+#endif
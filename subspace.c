@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "mt19937.h"
+#include "operator.h"
+#include "spkmeans.h"
+#include "subspace.h"
+
+void defaultSubspaceOptions(struct subspaceOptions *options) {
+    options->oversampling = SUBSPACE_OVERSAMPLING;
+    options->iterations = SUBSPACE_ITERATIONS;
+    options->seed = SUBSPACE_SEED;
+    options->matrixFree = 0;
+    options->operatorCache = 0;
+}
+
+/* Standard normal entries by the Box-Muller transform */
+static void gaussianBlock(struct matrix *x, unsigned long seed) {
+    struct mt19937 rng;
+    double u1, u2;
+    int i, j;
+
+    mt19937Seed(&rng, seed);
+    for (i = 0; i < x->rows; i++) {
+        for (j = 0; j < x->cols; j++) {
+            do {
+                u1 = mt19937NextDouble(&rng);
+            } while (u1 <= 0);
+            u2 = mt19937NextDouble(&rng);
+
+            MAT(x, i, j) = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+        }
+    }
+}
+
+/* Thin QR by modified Gram-Schmidt, run twice per column so the columns
+ * stay orthogonal to working precision. Only Q is kept, in place. */
+static void orthonormalize(struct matrix *x) {
+    double dot, norm;
+    int i, c, p, pass;
+
+    for (c = 0; c < x->cols; c++) {
+        for (pass = 0; pass < 2; pass++) {
+            for (p = 0; p < c; p++) {
+                dot = 0;
+                for (i = 0; i < x->rows; i++) {
+                    dot += MAT(x, i, p) * MAT(x, i, c);
+                }
+                for (i = 0; i < x->rows; i++) {
+                    MAT(x, i, c) -= dot * MAT(x, i, p);
+                }
+            }
+        }
+
+        norm = 0;
+        for (i = 0; i < x->rows; i++) {
+            norm += MAT(x, i, c) * MAT(x, i, c);
+        }
+
+        norm = sqrt(norm);
+        for (i = 0; norm > 0 && i < x->rows; i++) {
+            MAT(x, i, c) /= norm;
+        }
+    }
+}
+
+/* A shift just above the largest eigenvalue, from a few power steps on one
+ * random vector. The Rayleigh quotient approaches that eigenvalue from below,
+ * so it is padded by SUBSPACE_SHIFT_MARGIN and capped by op->bound. */
+static double estimateShift(struct linearOperator *op, unsigned long seed) {
+    struct matrix *x, *y, *swap;
+    double quotient = 0, norm;
+    int i, step;
+
+    x = allocMatrix(op->n, 1);
+    y = allocMatrix(op->n, 1);
+    if (x == NULL || y == NULL) {
+        freeMatrix(x);
+        freeMatrix(y);
+        return op->bound;
+    }
+
+    gaussianBlock(x, seed + 1);
+    orthonormalize(x);
+
+    for (step = 0; step < SUBSPACE_POWER_STEPS; step++) {
+        op->apply(op, x, y);
+
+        quotient = norm = 0;
+        for (i = 0; i < op->n; i++) {
+            quotient += MAT(x, i, 0) * MAT(y, i, 0);
+            norm += MAT(y, i, 0) * MAT(y, i, 0);
+        }
+
+        norm = sqrt(norm);
+        for (i = 0; norm > 0 && i < op->n; i++) {
+            MAT(y, i, 0) /= norm;
+        }
+
+        swap = x;
+        x = y;
+        y = swap;
+    }
+
+    freeMatrix(x);
+    freeMatrix(y);
+
+    quotient *= 1 + SUBSPACE_SHIFT_MARGIN;
+    return quotient > 0 && quotient < op->bound ? quotient : op->bound;
+}
+
+/* One Jacobi run stops at a tolerance relative to the whole matrix, so the
+ * small projected matrix is rotated again by the accumulated eigenvectors of
+ * each run until its off-diagonal is within SUBSPACE_RITZ_TOLERANCE. Returns
+ * the eigenvectors, the diagonal in values and whether the tolerance was
+ * reached in converged. */
+static struct matrix * ritzRotations(struct matrix *t, double *values, int *converged) {
+    struct matrix *v = NULL, *rot, *rotT, *product, *rotated;
+    struct jacobiRun run;
+    int pass, i;
+
+    t = copyMatrix(t);
+    for (pass = 0; t != NULL && pass < SUBSPACE_RITZ_PASSES; pass++) {
+        rot = convergedRotations(t, values, &run);
+        rotT = rot == NULL ? NULL : transposeMat(rot);
+        product = rotT == NULL ? NULL : matrixMultiply(rotT, t);
+        rotated = product == NULL ? NULL : matrixMultiply(product, rot);
+        freeMatrix(rotT);
+        freeMatrix(product);
+        freeMatrix(t);
+        t = rotated;
+
+        product = v == NULL || rot == NULL ? rot : matrixMultiply(v, rot);
+        if (product != rot) {
+            freeMatrix(rot);
+        }
+        freeMatrix(v);
+        v = product;
+
+        if (t == NULL || v == NULL || calcOff(t) <= SUBSPACE_RITZ_TOLERANCE) {
+            break;
+        }
+    }
+
+    if (t == NULL || v == NULL) {
+        freeMatrix(t);
+        freeMatrix(v);
+        return NULL;
+    }
+
+    *converged = calcOff(t) <= SUBSPACE_RITZ_TOLERANCE;
+    for (i = 0; i < t->rows; i++) {
+        values[i] = MAT(t, i, i);
+    }
+
+    freeMatrix(t);
+    return v;
+}
+
+/* Eigenpairs of the projected matrix in increasing order, k of them, or as
+ * many as the eigengap picks when k is 0 */
+static struct eigen * ritzPairs(struct matrix *t, int k) {
+    struct eigen *eigen;
+    struct matrix *v;
+    double *values;
+    int *order, i, j, converged, n = t->rows;
+
+    values = memAlloc(n * sizeof(double));
+    order = memAlloc(n * sizeof(int));
+    eigen = memAlloc(sizeof(struct eigen));
+    v = values == NULL || order == NULL || eigen == NULL ? NULL : ritzRotations(t, values, &converged);
+    if (v == NULL || sortEigenValues(values, n, order) != 0) {
+        printErrorMessage();
+        memFree(values);
+        memFree(order);
+        memFree(eigen);
+        freeMatrix(v);
+        return NULL;
+    }
+
+    eigen->n = n;
+    eigen->converged = converged;
+    eigen->values = memAlloc(n * sizeof(double));
+    for (i = 0; eigen->values != NULL && i < n; i++) {
+        eigen->values[i] = values[order[i]];
+    }
+
+    if (k == 0 && eigen->values != NULL) {
+        k = calcK(eigen->values, n);
+    }
+
+    eigen->k = k > 0 && k < n ? k : n;
+    eigen->vectors = eigen->values == NULL ? NULL : allocMatrix(n, eigen->k);
+    for (i = 0; eigen->vectors != NULL && i < n; i++) {
+        for (j = 0; j < eigen->k; j++) {
+            MAT(eigen->vectors, i, j) = MAT(v, i, order[j]);
+        }
+    }
+
+    memFree(values);
+    memFree(order);
+    freeMatrix(v);
+
+    if (eigen->vectors == NULL) {
+        printErrorMessage();
+        freeEigen(eigen);
+        return NULL;
+    }
+
+    return eigen;
+}
+
+/* The k smallest eigenpairs of op by randomized subspace iteration. A
+ * Gaussian block of k + oversampling columns is repeatedly multiplied by
+ * sigma I - A, where sigma is just above the spectrum, so the bottom of A's
+ * spectrum becomes the dominant part, and re-orthonormalized. Rayleigh-Ritz
+ * on the projected block X^T A X, diagonalized by Jacobi rotations, gives
+ * the eigenpairs. k == 0 picks k by the eigengap over the Ritz values.
+ * eigen->n is the block size. */
+struct eigen * subspaceEigen(struct linearOperator *op, int k, const struct subspaceOptions *options) {
+    struct matrix *x, *y, *t, *swap;
+    struct eigen *eigen;
+    double sigma;
+    int i, j, c, iter, block, n = op->n;
+    enum memSubsystem previous;
+
+    block = (k > 0 ? k : SUBSPACE_EIGENGAP_BLOCK) + (options->oversampling > 0 ? options->oversampling : 0);
+    if (block > n) {
+        block = n;
+    }
+
+    previous = memEnter(MEM_EIGEN);
+    x = allocMatrix(n, block);
+    y = allocMatrix(n, block);
+    t = allocMatrix(block, block);
+    if (x == NULL || y == NULL || t == NULL) {
+        freeMatrix(x);
+        freeMatrix(y);
+        freeMatrix(t);
+        memLeave(previous);
+        return NULL;
+    }
+
+    sigma = estimateShift(op, options->seed);
+    if (sigma <= 0) {
+        sigma = 1;
+    }
+
+    gaussianBlock(x, options->seed);
+    orthonormalize(x);
+
+    for (iter = 0; iter < options->iterations; iter++) {
+        op->apply(op, x, y);
+        for (i = 0; i < n; i++) {
+            for (c = 0; c < block; c++) {
+                MAT(y, i, c) = sigma * MAT(x, i, c) - MAT(y, i, c);
+            }
+        }
+
+        swap = x;
+        x = y;
+        y = swap;
+        orthonormalize(x);
+    }
+
+    /* Rayleigh-Ritz: T = X^T A X, symmetrized against round-off */
+    op->apply(op, x, y);
+    for (i = 0; i < block; i++) {
+        for (j = 0; j < block; j++) {
+            MAT(t, i, j) = 0;
+        }
+    }
+    for (c = 0; c < n; c++) {
+        for (i = 0; i < block; i++) {
+            for (j = 0; j < block; j++) {
+                MAT(t, i, j) += MAT(x, c, i) * MAT(y, c, j);
+            }
+        }
+    }
+    for (i = 0; i < block; i++) {
+        for (j = i + 1; j < block; j++) {
+            MAT(t, i, j) = MAT(t, j, i) = (MAT(t, i, j) + MAT(t, j, i)) / 2;
+        }
+    }
+
+    eigen = ritzPairs(t, k);
+    freeMatrix(t);
+    freeMatrix(y);
+
+    /* the Ritz vectors are X times the small eigenvectors */
+    y = eigen == NULL ? NULL : allocMatrix(n, eigen->k);
+    if (y == NULL) {
+        freeEigen(eigen);
+        freeMatrix(x);
+        memLeave(previous);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < eigen->k; c++) {
+            MAT(y, i, c) = 0;
+            for (j = 0; j < block; j++) {
+                MAT(y, i, c) += MAT(x, i, j) * MAT(eigen->vectors, j, c);
+            }
+        }
+    }
+
+    freeMatrix(x);
+    freeMatrix(eigen->vectors);
+    eigen->vectors = y;
+    memLeave(previous);
+
+    return eigen;
+}
+
+/* spkSubspace() on the matrix-free Laplacian; L is never stored */
+static struct spkResult * spkMatrixFree(struct matrix *points, int k, const struct subspaceOptions *options) {
+    struct linearOperator op;
+    struct eigen *eigen;
+
+    if (laplacianOperator(points, options->operatorCache, &op) != 0) {
+        printErrorMessage();
+        return NULL;
+    }
+
+    eigen = subspaceEigen(&op, k, options);
+    freeLaplacianOperator(&op);
+    if (eigen == NULL) {
+        return NULL;
+    }
+
+    return clusterEmbedding(eigen);
+}
+
+/* The spk flow with the bottom of L's spectrum found by subspace iteration */
+struct spkResult * spkSubspace(struct matrix *points, int k, const struct subspaceOptions *options) {
+    struct linearOperator op;
+    struct matrix *lMat;
+    struct eigen *eigen;
+
+    if (options->matrixFree) {
+        return spkMatrixFree(points, k, options);
+    }
+
+    lMat = gl(points);
+    if (lMat == NULL) {
+        return NULL;
+    }
+
+    denseOperator(lMat, &op);
+    eigen = subspaceEigen(&op, k, options);
+    freeMatrix(lMat);
+    if (eigen == NULL) {
+        return NULL;
+    }
+
+    return clusterEmbedding(eigen);
+}
+
+/* The subspace flow on a single precision L; the block products read the
+ * float rows but accumulate in double. With no L to store, the matrix-free
+ * flow always runs in double. */
+struct spkResult * spkSubspaceF(struct matrix *points, int k, const struct subspaceOptions *options) {
+    struct linearOperator op;
+    struct matrixf *lMat;
+    struct eigen *eigen;
+
+    if (options->matrixFree) {
+        return spkMatrixFree(points, k, options);
+    }
+
+    lMat = glF(points);
+    if (lMat == NULL) {
+        return NULL;
+    }
+
+    denseOperatorF(lMat, &op);
+    eigen = subspaceEigen(&op, k, options);
+    freeMatrixF(lMat);
+    if (eigen == NULL) {
+        return NULL;
+    }
+
+    return clusterEmbedding(eigen);
+}
@@ -0,0 +1,36 @@
+# ifndef SUBSPACE_H_
+# define SUBSPACE_H_
+
+#include "operator.h"
+#include "spkmeans.h"
+
+#define SUBSPACE_OVERSAMPLING 10
+#define SUBSPACE_ITERATIONS 20
+#define SUBSPACE_SEED 0
+#define SUBSPACE_POWER_STEPS 10
+#define SUBSPACE_SHIFT_MARGIN 0.05
+#define SUBSPACE_RITZ_PASSES 50
+#define SUBSPACE_RITZ_TOLERANCE 1e-12
+
+/* block columns besides the oversampling when k is left to the eigengap */
+#define SUBSPACE_EIGENGAP_BLOCK 10
+
+/* matrixFree runs the products on the points through laplacianOperator()
+ * instead of a stored L, keeping up to operatorCache bytes of W rows */
+struct subspaceOptions {
+    int oversampling;
+    int iterations;
+    unsigned long seed;
+    int matrixFree;
+    size_t operatorCache;
+};
+
+void defaultSubspaceOptions(struct subspaceOptions *options);
+
+struct eigen * subspaceEigen(struct linearOperator *op, int k, const struct subspaceOptions *options);
+
+struct spkResult * spkSubspace(struct matrix *points, int k, const struct subspaceOptions *options);
+
+struct spkResult * spkSubspaceF(struct matrix *points, int k, const struct subspaceOptions *options);
+
+#endif
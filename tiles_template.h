@@ -0,0 +1,196 @@
+/* Tiled affinity and streaming product kernels for one element type,
+ * included by outofcore.c once per precision with REAL, REAL_EXP, MATRIX and
+ * REAL_FN defined. Sums are always accumulated in double. No include guard. */
+
+struct REAL_FN(tileJob) {
+    MATRIX *points;
+    MATRIX *out;
+    double *sums;
+    int laplacian;
+};
+
+/* Fills one row block of W, or of L when sums is also wanted. A row's
+ * entries and its sum are produced in increasing column order, so the
+ * double results match the in-core wam() and gl() bit for bit. */
+static void REAL_FN(affinityBlock)(struct REAL_FN(tileJob) *job, int block, double *sums) {
+    MATRIX *points = job->points;
+    REAL_FN(distanceKernel) distance = REAL_FN(squaredDistanceKernel)(points->cols);
+    int i, j, tile, tileEnd, n = points->rows;
+    int first = block * TILE_ROWS, last = first + TILE_ROWS;
+    REAL weight;
+
+    if (last > n) {
+        last = n;
+    }
+
+    for (i = first; i < last; i++) {
+        sums[i - first] = 0;
+    }
+
+    for (tile = 0; tile < n; tile += TILE_COLS) {
+        tileEnd = tile + TILE_COLS < n ? tile + TILE_COLS : n;
+
+        for (i = first; i < last; i++) {
+            for (j = tile; j < tileEnd; j++) {
+                weight = i == j ? 0 : REAL_EXP(-distance(MAT_ROW(points, i), MAT_ROW(points, j), points->cols) / 2);
+                sums[i - first] += weight;
+                if (job->out != NULL) {
+                    MAT(job->out, i, j) = weight;
+                }
+            }
+        }
+    }
+
+    if (job->out == NULL) {
+        return;
+    }
+
+    if (job->laplacian) {
+        for (i = first; i < last; i++) {
+            for (j = 0; j < n; j++) {
+                MAT(job->out, i, j) = (i == j ? (REAL) sums[i - first] : 0) - MAT(job->out, i, j);
+            }
+        }
+    }
+
+    REAL_FN(releaseMatrixRows)(job->out, first, last);
+}
+
+static void REAL_FN(affinityBlocks)(void *ctx, int begin, int end) {
+    struct REAL_FN(tileJob) *job = ctx;
+    double sums[TILE_ROWS];
+    int b, i;
+
+    for (b = begin; b < end; b++) {
+        REAL_FN(affinityBlock)(job, b, sums);
+
+        if (job->sums != NULL) {
+            for (i = 0; i < TILE_ROWS && b * TILE_ROWS + i < job->points->rows; i++) {
+                job->sums[b * TILE_ROWS + i] = sums[i];
+            }
+        }
+    }
+}
+
+/* W (or L = D - W) of the points written row block by row block, into a
+ * scratch matrix in out-of-core mode so only a few blocks are ever resident.
+ * Each pair is evaluated twice to keep the writes sequential. */
+MATRIX * REAL_FN(tiledAffinity)(MATRIX *points, int laplacian) {
+    struct REAL_FN(tileJob) job;
+    int n = points->rows;
+
+    job.points = points;
+    job.sums = NULL;
+    job.laplacian = laplacian;
+    job.out = outOfCoreEnabled() ? REAL_FN(allocScratchMatrix)(scratchDir(), n, n) : REAL_FN(allocMatrix)(n, n);
+    if (job.out == NULL) {
+        return NULL;
+    }
+
+    if (job.out->backing == MATRIX_SCRATCH) {
+        madvise(job.out->mapBase, job.out->mapBytes, MADV_SEQUENTIAL);
+    }
+
+    parallelFor(blockCount(n), REAL_FN(affinityBlocks), &job);
+    STATS_ADD(kernelEvaluations, (long) n * (n - 1));
+
+    return job.out;
+}
+
+/* The degrees as a 1 x n matrix, summed on the fly without storing W */
+struct matrix * REAL_FN(streamedDegrees)(MATRIX *points) {
+    struct REAL_FN(tileJob) job;
+    struct matrix *degreeVec;
+
+    degreeVec = allocMatrix(1, points->rows);
+    if (degreeVec == NULL) {
+        return NULL;
+    }
+
+    job.points = points;
+    job.out = NULL;
+    job.sums = degreeVec->data;
+    job.laplacian = 0;
+    parallelFor(blockCount(points->rows), REAL_FN(affinityBlocks), &job);
+    STATS_ADD(kernelEvaluations, (long) points->rows * (points->rows - 1));
+
+    return degreeVec;
+}
+
+struct REAL_FN(matMulJob) {
+    MATRIX *mat;
+    struct matrix *x;
+    struct matrix *y;
+};
+
+static void REAL_FN(matMulBlocks)(void *ctx, int begin, int end) {
+    struct REAL_FN(matMulJob) *job = ctx;
+    MATRIX *mat = job->mat;
+    int b, i, j, c, first, last, cols = job->x->cols;
+    double value, *xRow, *yRow;
+    REAL *row;
+
+    for (b = begin; b < end; b++) {
+        first = b * TILE_ROWS;
+        last = first + TILE_ROWS < mat->rows ? first + TILE_ROWS : mat->rows;
+
+        for (i = first; i < last; i++) {
+            row = MAT_ROW(mat, i);
+            yRow = MAT_ROW(job->y, i);
+            for (c = 0; c < cols; c++) {
+                yRow[c] = 0;
+            }
+
+            for (j = 0; j < mat->cols; j++) {
+                value = row[j];
+                xRow = MAT_ROW(job->x, j);
+                for (c = 0; c < cols; c++) {
+                    yRow[c] += value * xRow[c];
+                }
+            }
+        }
+
+        REAL_FN(releaseMatrixRows)(mat, first, last);
+    }
+}
+
+/* Y = mat * X for an n x b block X, in one sequential pass over the rows of
+ * mat split across threads. Scratch matrices are dropped from memory block
+ * by block behind the pass. */
+void REAL_FN(streamMatMul)(MATRIX *mat, struct matrix *x, struct matrix *y) {
+    struct REAL_FN(matMulJob) job;
+
+    job.mat = mat;
+    job.x = x;
+    job.y = y;
+
+    if (mat->backing == MATRIX_SCRATCH) {
+        madvise(mat->mapBase, mat->mapBytes, MADV_SEQUENTIAL);
+    }
+
+    parallelFor(blockCount(mat->rows), REAL_FN(matMulBlocks), &job);
+}
+
+/* The largest Gershgorin row sum, an upper bound on the spectrum of a
+ * symmetric mat, found in one streaming pass */
+double REAL_FN(gershgorinBound)(MATRIX *mat) {
+    double sum, bound = 0;
+    int i, j;
+
+    for (i = 0; i < mat->rows; i++) {
+        sum = 0;
+        for (j = 0; j < mat->cols; j++) {
+            sum += fabs(MAT(mat, i, j));
+        }
+
+        if (sum > bound) {
+            bound = sum;
+        }
+
+        if ((i + 1) % TILE_ROWS == 0 || i == mat->rows - 1) {
+            REAL_FN(releaseMatrixRows)(mat, i - i % TILE_ROWS, i + 1);
+        }
+    }
+
+    return bound;
+}
@@ -1,11 +1,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "utils.h"
+#include "alloc.h"
+
+static errorHandler handler = NULL;
+
+/* Sends every later printErrorMessage() to handler instead of stdout, or
+ * back to stdout when handler is NULL. Returns the previous handler. */
+errorHandler setErrorHandler(errorHandler next) {
+    errorHandler previous = handler;
+
+    handler = next;
+    return previous;
+}
 
 void printErrorMessage() {
+    if (handler != NULL) {
+        handler();
+        return;
+    }
+
     printf("An Error Has Occurred");
 }
 
+/* For failures whose detail only the command line shows: the detail goes
+ * to stderr, or the installed handler is called instead of printing it */
+void printErrorDetail(const char *detail) {
+    if (handler != NULL) {
+        handler();
+        return;
+    }
+
+    fprintf(stderr, "%s\n", detail);
+}
+
 void freeVectorCords(struct vector *v) {
     struct cord *currCord, *nextCord;
     currCord = v->cords;
@@ -16,13 +44,13 @@ void freeVectorCords(struct vector *v) {
     }
 
     while(nextCord != NULL) {
-        free(currCord);
+        memFree(currCord);
         currCord = nextCord;
         nextCord = currCord->next;
     }
 
     if (currCord != NULL) { 
-        free(currCord);
+        memFree(currCord);
     }
 }
 
@@ -33,11 +61,11 @@ void freeVectorsList(struct vector *headVector) {
 
     while(nextVector != NULL) {
         freeVectorCords(currVector);
-        free(currVector);
+        memFree(currVector);
         currVector = nextVector;
         nextVector = currVector->next;
     }
 
     freeVectorCords(currVector);
-    free(currVector);
+    memFree(currVector);
 }
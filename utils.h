@@ -11,8 +11,14 @@ struct vector {
     struct cord *cords;
 };
 
+typedef void (*errorHandler)(void);
+
+errorHandler setErrorHandler(errorHandler next);
+
 void printErrorMessage();
 
+void printErrorDetail(const char *detail);
+
 void freeVectorCords(struct vector *v);
 
 void freeVectorsList(struct vector *headVector);
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include "utils.h"
+#include "alloc.h"
+#include "matrix.h"
+#include "parallel.h"
+#include "writer.h"
+
+/* Writes value the way printf("%.4f") does and returns the length written.
+ * The value is scaled and rounded in double precision; whenever that rounding
+ * could disagree with the exact decimal expansion (near ties, huge values,
+ * nan/inf) the libc formatter is used instead. */
+int formatFixed4(double value, char *out) {
+    double absValue, scaled, whole, frac;
+    unsigned long rounded, intPart, decimals;
+    char digits[24];
+    int len = 0, count = 0, i;
+
+    absValue = fabs(value);
+    if (!(absValue < 1e11)) {
+        return sprintf(out, "%.4f", value);
+    }
+
+    scaled = absValue * 10000.0;
+    if (scaled >= (double) (ULONG_MAX / 2)) {
+        return sprintf(out, "%.4f", value);
+    }
+
+    whole = floor(scaled);
+    frac = scaled - whole;
+    if (fabs(frac - 0.5) <= scaled * 4.5e-16 + 1e-300) {
+        return sprintf(out, "%.4f", value);
+    }
+
+    rounded = (unsigned long) whole + (frac > 0.5 ? 1 : 0);
+    intPart = rounded / 10000;
+    decimals = rounded % 10000;
+
+    if (value < 0 || (value == 0 && 1 / value < 0)) {
+        out[len++] = '-';
+    }
+
+    do {
+        digits[count++] = (char) ('0' + intPart % 10);
+        intPart /= 10;
+    } while (intPart > 0);
+
+    while (count > 0) {
+        out[len++] = digits[--count];
+    }
+
+    out[len++] = '.';
+    for (i = 3; i >= 0; i--) {
+        out[len + i] = (char) ('0' + decimals % 10);
+        decimals /= 10;
+    }
+
+    return len + 4;
+}
+
+static int reserve(struct textBuffer *buffer, size_t extra) {
+    size_t cap;
+    char *data;
+
+    if (buffer->len + extra <= buffer->cap) {
+        return 0;
+    }
+
+    cap = buffer->cap > 0 ? buffer->cap : WRITER_BLOCK_BYTES;
+    while (cap < buffer->len + extra) {
+        cap *= 2;
+    }
+
+    data = memRealloc(buffer->data, cap);
+    if (data == NULL) {
+        return 1;
+    }
+
+    buffer->data = data;
+    buffer->cap = cap;
+    return 0;
+}
+
+/* Appends one comma separated, newline terminated row */
+int appendRow(struct textBuffer *buffer, const double *row, int cols) {
+    int j;
+
+    for (j = 0; j < cols; j++) {
+        if (reserve(buffer, WRITER_MAX_NUMBER_LEN + 1) != 0) {
+            return 1;
+        }
+
+        buffer->len += formatFixed4(row[j], buffer->data + buffer->len);
+        buffer->data[buffer->len++] = j == cols - 1 ? '\n' : ',';
+    }
+
+    return 0;
+}
+
+int writeAll(int fd, const char *data, size_t len) {
+    ssize_t written;
+
+    while (len > 0) {
+        written = write(fd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+
+        data += written;
+        len -= written;
+    }
+
+    return 0;
+}
+
+/* exactly one of mat and matF is set; float rows are widened into the
+ * block's row of widened before formatting. A column job prints the single
+ * row of mat one value per line. */
+struct formatJob {
+    struct matrix *mat;
+    struct matrixf *matF;
+    int column;
+    int rows;
+    int cols;
+    double *widened;
+    struct textBuffer *buffers;
+    int firstRow;
+    int rowsPerBlock;
+    int failed;
+};
+
+static void formatBlocks(void *ctx, int begin, int end) {
+    struct formatJob *job = ctx;
+    struct textBuffer *buffer;
+    double *row;
+    int b, i, j, first, last;
+
+    for (b = begin; b < end; b++) {
+        buffer = &job->buffers[b];
+        buffer->len = 0;
+
+        first = job->firstRow + b * job->rowsPerBlock;
+        last = first + job->rowsPerBlock;
+        if (last > job->rows) {
+            last = job->rows;
+        }
+
+        for (i = first; i < last; i++) {
+            if (job->column) {
+                row = MAT_ROW(job->mat, 0) + i;
+            } else if (job->matF == NULL) {
+                row = MAT_ROW(job->mat, i);
+            } else {
+                row = job->widened + (size_t) b * job->cols;
+                for (j = 0; j < job->cols; j++) {
+                    row[j] = MAT(job->matF, i, j);
+                }
+            }
+
+            if (appendRow(buffer, row, job->cols) != 0) {
+                job->failed = 1;
+                return;
+            }
+        }
+    }
+}
+
+/* Writes the matrix as %.4f text with large write() calls. Rows are formatted
+ * in blocks of about WRITER_BLOCK_BYTES, one block per thread at a time, and
+ * the blocks are written out in row order. */
+static int writeRows(int fd, struct formatJob *job) {
+    int b, blocks, blockCount = getThreadCount();
+    int last, result = 0;
+    enum memSubsystem previous;
+
+    job->failed = 0;
+    job->rowsPerBlock = WRITER_BLOCK_BYTES / (job->cols * 8 + 1);
+    if (job->rowsPerBlock < 1) {
+        job->rowsPerBlock = 1;
+    }
+
+    previous = memEnter(MEM_OUTPUT);
+    job->buffers = memCalloc(blockCount, sizeof(struct textBuffer));
+    job->widened = job->matF == NULL ? NULL : memAlloc((size_t) blockCount * job->cols * sizeof(double));
+    if (job->buffers == NULL || (job->matF != NULL && job->widened == NULL)) {
+        printErrorMessage();
+        memFree(job->buffers);
+        memFree(job->widened);
+        memLeave(previous);
+        return 1;
+    }
+
+    for (job->firstRow = 0; job->firstRow < job->rows && result == 0;
+         job->firstRow += blocks * job->rowsPerBlock) {
+        blocks = (job->rows - job->firstRow + job->rowsPerBlock - 1) / job->rowsPerBlock;
+        if (blocks > blockCount) {
+            blocks = blockCount;
+        }
+
+        parallelFor(blocks, formatBlocks, job);
+        if (job->failed) {
+            printErrorMessage();
+            result = 1;
+            break;
+        }
+
+        for (b = 0; b < blocks && result == 0; b++) {
+            result = writeAll(fd, job->buffers[b].data, job->buffers[b].len);
+        }
+
+        /* scratch matrices are streamed, rows already written are dropped */
+        last = job->firstRow + blocks * job->rowsPerBlock < job->rows ?
+               job->firstRow + blocks * job->rowsPerBlock : job->rows;
+        if (job->matF == NULL && !job->column) {
+            releaseMatrixRows(job->mat, job->firstRow, last);
+        } else if (job->matF != NULL) {
+            releaseMatrixRowsF(job->matF, job->firstRow, last);
+        }
+    }
+
+    for (b = 0; b < blockCount; b++) {
+        memFree(job->buffers[b].data);
+    }
+
+    memFree(job->buffers);
+    memFree(job->widened);
+    memLeave(previous);
+    return result;
+}
+
+int writeMatrix(int fd, struct matrix *mat) {
+    struct formatJob job;
+
+    job.mat = mat;
+    job.matF = NULL;
+    job.column = 0;
+    job.rows = mat->rows;
+    job.cols = mat->cols;
+
+    return writeRows(fd, &job);
+}
+
+/* Float matrices print exactly like their values widened to double */
+int writeMatrixF(int fd, struct matrixf *mat) {
+    struct formatJob job;
+
+    job.mat = NULL;
+    job.matF = mat;
+    job.column = 0;
+    job.rows = mat->rows;
+    job.cols = mat->cols;
+
+    return writeRows(fd, &job);
+}
+
+/* Writes a 1 x n vector one value per line */
+int writeColumn(int fd, struct matrix *vec) {
+    struct formatJob job;
+
+    job.mat = vec;
+    job.matF = NULL;
+    job.column = 1;
+    job.rows = vec->cols;
+    job.cols = 1;
+
+    return writeRows(fd, &job);
+}
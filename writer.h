@@ -0,0 +1,29 @@
+# ifndef WRITER_H_
+# define WRITER_H_
+
+#include <stddef.h>
+#include "matrix.h"
+
+#define WRITER_STDOUT 1
+#define WRITER_BLOCK_BYTES (1024 * 1024)
+#define WRITER_MAX_NUMBER_LEN 512
+
+struct textBuffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+int formatFixed4(double value, char *out);
+
+int appendRow(struct textBuffer *buffer, const double *row, int cols);
+
+int writeAll(int fd, const char *data, size_t len);
+
+int writeMatrix(int fd, struct matrix *mat);
+
+int writeMatrixF(int fd, struct matrixf *mat);
+
+int writeColumn(int fd, struct matrix *vec);
+
+#endif